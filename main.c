@@ -25,6 +25,9 @@ int main(int argc, char* argv[]) {
         path = argv[1];
     }
 
+    ret = tf_disk_file_register(MY_DISK_ID, "../fat32.vhd");   // vhd: MBR+FAT32
+    exit_if_error(ret);
+
     ret = tf_mount(MY_DISK_ID, 'X');
     exit_if_error(ret);
 
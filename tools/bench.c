@@ -0,0 +1,381 @@
+/**
+ * @brief benchmarks of mount, path open, dir listing and file reads on an image
+ *
+ * the image is read through a counting backend, each bench reports ops/s, MB/s, and disk reads
+ * and sectors per op. every bench starts with a fresh mount, the sector cache is cold but the
+ * image may be in the page cache of the OS, drop it for cold disk numbers.
+ */
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "toyfs.h"
+
+
+#define BENCH_DEV      0
+#define BENCH_PATH_LEN 64
+
+typedef struct {
+    const char* img;
+    int         fd;
+    uint64_t    reads;   // device requests
+    uint64_t    secs;
+} bench_disk_t;
+
+typedef struct {
+    char     path[BENCH_PATH_LEN];
+    uint32_t size;
+} bench_file_t;
+
+static bench_disk_t  disk;
+static bench_file_t* files;
+static uint32_t      file_num;
+static char          (*dirs)[BENCH_PATH_LEN];
+static uint32_t      dir_num;
+static uint64_t      rng = 88172645463325252ull;   // xorshift64, the same ops on every run
+static const char*   index_path;                   // sidecar index used by every mount, -x
+
+
+static int bench_disk_open(void* ctx) {
+    disk.fd = open(disk.img, O_RDONLY);
+    return disk.fd < 0 ? -1 : 0;
+}
+
+static int bench_disk_read(void* ctx, uint32_t sec, uint32_t sec_num, uint16_t sec_size, uint8_t* data) {
+    size_t size = (size_t)sec_num * sec_size;
+
+    disk.reads++;
+    disk.secs += sec_num;
+    return pread(disk.fd, data, size, (off_t)sec * sec_size) == (ssize_t)size ? 0 : -1;
+}
+
+static int bench_disk_close(void* ctx) {
+    close(disk.fd);
+    return 0;
+}
+
+static const tf_disk_ops_t bench_disk_ops = {
+    .open  = bench_disk_open,
+    .read  = bench_disk_read,
+    .close = bench_disk_close,
+};
+
+
+static uint64_t rnd(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void die(const char* what, int ret) {
+    fprintf(stderr, "bench: %s: %d\n", what, ret);
+    exit(1);
+}
+
+static void fs_mount(void) {
+    tf_mount_opt_t opt = {.index_path = index_path};
+
+    int ret = tf_mount_ex(BENCH_DEV, 'X', &opt);
+    if (ret != 0) {
+        die("mount", ret);
+    }
+}
+
+
+typedef struct {
+    const char* name;
+    double      t0;
+    uint64_t    reads0;
+    uint64_t    secs0;
+} bench_run_t;
+
+static void run_begin(bench_run_t* run, const char* name) {
+    run->name   = name;
+    run->reads0 = disk.reads;
+    run->secs0  = disk.secs;
+    run->t0     = now_sec();
+}
+
+static void run_end(bench_run_t* run, uint64_t ops, uint64_t bytes) {
+    double   t     = now_sec() - run->t0;
+    uint64_t reads = disk.reads - run->reads0;
+    uint64_t secs  = disk.secs - run->secs0;
+
+    if (ops == 0) {
+        ops = 1;
+    }
+    printf("%-8s %10llu %12.0f %10.1f %10.2f %10.2f\n", run->name, (unsigned long long)ops, ops / t,
+           bytes / t / 1048576.0, (double)reads / ops, (double)secs / ops);
+}
+
+
+/**
+ * @brief collect all dirs and files below path, not timed
+ */
+static void collect(const char* path) {
+    tf_item_t dir, item;
+    char      name[TF_FN_LEN_MAX];
+
+    if (tf_item_open(path, &dir) != 0) {
+        return;
+    }
+
+    dirs = realloc(dirs, sizeof(*dirs) * (dir_num + 1));
+    snprintf(dirs[dir_num++], BENCH_PATH_LEN, "%s", path);
+
+    while (tf_dir_read(&dir, &item) == 0) {
+        if (item.sfn[0] == '.' || (item.attr & TF_ATTR_VOLUME_ID)) {
+            continue;
+        }
+
+        char sub[BENCH_PATH_LEN];
+        util_sfn2name(item.sfn, name);
+        if (snprintf(sub, sizeof(sub), "%s/%s", strcmp(path, "/") == 0 ? "" : path, name) >= (int)sizeof(sub)) {
+            continue;
+        }
+
+        if (item.attr & TF_ATTR_DIRECTORY) {
+            collect(sub);
+        } else {
+            files = realloc(files, sizeof(bench_file_t) * (file_num + 1));
+            memcpy(files[file_num].path, sub, sizeof(sub));
+            files[file_num++].size = item.size;
+        }
+    }
+}
+
+
+static void bench_mount(uint32_t n) {
+    bench_run_t run;
+
+    run_begin(&run, "mount");
+    for (uint32_t i = 0; i < n; i++) {
+        fs_mount();
+        tf_unmount(BENCH_DEV);
+    }
+    run_end(&run, n, 0);
+}
+
+static void bench_open(uint32_t n) {
+    bench_run_t run;
+    tf_item_t   item;
+
+    fs_mount();
+    run_begin(&run, "open");
+    for (uint32_t i = 0; i < n; i++) {
+        int ret = tf_item_open(files[rnd() % file_num].path, &item);
+        if (ret != 0) {
+            die("open", ret);
+        }
+        tf_item_close(&item);
+    }
+    run_end(&run, n, 0);
+    tf_unmount(BENCH_DEV);
+}
+
+static void bench_list(void) {
+    bench_run_t run;
+    tf_item_t   dir, item;
+    uint64_t    ops = 0;
+
+    fs_mount();
+    run_begin(&run, "list");
+    for (uint32_t i = 0; i < dir_num; i++) {
+        if (tf_item_open(dirs[i], &dir) != 0) {
+            die("open dir", -1);
+        }
+        while (tf_dir_read(&dir, &item) == 0) {
+            ops++;
+        }
+    }
+    run_end(&run, ops, ops * 32);
+    tf_unmount(BENCH_DEV);
+}
+
+static void bench_dirbatch(void) {
+    bench_run_t run;
+    tf_item_t   dir;
+    tf_dirent_t ents[256];
+    uint64_t    ops = 0;
+    int         num;
+
+    fs_mount();
+    run_begin(&run, "dirbatch");
+    for (uint32_t i = 0; i < dir_num; i++) {
+        if (tf_item_open(dirs[i], &dir) != 0) {
+            die("open dir", -1);
+        }
+        while ((num = tf_dir_read_batch(&dir, ents, array_length(ents), TF_DIRENT_NAME | TF_DIRENT_SIZE)) > 0) {
+            ops += num;
+        }
+    }
+    run_end(&run, ops, ops * 32);
+    tf_unmount(BENCH_DEV);
+}
+
+static void bench_seq(uint8_t* buf, uint32_t buf_size) {
+    bench_run_t run;
+    tf_item_t   file;
+    uint64_t    ops   = 0;
+    uint64_t    bytes = 0;
+    int         ret;
+
+    fs_mount();
+    run_begin(&run, "seq");
+    for (uint32_t i = 0; i < file_num; i++) {
+        if (tf_item_open(files[i].path, &file) != 0) {
+            die("open file", -1);
+        }
+        while ((ret = tf_file_read(&file, buf, buf_size)) > 0) {
+            bytes += ret;
+            ops++;
+        }
+        tf_item_close(&file);
+    }
+    run_end(&run, ops, bytes);
+    tf_unmount(BENCH_DEV);
+}
+
+static void bench_rand(uint32_t n, uint8_t* buf, uint32_t read_size) {
+    bench_run_t run;
+    tf_item_t   file;
+    uint64_t    bytes   = 0;
+    uint32_t*   big     = malloc(sizeof(uint32_t) * file_num);
+    uint32_t    big_num = 0;
+
+    if (big == nullptr) {
+        die("no memory", TF_ERR_NO_MEM);
+    }
+
+    // files with at least one read
+    for (uint32_t i = 0; i < file_num; i++) {
+        if (files[i].size >= read_size) {
+            big[big_num++] = i;
+        }
+    }
+    if (big_num == 0) {
+        printf("%-8s no file of %u bytes\n", "rand", read_size);
+        free(big);
+        return;
+    }
+
+    fs_mount();
+    run_begin(&run, "rand");
+    for (uint32_t i = 0; i < n; i++) {
+        bench_file_t* f = &files[big[rnd() % big_num]];
+
+        if (tf_item_open(f->path, &file) != 0) {
+            die("open file", -1);
+        }
+        uint32_t ofs = rnd() % (f->size - read_size + 1) / read_size * read_size;
+        int      ret = tf_file_pread(&file, ofs, buf, read_size);
+        if (ret < 0) {
+            die("pread", ret);
+        }
+        bytes += ret;
+        tf_item_close(&file);
+    }
+    run_end(&run, n, bytes);
+    tf_unmount(BENCH_DEV);
+    free(big);
+}
+
+
+static void usage(void) {
+    printf("usage: bench [options] <image>\n"
+           "  -n <num>     ops of open and rand, default 10000\n"
+           "  -m <num>     ops of mount, default 20\n"
+           "  -B <bytes>   buffer of seq reads, default 65536\n"
+           "  -R <bytes>   size of rand reads, default 4096\n"
+           "  -t <list>    benches, comma separated, from mount,open,list,dirbatch,seq,rand,\n"
+           "               default all\n"
+           "  -x <file>    save a sidecar index of the image to file, and mount with it\n");
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t    n        = 10000;
+    uint32_t    mount_n  = 20;
+    uint32_t    buf_size = 65536;
+    uint32_t    rd_size  = 4096;
+    const char* which    = "mount,open,list,dirbatch,seq,rand";
+    int         opt;
+
+    while ((opt = getopt(argc, argv, "n:m:B:R:t:x:h")) != -1) {
+        switch (opt) {
+        case 'n': n = atoi(optarg); break;
+        case 'm': mount_n = atoi(optarg); break;
+        case 'B': buf_size = atoi(optarg); break;
+        case 'R': rd_size = atoi(optarg); break;
+        case 't': which = optarg; break;
+        case 'x': index_path = optarg; break;
+        default: usage();
+        }
+    }
+    if (optind != argc - 1 || buf_size == 0 || rd_size == 0) {
+        usage();
+    }
+
+    disk.img = argv[optind];
+    int ret  = tf_disk_register(BENCH_DEV, &bench_disk_ops, nullptr);
+    if (ret != 0) {
+        die("register", ret);
+    }
+
+    fs_mount();
+    collect("/");
+    if (index_path != nullptr) {
+#if TF_INDEX
+        ret = tf_index_save(BENCH_DEV, index_path);
+#else
+        ret = TF_ERR_WRONG_PARAM;
+#endif
+        if (ret != 0) {
+            die("index", ret);
+        }
+    }
+    tf_unmount(BENCH_DEV);
+    if (file_num == 0) {
+        die("no file in the image", 0);
+    }
+
+    uint8_t* buf = malloc(buf_size > rd_size ? buf_size : rd_size);
+    if (buf == nullptr) {
+        die("no memory", TF_ERR_NO_MEM);
+    }
+
+    printf("%s: %u dirs, %u files\n", disk.img, dir_num, file_num);
+    printf("%-8s %10s %12s %10s %10s %10s\n", "bench", "ops", "ops/s", "MB/s", "reads/op", "secs/op");
+
+    if (strstr(which, "mount") != nullptr) {
+        bench_mount(mount_n);
+    }
+    if (strstr(which, "open") != nullptr) {
+        bench_open(n);
+    }
+    if (strstr(which, "list") != nullptr) {
+        bench_list();
+    }
+    if (strstr(which, "dirbatch") != nullptr) {
+        bench_dirbatch();
+    }
+    if (strstr(which, "seq") != nullptr) {
+        bench_seq(buf, buf_size);
+    }
+    if (strstr(which, "rand") != nullptr) {
+        bench_rand(n, buf, rd_size);
+    }
+
+    free(buf);
+    free(files);
+    free(dirs);
+    return 0;
+}
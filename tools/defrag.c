@@ -0,0 +1,509 @@
+/**
+ * @brief fragmentation report and offline defragmenter of images
+ *
+ * the tree is listed and the cluster chains are walked by the library. the report has the extents
+ * (runs of continuous clusters) of each file and dir, the totals of the volume and the worst items.
+ * with -o, a copy of the image is written where every chain is one run, laid out depth first: a dir,
+ * the files in it, then its subdirs, so the clusters of a dir sit right before the ones of its files.
+ * root stays at cluster 2, clusters in no chain become free, bad clusters are kept.
+ */
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "toyfs.h"
+
+
+#define DEFRAG_DEV      0
+#define DEFRAG_PATH_LEN 256
+#define DEFRAG_BATCH    64              // dir items listed at once
+#define DEFRAG_CHUNK    (1024 * 1024)   // file bytes copied at once, a multiple of the cluster size
+#define DEFRAG_BAD      0x0FFFFFF7
+#define DEFRAG_EOC      0x0FFFFFFF
+#define DEFRAG_NO_OFS   0xFFFFFFFF
+
+typedef struct {
+    char     path[DEFRAG_PATH_LEN];
+    uint8_t  attr;
+    uint32_t size;
+    int      parent;     // node of the dir contains it, -1 for root
+    uint32_t ofs;        // byte offset of its item in the dir
+    uint32_t dot_ofs;    // of "." and ".." in a dir, DEFRAG_NO_OFS when missing
+    uint32_t dotdot_ofs;
+    uint32_t clus_num;   // clusters of the chain
+    uint32_t ext_num;    // runs of continuous clusters
+    uint32_t new_clus;   // first cluster in the copy, 0 for no cluster
+} defrag_node_t;
+
+static defrag_node_t* nodes;   // root first, then depth first like the layout of the copy
+static uint32_t       node_num;
+static uint32_t       node_cap;
+static tf_fs_t*       fs;
+
+
+static void die(const char* what, int ret) {
+    fprintf(stderr, "defrag: %s: %d\n", what, ret);
+    exit(1);
+}
+
+static bool is_dir(const defrag_node_t* node) {
+    return (node->attr & TF_ATTR_DIRECTORY) != 0;
+}
+
+static void disk_pread(int fd, uint8_t* data, uint32_t size, uint64_t ofs) {
+    if (pread(fd, data, size, ofs) != (ssize_t)size) {
+        die("read failed", TF_ERR_DISK_IO);
+    }
+}
+
+static void disk_pwrite(int fd, const uint8_t* data, uint32_t size, uint64_t ofs) {
+    if (pwrite(fd, data, size, ofs) != (ssize_t)size) {
+        die("write failed", TF_ERR_DISK_IO);
+    }
+}
+
+static uint64_t clus_pos(uint32_t clus) {
+    return ((uint64_t)fs->dat_sec_ofs + (uint64_t)(clus - 2) * fs->clus_sec_num) * fs->sec_size;
+}
+
+
+/**
+ * @brief add a node, count the clusters and extents of its chain
+ *
+ * @return uint32_t index of the node
+ */
+static uint32_t node_add(const char* path, uint8_t attr, uint32_t size, int parent, uint32_t ofs) {
+    tf_item_t item;
+
+    int ret = tf_item_open(path, &item);
+    if (ret != 0) {
+        die(path, ret);
+    }
+
+    int ext_num = tf_item_extents(&item, nullptr, 0);
+    if (ext_num < 0) {
+        die(path, ext_num);
+    }
+    tf_extent_t* exts = malloc(sizeof(tf_extent_t) * (ext_num > 0 ? ext_num : 1));
+    if (exts == nullptr) {
+        die("no memory", TF_ERR_NO_MEM);
+    }
+    tf_item_extents(&item, exts, ext_num);
+
+    if (node_num == node_cap) {
+        node_cap = node_cap > 0 ? node_cap * 2 : 256;
+        nodes    = realloc(nodes, sizeof(defrag_node_t) * node_cap);
+        if (nodes == nullptr) {
+            die("no memory", TF_ERR_NO_MEM);
+        }
+    }
+
+    defrag_node_t* node = &nodes[node_num];
+    memset(node, 0, sizeof(defrag_node_t));
+    snprintf(node->path, sizeof(node->path), "%s", path);
+    node->attr       = attr;
+    node->size       = size;
+    node->parent     = parent;
+    node->ofs        = ofs;
+    node->dot_ofs    = DEFRAG_NO_OFS;
+    node->dotdot_ofs = DEFRAG_NO_OFS;
+    node->ext_num    = ext_num;
+    for (int i = 0; i < ext_num; i++) {
+        node->clus_num += exts[i].len;
+    }
+
+    free(exts);
+    return node_num++;
+}
+
+/**
+ * @brief add the files of a dir, then each subdir and what's below it
+ */
+static void collect(uint32_t d) {
+    char         path[DEFRAG_PATH_LEN];
+    tf_item_t    dir;
+    tf_dirent_t  ents[DEFRAG_BATCH];
+    tf_dirent_t* subs    = nullptr;
+    uint32_t     sub_num = 0;
+    uint32_t     sub_cap = 0;
+    int          num;
+
+    strcpy(path, nodes[d].path);   // nodes may move
+    size_t path_len = strlen(path);
+    bool   slash    = path[path_len - 1] != '/';
+
+    int ret = tf_item_open(path, &dir);
+    if (ret != 0) {
+        die(path, ret);
+    }
+
+    while ((num = tf_dir_read_batch(&dir, ents, DEFRAG_BATCH, TF_DIRENT_NAME | TF_DIRENT_SIZE)) > 0) {
+        for (int i = 0; i < num; i++) {
+            tf_dirent_t* ent = &ents[i];
+
+            if (ent->sfn[0] == '.') {
+                if (ent->sfn[1] == '.') {
+                    nodes[d].dotdot_ofs = ent->ofs;
+                } else {
+                    nodes[d].dot_ofs = ent->ofs;
+                }
+                continue;
+            }
+            if (ent->attr & TF_ATTR_VOLUME_ID) {
+                continue;
+            }
+
+            char name[TF_FN_LEN_MAX];
+            char sub[DEFRAG_PATH_LEN];
+            util_sfn2name(ent->sfn, name);
+            if (snprintf(sub, sizeof(sub), "%s%s%s", path, slash ? "/" : "", name) >= (int)sizeof(sub)) {
+                die("path too long", TF_ERR_PATH_INVALID);
+            }
+
+            if (!(ent->attr & TF_ATTR_DIRECTORY)) {
+                node_add(sub, ent->attr, ent->size, d, ent->ofs);
+                continue;
+            }
+
+            // subdirs go after all files of the dir
+            if (sub_num == sub_cap) {
+                sub_cap = sub_cap > 0 ? sub_cap * 2 : 16;
+                subs    = realloc(subs, sizeof(tf_dirent_t) * sub_cap);
+                if (subs == nullptr) {
+                    die("no memory", TF_ERR_NO_MEM);
+                }
+            }
+            subs[sub_num++] = *ent;
+        }
+    }
+    if (num != TF_STA_READDIR_END) {
+        die(path, num);
+    }
+
+    for (uint32_t i = 0; i < sub_num; i++) {
+        char name[TF_FN_LEN_MAX];
+        char sub[DEFRAG_PATH_LEN];
+        util_sfn2name(subs[i].sfn, name);
+        snprintf(sub, sizeof(sub), "%s%s%s", path, slash ? "/" : "", name);
+        collect(node_add(sub, subs[i].attr, subs[i].size, d, subs[i].ofs));
+    }
+    free(subs);
+}
+
+
+static int worse(const void* a, const void* b) {
+    const defrag_node_t* na = &nodes[*(const uint32_t*)a];
+    const defrag_node_t* nb = &nodes[*(const uint32_t*)b];
+
+    if (na->ext_num != nb->ext_num) {
+        return na->ext_num < nb->ext_num ? 1 : -1;
+    }
+    return na->clus_num < nb->clus_num ? 1 : na->clus_num > nb->clus_num ? -1 : 0;
+}
+
+static void node_print(const defrag_node_t* node) {
+    printf("%8u %9u %8.1f  %s%s\n", node->ext_num, node->clus_num,
+           node->ext_num > 0 ? (double)node->clus_num / node->ext_num : 0.0, node->path,
+           is_dir(node) && node->parent >= 0 ? "/" : "");
+}
+
+/**
+ * @brief print the totals, the worst top items, and every item when all
+ */
+static void report(uint32_t top, bool all) {
+    uint32_t files = 0, dirs = 0, frag_files = 0, frag_dirs = 0;
+    uint64_t clus = 0, exts = 0, used = 0;
+
+    for (uint32_t i = 0; i < node_num; i++) {
+        defrag_node_t* node = &nodes[i];
+
+        if (is_dir(node)) {
+            dirs++;
+            frag_dirs += node->ext_num > 1;
+        } else {
+            files++;
+            frag_files += node->ext_num > 1;
+        }
+        clus += node->clus_num;
+        exts += node->ext_num;
+        used += node->ext_num > 0;
+    }
+
+    printf("%u files, %u dirs, %llu clusters of %u B in %llu extents, %.1f clusters per extent\n", files, dirs,
+           (unsigned long long)clus, fs->sec_size * fs->clus_sec_num, (unsigned long long)exts,
+           exts > 0 ? (double)clus / exts : 0.0);
+    printf("fragmented: %u files (%.1f%%), %u dirs (%.1f%%), %llu extents more than one per chain\n", frag_files,
+           files > 0 ? 100.0 * frag_files / files : 0.0, frag_dirs, dirs > 0 ? 100.0 * frag_dirs / dirs : 0.0,
+           (unsigned long long)(exts - used));
+
+    uint32_t* order = malloc(sizeof(uint32_t) * node_num);
+    if (order == nullptr) {
+        die("no memory", TF_ERR_NO_MEM);
+    }
+    for (uint32_t i = 0; i < node_num; i++) {
+        order[i] = i;
+    }
+
+    if (all) {
+        printf("\n%8s %9s %8s  %s\n", "extents", "clusters", "avg run", "path");
+        for (uint32_t i = 0; i < node_num; i++) {
+            node_print(&nodes[i]);
+        }
+    }
+
+    qsort(order, node_num, sizeof(uint32_t), worse);
+    if (top > 0 && node_num > 0 && nodes[order[0]].ext_num > 1) {
+        printf("\nworst:\n%8s %9s %8s  %s\n", "extents", "clusters", "avg run", "path");
+        for (uint32_t i = 0; i < top && i < node_num && nodes[order[i]].ext_num > 1; i++) {
+            node_print(&nodes[order[i]]);
+        }
+    }
+
+    free(order);
+}
+
+
+/**
+ * @brief give every chain a run in the new FAT, in node order
+ *
+ * @param fat bad clusters set, all others free except the 2 reserved
+ * @return uint32_t the cluster after the last one used
+ */
+static uint32_t layout(uint32_t* fat) {
+    uint32_t cursor = 2;
+
+    for (uint32_t i = 0; i < node_num; i++) {
+        uint32_t prev = 0;
+
+        for (uint32_t k = 0; k < nodes[i].clus_num; k++) {
+            while (cursor < fs->clus_num && fat[cursor] == DEFRAG_BAD) {
+                cursor++;   // the run is broken here
+            }
+            if (cursor >= fs->clus_num) {
+                die("no space for cross-linked chains", TF_ERR_NO_SPACE);
+            }
+            if (prev != 0) {
+                fat[prev] = cursor;
+            } else {
+                nodes[i].new_clus = cursor;
+            }
+            prev = cursor++;
+        }
+        if (prev != 0) {
+            fat[prev] = DEFRAG_EOC;
+        }
+    }
+
+    if (nodes[0].new_clus != 2) {
+        die("root can't stay at cluster 2", TF_ERR_NO_SPACE);
+    }
+    return cursor;
+}
+
+/**
+ * @brief point an item to the new first cluster
+ */
+static void item_patch(uint8_t* data, uint32_t ofs, uint32_t clus) {
+    util_set_value_to_block(data + ofs, 20, 2, clus >> 16);      // DIR_FstClusHI
+    util_set_value_to_block(data + ofs, 26, 2, clus & 0xFFFF);   // DIR_FstClusLO
+}
+
+/**
+ * @brief copy the chain of a node to its new run, the items of a dir point to the new clusters
+ *
+ * @param out fd of the copy
+ * @param d node
+ * @param fat the new FAT
+ * @param buf DEFRAG_CHUNK bytes, or the whole chain of a dir
+ */
+static void node_copy(int out, uint32_t d, const uint32_t* fat, uint8_t* buf) {
+    defrag_node_t* node      = &nodes[d];
+    uint32_t       clus_size = fs->sec_size * fs->clus_sec_num;
+    uint64_t       total     = (uint64_t)node->clus_num * clus_size;
+    uint32_t       clus      = node->new_clus;
+    tf_item_t      item;
+
+    if (node->clus_num == 0) {
+        return;
+    }
+
+    int ret = tf_item_open(node->path, &item);
+    if (ret != 0) {
+        die(node->path, ret);
+    }
+
+    // a dir is copied at once, a file by chunks
+    uint32_t chunk = is_dir(node) ? total : DEFRAG_CHUNK;
+    for (uint64_t ofs = 0; ofs < total; ofs += chunk) {
+        uint32_t len = total - ofs < chunk ? total - ofs : chunk;
+
+        int n = tf_file_pread(&item, ofs, buf, len);   // a file is read up to its size
+        if (n < 0) {
+            die(node->path, n);
+        }
+        memset(buf + n, 0, len - n);
+
+        if (is_dir(node)) {
+            for (uint32_t i = d + 1; i < node_num; i++) {
+                if (nodes[i].parent == (int)d) {
+                    item_patch(buf, nodes[i].ofs, nodes[i].new_clus);
+                }
+            }
+            if (node->dot_ofs != DEFRAG_NO_OFS) {
+                item_patch(buf, node->dot_ofs, node->new_clus);
+            }
+            if (node->dotdot_ofs != DEFRAG_NO_OFS) {
+                item_patch(buf, node->dotdot_ofs, node->parent > 0 ? nodes[node->parent].new_clus : 0);
+            }
+        }
+
+        // write by runs, a run is broken only by bad clusters
+        for (uint32_t done = 0; done < len;) {
+            uint32_t first = clus;
+            uint32_t run   = clus_size;
+
+            while (done + run < len && fat[clus] == clus + 1) {
+                clus++;
+                run += clus_size;
+            }
+            disk_pwrite(out, buf + done, run, clus_pos(first));
+            done += run;
+            clus = fat[clus];
+        }
+    }
+}
+
+/**
+ * @brief write a defragmented copy of the image
+ */
+static void write_copy(const char* img, const char* out_path) {
+    struct stat st_in, st_out;
+
+    int in  = open(img, O_RDONLY);
+    int out = open(out_path, O_RDWR | O_CREAT, 0644);
+    if (in < 0 || out < 0) {
+        die("can't open the images", TF_ERR_DISK_IO);
+    }
+    if (fstat(in, &st_in) != 0 || fstat(out, &st_out) != 0) {
+        die("can't stat the images", TF_ERR_DISK_IO);
+    }
+    if (st_in.st_dev == st_out.st_dev && st_in.st_ino == st_out.st_ino) {
+        die("the copy should not be the image", TF_ERR_WRONG_PARAM);
+    }
+
+    uint32_t clus_size = fs->sec_size * fs->clus_sec_num;
+    uint32_t fat_size  = fs->fat_sec_num * fs->sec_size;
+    uint32_t dir_max   = 0;
+    for (uint32_t i = 0; i < node_num; i++) {
+        if (is_dir(&nodes[i]) && nodes[i].clus_num * clus_size > dir_max) {
+            dir_max = nodes[i].clus_num * clus_size;
+        }
+    }
+
+    uint32_t* fat = malloc(fat_size);
+    uint8_t*  buf = malloc(dir_max > DEFRAG_CHUNK ? dir_max : DEFRAG_CHUNK);
+    if (fat == nullptr || buf == nullptr) {
+        die("no memory", TF_ERR_NO_MEM);
+    }
+
+    // everything before the data area stays the same, like MBR, boot sectors and FSInfo
+    off_t size = lseek(in, 0, SEEK_END);   // st_size is 0 for a block device
+    if (size <= 0 || ftruncate(out, 0) != 0 || ftruncate(out, size) != 0) {
+        die("can't size the copy", TF_ERR_DISK_IO);
+    }
+    for (uint64_t ofs = 0; ofs < (uint64_t)fs->dat_sec_ofs * fs->sec_size; ofs += DEFRAG_CHUNK) {
+        uint64_t len = (uint64_t)fs->dat_sec_ofs * fs->sec_size - ofs;
+        len          = len < DEFRAG_CHUNK ? len : DEFRAG_CHUNK;
+        disk_pread(in, buf, len, ofs);
+        disk_pwrite(out, buf, len, ofs);
+    }
+
+    // the new FAT keeps the 2 reserved entries and the bad clusters
+    disk_pread(in, (uint8_t*)fat, fat_size, (uint64_t)fs->fat_sec_ofs * fs->sec_size);
+    for (uint32_t c = 2; c < fat_size / 4; c++) {
+        fat[c] = (fat[c] & 0x0FFFFFFF) == DEFRAG_BAD && c < fs->clus_num ? DEFRAG_BAD : 0;
+    }
+    uint32_t next_free = layout(fat);
+
+    for (uint32_t i = 0; i < node_num; i++) {
+        node_copy(out, i, fat, buf);
+    }
+
+    for (uint32_t f = 0; f < fs->fat_num; f++) {
+        uint64_t sec = (uint64_t)fs->fat_sec_ofs + (uint64_t)f * fs->fat_sec_num;
+        disk_pwrite(out, (uint8_t*)fat, fat_size, sec * fs->sec_size);
+    }
+
+    uint32_t free_num = 0;
+    for (uint32_t c = 2; c < fs->clus_num; c++) {
+        free_num += fat[c] == 0;
+    }
+    disk_pread(out, buf, fs->sec_size, (uint64_t)fs->fsinfo_sec * fs->sec_size);
+    util_set_value_to_block(buf, 488, 4, free_num);    // FSI_Free_Count
+    util_set_value_to_block(buf, 492, 4, next_free);   // FSI_Nxt_Free
+    disk_pwrite(out, buf, fs->sec_size, (uint64_t)fs->fsinfo_sec * fs->sec_size);
+
+    if (fsync(out) != 0) {
+        die("can't sync the copy", TF_ERR_DISK_IO);
+    }
+    printf("\n%s: %u chains in %u clusters from cluster 2, %u clusters free\n", out_path, node_num, next_free - 2,
+           free_num);
+
+    free(fat);
+    free(buf);
+    close(in);
+    close(out);
+}
+
+
+static void usage(void) {
+    printf("usage: defrag [options] <image>\n"
+           "  -n <num>     worst items listed, default 10\n"
+           "  -a           list every item\n"
+           "  -o <image>   write a defragmented copy, the image is not changed\n");
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t    top = 10;
+    bool        all = false;
+    const char* out = nullptr;
+    int         opt;
+
+    while ((opt = getopt(argc, argv, "n:ao:h")) != -1) {
+        switch (opt) {
+        case 'n': top = atoi(optarg); break;
+        case 'a': all = true; break;
+        case 'o': out = optarg; break;
+        default: usage();
+        }
+    }
+    if (optind != argc - 1) {
+        usage();
+    }
+
+    int ret = tf_disk_file_register(DEFRAG_DEV, argv[optind]);
+    if (ret == 0) {
+        ret = tf_mount(DEFRAG_DEV, 'X');
+    }
+    if (ret != 0) {
+        die("mount", ret);
+    }
+
+    node_add("X:/", TF_ATTR_DIRECTORY, 0, -1, 0);
+    collect(0);
+
+    tf_item_t root;
+    tf_item_open("X:/", &root);
+    fs = root.fs;
+
+    printf("%s: ", argv[optind]);
+    report(top, all);
+    if (out != nullptr) {
+        write_copy(argv[optind], out);
+    }
+
+    tf_unmount(DEFRAG_DEV);
+    free(nodes);
+    return 0;
+}
@@ -0,0 +1,516 @@
+/**
+ * @brief generator of MBR+FAT32 images for benchmarks, the same options give the same image
+ *
+ * the volume starts at 1 MiB, root dir has LARGE.BIN and a tree of dirs D0000.. with files
+ * F000000.DAT.., every dir below root has `fanout` sub dirs until `levels` deep, and `files` files.
+ * cluster runs of files and dirs are broken by the fragmentation level.
+ */
+#include <fcntl.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+#define MKIMG_RSVD_SEC  32
+#define MKIMG_FAT_NUM   2
+#define MKIMG_EOC       0x0FFFFFFF
+#define MKIMG_ITEM_SIZE 32
+#define MKIMG_DIR_MAX   65536   // items of a dir
+
+enum {
+    SIZE_FIXED,
+    SIZE_UNIFORM,
+    SIZE_EXP,
+};
+
+typedef struct {
+    // options
+    uint32_t vol_mb;
+    uint32_t sec_size;
+    uint32_t clus_sec;
+    uint32_t fanout;
+    uint32_t levels;
+    uint32_t files;
+    int      size_dist;
+    uint64_t size_a;
+    uint64_t size_b;
+    uint32_t frag;       // percent
+    uint32_t large_mb;
+    uint64_t seed;
+
+    // layout
+    int       fd;
+    uint32_t  vol_ofs;   // in sectors
+    uint32_t  sec_total;
+    uint32_t  fat_sec;
+    uint32_t  dat_ofs;   // in sectors, of the disk
+    uint32_t  clus_num;  // include the 2 reserved
+    uint32_t  clus_size;
+    uint32_t* fat;
+    uint32_t  cursor;    // next cluster for a continuous run
+    uint32_t  low_free;  // no free cluster below
+    uint64_t  rng;
+    uint8_t*  buf;       // a cluster
+
+    // result
+    uint32_t dir_cnt;
+    uint32_t file_cnt;
+    uint64_t data_bytes;
+    uint32_t runs;
+    uint32_t free_num;
+} mkimg_t;
+
+
+static void put16(uint8_t* p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put32(uint8_t* p, uint32_t v) {
+    put16(p, v);
+    put16(p + 2, v >> 16);
+}
+
+// xorshift64*, the same numbers on every libc
+static uint64_t rnd(mkimg_t* m) {
+    m->rng ^= m->rng >> 12;
+    m->rng ^= m->rng << 25;
+    m->rng ^= m->rng >> 27;
+    return m->rng * 2685821657736338717ull;
+}
+
+static double rnd_unit(mkimg_t* m) {
+    return (rnd(m) >> 11) * (1.0 / 9007199254740992.0);   // [0, 1)
+}
+
+static void die(const char* msg) {
+    fprintf(stderr, "mkimg: %s\n", msg);
+    exit(1);
+}
+
+static void disk_write(mkimg_t* m, uint64_t sec, const uint8_t* data, uint32_t size) {
+    if (pwrite(m->fd, data, size, sec * m->sec_size) != (ssize_t)size) {
+        die("write failed");
+    }
+}
+
+
+/**
+ * @brief find a free cluster from clus, wrap to the start
+ *
+ * @return uint32_t 0 when full
+ */
+static uint32_t clus_find_free(mkimg_t* m, uint32_t clus) {
+    if (clus < m->low_free || clus >= m->clus_num) {
+        clus = m->low_free;
+    }
+    for (uint32_t i = clus; i < m->clus_num; i++) {
+        if (m->fat[i] == 0) {
+            return i;
+        }
+    }
+    for (uint32_t i = m->low_free; i < clus; i++) {
+        if (m->fat[i] == 0) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief allocate a chain, each cluster starts a new run at a random place by the fragmentation level
+ *
+ * @param m
+ * @param num cluster number, > 0
+ * @param chain result value, the clusters
+ */
+static void clus_alloc(mkimg_t* m, uint32_t num, uint32_t* chain) {
+    for (uint32_t i = 0; i < num; i++) {
+        uint32_t clus;
+
+        if (m->low_free >= m->clus_num) {
+            die("image full, use a larger -m or smaller files");
+        }
+        if (m->frag > 0 && rnd(m) % 100 < m->frag) {
+            clus = clus_find_free(m, m->low_free + rnd(m) % (m->clus_num - m->low_free));
+        } else {
+            clus = clus_find_free(m, m->cursor);
+        }
+        if (clus == 0) {
+            die("image full, use a larger -m or smaller files");
+        }
+
+        m->fat[clus] = MKIMG_EOC;
+        if (i > 0) {
+            m->fat[chain[i - 1]] = clus;
+        }
+        if (i == 0 || clus != chain[i - 1] + 1) {
+            m->runs++;
+        }
+        chain[i]  = clus;
+        m->cursor = clus + 1;
+        while (m->low_free < m->clus_num && m->fat[m->low_free] != 0) {
+            m->low_free++;
+        }
+    }
+}
+
+static uint64_t clus_sec(mkimg_t* m, uint32_t clus) {
+    return m->dat_ofs + (uint64_t)(clus - 2) * m->clus_sec;
+}
+
+
+static uint64_t file_size(mkimg_t* m) {
+    switch (m->size_dist) {
+    case SIZE_UNIFORM:
+        return m->size_a + rnd(m) % (m->size_b - m->size_a + 1);
+    case SIZE_EXP:
+        return (uint64_t)(-log(1.0 - rnd_unit(m)) * m->size_a);
+    default:
+        return m->size_a;
+    }
+}
+
+/**
+ * @brief allocate and write the data of a file, every byte is (id * 131 + offset) & 0xFF
+ *
+ * @return uint32_t first cluster, 0 for empty file
+ */
+static uint32_t file_write(mkimg_t* m, uint32_t id, uint64_t size) {
+    if (size == 0) {
+        return 0;
+    }
+
+    uint32_t  num   = (size + m->clus_size - 1) / m->clus_size;
+    uint32_t* chain = malloc(sizeof(uint32_t) * num);
+    if (chain == NULL) {
+        die("no memory");
+    }
+    clus_alloc(m, num, chain);
+
+    for (uint32_t i = 0; i < num; i++) {
+        uint64_t ofs = (uint64_t)i * m->clus_size;
+        uint32_t len = size - ofs < m->clus_size ? size - ofs : m->clus_size;
+
+        for (uint32_t k = 0; k < len; k++) {
+            m->buf[k] = (uint8_t)(id * 131 + ofs + k);
+        }
+        memset(m->buf + len, 0, m->clus_size - len);
+        disk_write(m, clus_sec(m, chain[i]), m->buf, m->clus_size);
+    }
+
+    uint32_t first = chain[0];
+    free(chain);
+
+    m->data_bytes += size;
+    return first;
+}
+
+static void item_make(uint8_t* raw, const char* sfn, uint8_t attr, uint32_t clus, uint32_t size) {
+    memset(raw, 0, MKIMG_ITEM_SIZE);
+    memcpy(raw, sfn, 11);
+    raw[11] = attr;
+    put16(raw + 16, 0x0021);   // DIR_CrtDate 1980-01-01
+    put16(raw + 18, 0x0021);   // DIR_LstAccDate
+    put16(raw + 20, clus >> 16);
+    put16(raw + 24, 0x0021);   // DIR_WrtDate
+    put16(raw + 26, clus & 0xFFFF);
+    put32(raw + 28, size);
+}
+
+/**
+ * @brief write a dir and all below it
+ *
+ * @param m
+ * @param clus first cluster of the dir, allocated by the parent, 2 for root
+ * @param parent first cluster of the parent, 0 for root and its sub dirs
+ * @param level 0 for root
+ */
+static void dir_write(mkimg_t* m, uint32_t clus, uint32_t parent, uint32_t level) {
+    uint32_t dir_num  = level < m->levels ? m->fanout : 0;
+    uint32_t file_num = level > 0 ? m->files : 0;
+    uint32_t item_num = (level > 0 ? 2 : 1 + (m->large_mb > 0)) + dir_num + file_num;
+
+    if (item_num > MKIMG_DIR_MAX) {
+        die("too many items in a dir");
+    }
+
+    uint32_t  clus_num = (item_num * MKIMG_ITEM_SIZE + m->clus_size - 1) / m->clus_size;
+    uint32_t* chain    = malloc(sizeof(uint32_t) * clus_num);
+    uint8_t*  raw      = calloc(clus_num, m->clus_size);
+    uint32_t* subs     = malloc(sizeof(uint32_t) * (dir_num + 1));
+    uint32_t  n        = 0;
+    char      sfn[24];
+
+    if (chain == NULL || raw == NULL || subs == NULL) {
+        die("no memory");
+    }
+
+    // the first cluster is given, the rest follow it like other chains
+    chain[0] = clus;
+    if (clus_num > 1) {
+        clus_alloc(m, clus_num - 1, chain + 1);
+        m->fat[clus] = chain[1];
+    }
+
+    if (level == 0) {
+        item_make(raw + MKIMG_ITEM_SIZE * n++, "TOYFS      ", 0x08, 0, 0);
+        if (m->large_mb > 0) {
+            uint32_t size = m->large_mb * 1024 * 1024;
+            item_make(raw + MKIMG_ITEM_SIZE * n++, "LARGE   BIN", 0x20, file_write(m, m->file_cnt++, size), size);
+        }
+    } else {
+        item_make(raw + MKIMG_ITEM_SIZE * n++, ".          ", 0x10, clus, 0);
+        item_make(raw + MKIMG_ITEM_SIZE * n++, "..         ", 0x10, parent, 0);
+    }
+
+    for (uint32_t i = 0; i < dir_num; i++) {
+        // allocated here to have the cluster for the item, written after the files
+        clus_alloc(m, 1, &subs[i]);
+        snprintf(sfn, sizeof(sfn), "D%04u      ", i);
+        item_make(raw + MKIMG_ITEM_SIZE * n++, sfn, 0x10, subs[i], 0);
+    }
+
+    for (uint32_t i = 0; i < file_num; i++) {
+        uint64_t size = file_size(m);
+        if (size > 0xFFFFFFFFull) {
+            size = 0xFFFFFFFFull;
+        }
+        snprintf(sfn, sizeof(sfn), "F%06u DAT", i);
+        item_make(raw + MKIMG_ITEM_SIZE * n++, sfn, 0x20, file_write(m, m->file_cnt++, size), size);
+    }
+
+    for (uint32_t i = 0; i < clus_num; i++) {
+        disk_write(m, clus_sec(m, chain[i]), raw + (size_t)i * m->clus_size, m->clus_size);
+    }
+    m->dir_cnt++;
+
+    for (uint32_t i = 0; i < dir_num; i++) {
+        dir_write(m, subs[i], level == 0 ? 0 : clus, level + 1);
+    }
+
+    free(chain);
+    free(raw);
+    free(subs);
+}
+
+
+static void layout(mkimg_t* m) {
+    m->vol_ofs   = 1024 * 1024 / m->sec_size;
+    m->sec_total = (uint64_t)m->vol_mb * 1024 * 1024 / m->sec_size;
+    m->clus_size = m->sec_size * m->clus_sec;
+
+    // FAT for all sectors as clusters is a bit large, the clusters are counted again after it
+    uint32_t clus = (m->sec_total - MKIMG_RSVD_SEC) / m->clus_sec + 2;
+    m->fat_sec    = ((uint64_t)clus * 4 + m->sec_size - 1) / m->sec_size;
+    m->clus_num   = (m->sec_total - MKIMG_RSVD_SEC - MKIMG_FAT_NUM * m->fat_sec) / m->clus_sec + 2;
+    m->dat_ofs    = m->vol_ofs + MKIMG_RSVD_SEC + MKIMG_FAT_NUM * m->fat_sec;
+
+    if (m->clus_num < 3 + 2 || m->clus_num > 0x0FFFFFF5) {
+        die("bad volume size for the cluster size");
+    }
+    if (m->clus_num - 2 < 65525) {
+        fprintf(stderr, "mkimg: %u clusters, FAT16 for other tools, fine for toyfs\n", m->clus_num - 2);
+    }
+}
+
+static void write_meta(mkimg_t* m) {
+    uint8_t* sec = calloc(1, m->sec_size);
+
+    if (sec == NULL) {
+        die("no memory");
+    }
+    for (uint32_t i = 2; i < m->clus_num; i++) {
+        m->free_num += m->fat[i] == 0;
+    }
+
+    // MBR, one FAT32 (LBA) partition
+    uint8_t* pe = sec + 446;
+    pe[4]       = 0x0C;
+    put32(pe + 8, m->vol_ofs);
+    put32(pe + 12, m->sec_total);
+    sec[510] = 0x55;
+    sec[511] = 0xAA;
+    disk_write(m, 0, sec, m->sec_size);
+
+    // boot sector, and its backup at 6
+    memset(sec, 0, m->sec_size);
+    memcpy(sec, "\xEB\x58\x90TOYFS   ", 11);
+    put16(sec + 11, m->sec_size);             // BPB_BytsPerSec
+    sec[13] = m->clus_sec;                    // BPB_SecPerClus
+    put16(sec + 14, MKIMG_RSVD_SEC);          // BPB_RsvdSecCnt
+    sec[16] = MKIMG_FAT_NUM;                  // BPB_NumFATs
+    sec[21] = 0xF8;                           // BPB_Media
+    put16(sec + 24, 63);                      // BPB_SecPerTrk
+    put16(sec + 26, 255);                     // BPB_NumHeads
+    put32(sec + 28, m->vol_ofs);              // BPB_HiddSec
+    put32(sec + 32, m->sec_total);            // BPB_TotSec32
+    put32(sec + 36, m->fat_sec);              // BPB_FATSz32
+    put32(sec + 44, 2);                       // BPB_RootClus
+    put16(sec + 48, 1);                       // BPB_FSInfo
+    put16(sec + 50, 6);                       // BPB_BkBootSec
+    sec[64] = 0x80;                           // BS_DrvNum
+    sec[66] = 0x29;                           // BS_BootSig
+    put32(sec + 67, (uint32_t)m->seed);       // BS_VolID
+    memcpy(sec + 71, "TOYFS      FAT32   ", 19);
+    sec[510] = 0x55;
+    sec[511] = 0xAA;
+    disk_write(m, m->vol_ofs, sec, m->sec_size);
+    disk_write(m, m->vol_ofs + 6, sec, m->sec_size);
+
+    // FSInfo, and its backup at 7
+    memset(sec, 0, m->sec_size);
+    put32(sec + 0, 0x41615252);
+    put32(sec + 484, 0x61417272);
+    put32(sec + 488, m->free_num);
+    put32(sec + 492, m->low_free);
+    put32(sec + 508, 0xAA550000);
+    disk_write(m, m->vol_ofs + 1, sec, m->sec_size);
+    disk_write(m, m->vol_ofs + 7, sec, m->sec_size);
+
+    for (int i = 0; i < MKIMG_FAT_NUM; i++) {
+        disk_write(m, m->vol_ofs + MKIMG_RSVD_SEC + (uint64_t)i * m->fat_sec, (uint8_t*)m->fat,
+                   m->fat_sec * m->sec_size);
+    }
+
+    free(sec);
+}
+
+
+/**
+ * @brief parse a byte size like 4096, 16k, 2m
+ */
+static uint64_t parse_size(const char* s) {
+    char*    end;
+    uint64_t v = strtoull(s, &end, 10);
+
+    if (*end == 'k' || *end == 'K') {
+        v *= 1024;
+    } else if (*end == 'm' || *end == 'M') {
+        v *= 1024 * 1024;
+    }
+    return v;
+}
+
+static void parse_dist(mkimg_t* m, const char* s) {
+    const char* arg = strchr(s, ':');
+
+    if (arg == NULL) {
+        die("bad -s, like fixed:4k, uniform:0:64k or exp:16k");
+    }
+    arg++;
+
+    if (strncmp(s, "fixed:", 6) == 0) {
+        m->size_dist = SIZE_FIXED;
+        m->size_a    = parse_size(arg);
+    } else if (strncmp(s, "uniform:", 8) == 0 && strchr(arg, ':') != NULL) {
+        m->size_dist = SIZE_UNIFORM;
+        m->size_a    = parse_size(arg);
+        m->size_b    = parse_size(strchr(arg, ':') + 1);
+        if (m->size_b < m->size_a) {
+            die("bad -s, max < min");
+        }
+    } else if (strncmp(s, "exp:", 4) == 0) {
+        m->size_dist = SIZE_EXP;
+        m->size_a    = parse_size(arg);
+    } else {
+        die("bad -s, like fixed:4k, uniform:0:64k or exp:16k");
+    }
+}
+
+static void usage(void) {
+    printf("usage: mkimg [options] <image>\n"
+           "  -m <MB>      volume size, default 512\n"
+           "  -b <bytes>   sector size, 512, 1024, 2048 or 4096, default 512\n"
+           "  -c <num>     sectors per cluster, default 8\n"
+           "  -d <num>     sub dirs of each dir (fan-out), default 4\n"
+           "  -l <num>     dir levels below root, default 2\n"
+           "  -f <num>     files in each dir below root, default 64\n"
+           "  -s <dist>    file sizes, fixed:N, uniform:MIN:MAX or exp:MEAN, k and m suffixes, default exp:16k\n"
+           "  -F <0-100>   fragmentation, percent of clusters starting a new run at a random place, default 0\n"
+           "  -L <MB>      size of /LARGE.BIN, default 16, 0 for none\n"
+           "  -r <seed>    random seed, default 1\n");
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    mkimg_t m = {0};
+    int     opt;
+
+    m.vol_mb    = 512;
+    m.sec_size  = 512;
+    m.clus_sec  = 8;
+    m.fanout    = 4;
+    m.levels    = 2;
+    m.files     = 64;
+    m.size_dist = SIZE_EXP;
+    m.size_a    = 16 * 1024;
+    m.large_mb  = 16;
+    m.seed      = 1;
+
+    while ((opt = getopt(argc, argv, "m:b:c:d:l:f:s:F:L:r:h")) != -1) {
+        switch (opt) {
+        case 'm': m.vol_mb = atoi(optarg); break;
+        case 'b': m.sec_size = atoi(optarg); break;
+        case 'c': m.clus_sec = atoi(optarg); break;
+        case 'd': m.fanout = atoi(optarg); break;
+        case 'l': m.levels = atoi(optarg); break;
+        case 'f': m.files = atoi(optarg); break;
+        case 's': parse_dist(&m, optarg); break;
+        case 'F': m.frag = atoi(optarg); break;
+        case 'L': m.large_mb = atoi(optarg); break;
+        case 'r': m.seed = strtoull(optarg, NULL, 0); break;
+        default: usage();
+        }
+    }
+    if (optind != argc - 1) {
+        usage();
+    }
+    if (m.sec_size < 512 || m.sec_size > 4096 || (m.sec_size & (m.sec_size - 1)) != 0) {
+        die("bad -b");
+    }
+    if (m.clus_sec == 0 || m.clus_sec > 128 || (m.clus_sec & (m.clus_sec - 1)) != 0) {
+        die("bad -c");
+    }
+    if (m.frag > 100) {
+        die("bad -F");
+    }
+
+    m.rng = m.seed * 0x9E3779B97F4A7C15ull + 1;   // never 0
+    layout(&m);
+
+    m.fat = calloc(m.clus_num, sizeof(uint32_t));
+    m.buf = malloc(m.clus_size);
+    if (m.fat == NULL || m.buf == NULL) {
+        die("no memory");
+    }
+    m.fat[0]   = 0x0FFFFFF8;
+    m.fat[1]   = MKIMG_EOC;
+    m.fat[2]   = MKIMG_EOC;   // root
+    m.cursor   = 3;
+    m.low_free = 3;
+
+    m.fd = open(argv[optind], O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (m.fd < 0) {
+        die("can't create the image");
+    }
+    if (ftruncate(m.fd, (off_t)(m.vol_ofs + m.sec_total) * m.sec_size) != 0) {
+        die("can't size the image");
+    }
+
+    dir_write(&m, 2, 0, 0);
+    write_meta(&m);
+    close(m.fd);
+
+    printf("%s: %u MB, %u B sectors, %u B clusters, %u dirs, %u files, %.1f MB data, %u runs, %u clusters free\n",
+           argv[optind], m.vol_mb, m.sec_size, m.clus_size, m.dir_cnt, m.file_cnt, m.data_bytes / 1048576.0, m.runs,
+           m.free_num);
+
+    free(m.fat);
+    free(m.buf);
+    return 0;
+}
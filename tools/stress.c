@@ -0,0 +1,313 @@
+/**
+ * @brief multithreaded stress of concurrent readers on an image, needs TF_THREAD_SAFE
+ *
+ * a sample of the files is read once by a single thread first, with the item count of every dir.
+ * then many threads open random paths and read them with tf_file_read and tf_file_pread, or list
+ * dirs with tf_dir_read, and check every result against the ones read first, while another thread
+ * keeps dropping the caches with tf_cache_invalidate. build it with -fsanitize=thread to check the
+ * locking too.
+ */
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "toyfs.h"
+
+#if !TF_THREAD_SAFE
+#error "set TF_THREAD_SAFE to 1 in toyfs_cfg.h"
+#endif
+
+
+#define STRESS_DEV       0
+#define STRESS_PATH_LEN  64
+#define STRESS_MAX_THRDS 64
+#define STRESS_PREADS    8           // preads of a file in one op
+#define STRESS_READ_MAX  (1 << 16)   // max bytes of a read or pread
+
+typedef struct {
+    char     path[STRESS_PATH_LEN];
+    uint32_t size;
+    uint8_t* data;    // files only, read before the threads start
+    uint32_t items;   // dirs only, items listed by tf_dir_read
+} stress_node_t;
+
+typedef struct {
+    uint64_t rng;
+    uint64_t reads;
+    uint64_t preads;
+    uint64_t lists;
+} stress_thrd_t;
+
+static stress_node_t* files;
+static uint32_t       file_num;
+static uint32_t       file_max = 256;
+static stress_node_t* dirs;
+static uint32_t       dir_num;
+static uint32_t       op_num   = 2000;   // ops of each reader
+static int            stop;
+static int            bad;
+static uint64_t       invalidates;
+
+
+static void die(const char* what, int ret) {
+    fprintf(stderr, "stress: %s: %d\n", what, ret);
+    exit(1);
+}
+
+static uint64_t rnd(stress_thrd_t* thrd) {
+    thrd->rng ^= thrd->rng << 13;
+    thrd->rng ^= thrd->rng >> 7;
+    thrd->rng ^= thrd->rng << 17;
+    return thrd->rng;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fail(const char* what, const char* path, int ret) {
+    printf("%s %s: %d\n", what, path, ret);
+    __atomic_fetch_add(&bad, 1, __ATOMIC_RELAXED);
+}
+
+static uint32_t dir_count(tf_item_t* dir) {
+    tf_item_t item;
+    uint32_t  num = 0;
+
+    while (tf_dir_read(dir, &item) == 0) {
+        num++;
+    }
+    return num;
+}
+
+
+/**
+ * @brief collect the dirs below path with their item counts, and up to file_max files, not timed
+ */
+static void collect(const char* path) {
+    tf_item_t dir, item;
+    char      name[TF_FN_LEN_MAX];
+
+    if (tf_item_open(path, &dir) != 0) {
+        return;
+    }
+
+    dirs = realloc(dirs, sizeof(stress_node_t) * (dir_num + 1));
+    memset(&dirs[dir_num], 0, sizeof(stress_node_t));
+    snprintf(dirs[dir_num].path, STRESS_PATH_LEN, "%s", path);
+    dirs[dir_num++].items = dir_count(&dir);
+
+    tf_item_open(path, &dir);
+    while (tf_dir_read(&dir, &item) == 0) {
+        if (item.sfn[0] == '.' || (item.attr & TF_ATTR_VOLUME_ID)) {
+            continue;
+        }
+
+        char sub[STRESS_PATH_LEN];
+        util_sfn2name(item.sfn, name);
+        if (snprintf(sub, sizeof(sub), "%s/%s", strcmp(path, "/") == 0 ? "" : path, name) >= (int)sizeof(sub)) {
+            continue;
+        }
+
+        if (item.attr & TF_ATTR_DIRECTORY) {
+            collect(sub);
+        } else if (file_num < file_max) {
+            files = realloc(files, sizeof(stress_node_t) * (file_num + 1));
+            memset(&files[file_num], 0, sizeof(stress_node_t));
+            memcpy(files[file_num].path, sub, sizeof(sub));
+            files[file_num++].size = item.size;
+        }
+    }
+}
+
+/**
+ * @brief read the files collected, the data the threads check with
+ */
+static void load(void) {
+    tf_item_t file;
+
+    for (uint32_t i = 0; i < file_num; i++) {
+        stress_node_t* f = &files[i];
+
+        f->data = malloc(f->size > 0 ? f->size : 1);
+        if (f->data == nullptr) {
+            die("no memory", TF_ERR_NO_MEM);
+        }
+        if (tf_item_open(f->path, &file) != 0 || tf_file_read(&file, f->data, f->size) != (int)f->size) {
+            die("read", TF_ERR_DISK_IO);
+        }
+        tf_item_close(&file);
+    }
+}
+
+
+static void op_read(stress_thrd_t* thrd, const stress_node_t* f, uint8_t* buf) {
+    tf_item_t file;
+    uint32_t  chunk = 1 + rnd(thrd) % STRESS_READ_MAX;
+    uint32_t  ofs   = 0;
+    int       ret;
+
+    if ((ret = tf_item_open(f->path, &file)) != 0) {
+        fail("open", f->path, ret);
+        return;
+    }
+    while ((ret = tf_file_read(&file, buf, chunk)) > 0) {
+        if (ofs + ret > f->size || memcmp(buf, f->data + ofs, ret) != 0) {
+            fail("read mismatch", f->path, ofs);
+            break;
+        }
+        ofs += ret;
+    }
+    if (ret < 0 || ofs != f->size) {
+        fail("read", f->path, ret < 0 ? ret : (int)ofs);
+    }
+    tf_item_close(&file);
+    thrd->reads++;
+}
+
+static void op_pread(stress_thrd_t* thrd, const stress_node_t* f, uint8_t* buf) {
+    tf_item_t file;
+    int       ret;
+
+    if ((ret = tf_item_open(f->path, &file)) != 0) {
+        fail("open", f->path, ret);
+        return;
+    }
+    for (int i = 0; i < STRESS_PREADS && f->size > 0; i++) {
+        uint32_t ofs  = rnd(thrd) % f->size;
+        uint32_t size = 1 + rnd(thrd) % STRESS_READ_MAX;
+        uint32_t want = f->size - ofs < size ? f->size - ofs : size;
+
+        ret = tf_file_pread(&file, ofs, buf, size);
+        if (ret != (int)want || memcmp(buf, f->data + ofs, want) != 0) {
+            fail("pread mismatch", f->path, ofs);
+        }
+    }
+    tf_item_close(&file);
+    thrd->preads++;
+}
+
+static void op_list(stress_thrd_t* thrd, const stress_node_t* d) {
+    tf_item_t dir;
+    int       ret;
+
+    if ((ret = tf_item_open(d->path, &dir)) != 0) {
+        fail("open dir", d->path, ret);
+        return;
+    }
+    uint32_t num = dir_count(&dir);
+    if (num != d->items) {
+        fail("list mismatch", d->path, num);
+    }
+    if ((ret = tf_item_open("/NOPE/NOPE.TXT", &dir)) != TF_ERR_PATH_NOT_FOUND) {
+        fail("open missing", "/NOPE/NOPE.TXT", ret);
+    }
+    thrd->lists++;
+}
+
+static void* reader(void* arg) {
+    stress_thrd_t* thrd = arg;
+    uint8_t*       buf  = malloc(STRESS_READ_MAX);
+
+    if (buf == nullptr) {
+        die("no memory", TF_ERR_NO_MEM);
+    }
+    for (uint32_t i = 0; i < op_num; i++) {
+        switch (rnd(thrd) % 3) {
+        case 0: op_read(thrd, &files[rnd(thrd) % file_num], buf); break;
+        case 1: op_pread(thrd, &files[rnd(thrd) % file_num], buf); break;
+        default: op_list(thrd, &dirs[rnd(thrd) % dir_num]); break;
+        }
+    }
+    free(buf);
+    return nullptr;
+}
+
+static void* invalidator(void* arg) {
+    stress_thrd_t* thrd = arg;
+
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        tf_cache_invalidate(STRESS_DEV, nullptr);
+        tf_cache_invalidate(STRESS_DEV, dirs[rnd(thrd) % dir_num].path);
+        invalidates++;
+    }
+    return nullptr;
+}
+
+
+static void usage(void) {
+    printf("usage: stress [options] <image>\n"
+           "  -t <num>     reader threads, default 8\n"
+           "  -n <num>     ops of each reader, default 2000\n"
+           "  -f <num>     files read into memory to check with, default 256\n");
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    int           thrd_num = 8;
+    int           opt;
+    pthread_t     tids[STRESS_MAX_THRDS + 1];
+    stress_thrd_t thrds[STRESS_MAX_THRDS + 1] = {0};
+
+    while ((opt = getopt(argc, argv, "t:n:f:h")) != -1) {
+        switch (opt) {
+        case 't': thrd_num = atoi(optarg); break;
+        case 'n': op_num = atoi(optarg); break;
+        case 'f': file_max = atoi(optarg); break;
+        default: usage();
+        }
+    }
+    if (optind != argc - 1 || thrd_num <= 0 || thrd_num > STRESS_MAX_THRDS || file_max == 0) {
+        usage();
+    }
+
+    int ret = tf_disk_file_register(STRESS_DEV, argv[optind]);
+    if (ret != 0) {
+        die("register", ret);
+    }
+    if ((ret = tf_mount(STRESS_DEV, 'X')) != 0) {
+        die("mount", ret);
+    }
+
+    collect("/");
+    if (file_num == 0) {
+        die("no file in the image", 0);
+    }
+    load();
+    tf_cache_invalidate(STRESS_DEV, nullptr);   // the threads start cold
+    printf("%s: %u dirs, %u files checked, %d threads\n", argv[optind], dir_num, file_num, thrd_num);
+
+    double t0 = now_sec();
+    for (int i = 0; i <= thrd_num; i++) {
+        thrds[i].rng = 88172645463325252ull + i;
+        if (pthread_create(&tids[i], nullptr, i < thrd_num ? reader : invalidator, &thrds[i]) != 0) {
+            die("thread", i);
+        }
+    }
+    for (int i = 0; i < thrd_num; i++) {
+        pthread_join(tids[i], nullptr);
+    }
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    pthread_join(tids[thrd_num], nullptr);
+
+    uint64_t reads = 0, preads = 0, lists = 0;
+    for (int i = 0; i < thrd_num; i++) {
+        reads += thrds[i].reads;
+        preads += thrds[i].preads;
+        lists += thrds[i].lists;
+    }
+    printf("%llu reads, %llu preads, %llu lists, %llu invalidates in %.2f s\n", (unsigned long long)reads,
+           (unsigned long long)preads, (unsigned long long)lists, (unsigned long long)invalidates, now_sec() - t0);
+    printf("stress: %d bad\n", bad);
+
+    tf_unmount(STRESS_DEV);
+    for (uint32_t i = 0; i < file_num; i++) {
+        free(files[i].data);
+    }
+    free(files);
+    free(dirs);
+    return bad != 0;
+}
@@ -1,5 +1,18 @@
 #include "toyfs.h"
 
+#if TF_FAT_SIMD && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define TF_FAT_SIMD_X86 1
+#else
+#define TF_FAT_SIMD_X86 0
+#endif
+
+#if TF_INDEX
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #define TF_DIRITEM_SIZE           32
 #define TF_CLUSTER_ID_VALID(clus) (clus < 0x0FFFFFF8)
@@ -14,513 +27,5218 @@
 #define TF_FILEATTR_DELETED        0x40   // not for user
 #define TF_FILEATTR_EMPTY          0xFF   // not for user
 #define TF_MASK_MATCH(attr, mask)  (((attr) & (mask)) == (mask))
+#define TF_DIR_SIZE_MAX            (65536 * TF_DIRITEM_SIZE)
+#define TF_DATE_NO_RTC             0x0021   // 1980-01-01, for the dates of new items
+#define TF_CLUSMAP_SCAN_SEC        64       // FAT sectors read at once when building clusmap
+#define TF_CLUSMAP_RUN_MIN         16       // shorter free runs are skipped for a new place, room for appends
+#define TF_DIRBATCH_SIZE           65536    // dir bytes read at once by tf_dir_read_batch
+#define TF_WALK_BATCH              64       // items listed a call by tf_walk
+
+// sections of the sidecar index after its header
+#define TF_INDEX_NODES(hdr)     ((const tf_index_node_t*)((hdr) + 1))
+#define TF_INDEX_EXTS(hdr)      ((const tf_extent_t*)(TF_INDEX_NODES(hdr) + (hdr)->node_num))
+#define TF_INDEX_NAME_HASH(hdr) ((const int32_t*)(TF_INDEX_EXTS(hdr) + (hdr)->ext_num))
+#define TF_INDEX_CLUS_HASH(hdr) (TF_INDEX_NAME_HASH(hdr) + (1u << (hdr)->hash_bits))
+
+#if TF_STATS
+#define TF_STAT_ADD(fs, name, n) tf_atomic_add(&(fs)->stats.name, (n))
+#else
+#define TF_STAT_ADD(fs, name, n) ((void)0)
+#endif
 
 
 // global
-static tf_fs_t fs_pool[TF_MAX_FS_NUM] = {0};
+static tf_fs_t    fs_pool[TF_MAX_FS_NUM]     = {0};
+static tf_mutex_t fs_pool_lock               = TF_MUTEX_INITIALIZER;   // for mount and unmount
+static tf_fs_t*   fs_by_label[256]           = {0};                    // mounted fs of each label
+static tf_fs_t*   fs_by_dev[TF_MAX_DEV_NUM]  = {0};                    // mounted fs of each device
+static tf_fs_t*   fs_first                   = nullptr;                // fs of paths like "/a/b"
 
 
 /**
- * @brief get next cluster id from fat table, use cache
+ * @brief write back FAT sectors to all copies of FAT, for the FAT cache
+ *
+ * @param ctx the fs
+ * @param sec sector index in FAT
+ * @param sec_num
+ * @param data
+ * @return int 0, -1
+ */
+static int tf_fat_wb(void* ctx, uint32_t sec, uint32_t sec_num, const uint8_t* data) {
+    tf_fs_t* fs  = ctx;
+    int      ret = 0;
+
+    for (uint8_t i = 0; i < fs->fat_num; i++) {
+        if (tf_disk_writen_co(fs->dev, fs->fat_sec_ofs + fs->fat_sec_num * i + sec, sec_num, fs->sec_size, data) != 0) {
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+
+/**
+ * @brief init the FAT cache, load the whole FAT when it's small enough
  *
  * @param fs
- * @param clus_id
- * @return uint32_t
+ * @return int 0, TF_ERR_NO_MEM, TF_ERR_DISK_IO
  */
-static uint32_t tf_next_cluster(tf_fs_t* fs, uint32_t clus_id) {
-    if (!fs->fatcache_inited ||   // cache not inited
-        (clus_id < fs->fatcache_start) || (clus_id - fs->fatcache_start >= (TF_DEFALUT_SECTOR_SIZE / 4))) {
-        // read fat from disk
-        fs->fatcache_start  = clus_id & (~(uint32_t)(TF_DEFALUT_SECTOR_SIZE / 4 - 1));
-        fs->fatcache_inited = true;
-        tf_disk_read_co(fs->dev, fs->fat_sec_ofs + fs->fatcache_start / (TF_DEFALUT_SECTOR_SIZE / 4), fs->sec_size,
-                        (uint8_t*)fs->fatcache);
+static int tf_fat_init(tf_fs_t* fs) {
+    tf_mutex_init(&fs->fat_lock);
+
+#if TF_FAT_RESIDENT
+    uint32_t fat_size = fs->fat_sec_num * fs->sec_size;
+    if (fat_size <= fs->fatcache_size) {
+        fs->fat      = malloc(fat_size);
+        fs->fatdirty = calloc((fs->fat_sec_num + 31) / 32, sizeof(uint32_t));
+        if (fs->fat == nullptr || fs->fatdirty == nullptr) {
+            free(fs->fat);
+            free(fs->fatdirty);
+            fs->fat      = nullptr;
+            fs->fatdirty = nullptr;
+            tf_mutex_deinit(&fs->fat_lock);
+            return TF_ERR_NO_MEM;
+        }
+        if (tf_disk_readn_co(fs->dev, fs->fat_sec_ofs, fs->fat_sec_num, fs->sec_size, (uint8_t*)fs->fat) != 0) {
+            free(fs->fat);
+            free(fs->fatdirty);
+            fs->fat      = nullptr;
+            fs->fatdirty = nullptr;
+            tf_mutex_deinit(&fs->fat_lock);
+            return TF_ERR_DISK_IO;
+        }
+        return 0;
     }
+#endif
 
-    return fs->fatcache[clus_id - fs->fatcache_start];
+    fs->fatwin = malloc(TF_FATCACHE_WINDOW * fs->sec_size);
+    if (fs->fatwin == nullptr) {
+        tf_mutex_deinit(&fs->fat_lock);
+        return TF_ERR_NO_MEM;
+    }
+    if (tf_cache_init(&fs->fatcache, fs->fatcache_size / fs->sec_size, fs->sec_size) != 0) {
+        free(fs->fatwin);
+        fs->fatwin = nullptr;
+        tf_mutex_deinit(&fs->fat_lock);
+        return TF_ERR_NO_MEM;
+    }
+    fs->fatcache.wb     = tf_fat_wb;
+    fs->fatcache.wb_ctx = fs;
+    return 0;
 }
 
 
 /**
- * @brief read sector from disk, use cache
+ * @brief free the FAT cache
  *
  * @param fs
- * @param sec
  */
-static void tf_fs_disk_read(tf_fs_t* fs, uint32_t sec) {
-    if (!fs->cache_inited || sec != fs->cache_sec) {
-        fs->cache_sec    = sec;
-        fs->cache_inited = true;
-        tf_disk_read_co(fs->dev, sec, fs->sec_size, fs->cache);
-    }
+static void tf_fat_deinit(tf_fs_t* fs) {
+    free(fs->fat);
+    free(fs->fatdirty);
+    free(fs->fatwin);
+    free(fs->clusmap);
+    fs->fat      = nullptr;
+    fs->fatdirty = nullptr;
+    fs->fatwin   = nullptr;
+    fs->clusmap  = nullptr;
+    tf_cache_deinit(&fs->fatcache);
+    tf_mutex_deinit(&fs->fat_lock);
 }
 
 
 /**
- * @brief prefetch file data from disk to ram cache
+ * @brief get a sector of FAT from the FAT cache, read a window of sectors when missed
  *
- * @param item: file or dir
- * @return bool: return false when no data can prefetch (all cluster has been read)
+ * called with fs->fat_lock held, the data is valid until the next call
+ *
+ * @param fs
+ * @param fat_sec sector index in FAT
+ * @return uint32_t* nullptr when io error
  */
-static bool tf_item_data_prefetch(tf_item_t* item) {
-    tf_fs_t* fs = item->fs;
+static uint32_t* tf_fat_sec_get(tf_fs_t* fs, uint32_t fat_sec) {
+    uint32_t* cached = (uint32_t*)tf_cache_lookup(&fs->fatcache, fat_sec);
+    if (cached != nullptr) {
+        return cached;
+    }
 
-    // byte offset in current cluster
-    uint16_t cur_clus_ofs = item->cur_ofs % (fs->sec_size * fs->clus_sec_num);
+    // read a window of FAT sectors, chains are mostly local
+    uint32_t win = fs->fat_sec_num - fat_sec < TF_FATCACHE_WINDOW ? fs->fat_sec_num - fat_sec : TF_FATCACHE_WINDOW;
+    bool     skip[TF_FATCACHE_WINDOW];
 
-    // if current cluster read finished, try find next cluster
-    if (item->cur_ofs != 0 && cur_clus_ofs == 0) {
-        // find next cluster
-        uint32_t next_clus = tf_next_cluster(fs, item->cur_clus);
+    // the cached ones may be changed, and written back if evicted below, keep them
+    for (uint32_t i = 0; i < win; i++) {
+        skip[i] = tf_cache_contains(&fs->fatcache, fat_sec + i);
+    }
+    if (tf_disk_readn_co(fs->dev, fs->fat_sec_ofs + fat_sec, win, fs->sec_size, fs->fatwin) != 0) {
+        return nullptr;
+    }
 
-        if (TF_CLUSTER_ID_VALID(next_clus)) {
-            item->cur_clus = next_clus;
-        } else {
-            // no next cluster
-            return false;
+    // the wanted one last, not evicted by the others
+    for (uint32_t i = win; i-- > 0;) {
+        if (!skip[i]) {
+            cached = (uint32_t*)tf_cache_insert(&fs->fatcache, fat_sec + i);
+            memcpy(cached, fs->fatwin + i * fs->sec_size, fs->sec_size);
         }
     }
+    return cached;
+}
 
-    tf_fs_disk_read(fs, fs->dat_sec_ofs + fs->clus_sec_num * (item->cur_clus - 2) + (cur_clus_ofs / fs->sec_size));
 
-    return true;
+/**
+ * @brief read an entry of the resident FAT, without fat_lock mostly
+ *
+ * tf_fat_reload rewrites the entries with fat_lock held and fs->fat_seq odd, a read meanwhile waits
+ * for it on fat_lock, not spinning
+ *
+ * @param fs FAT resident
+ * @param clus_id
+ * @return uint32_t the entry
+ */
+static uint32_t tf_fat_resident_get(tf_fs_t* fs, uint32_t clus_id) {
+    uint32_t seq = tf_atomic_load_acq(&fs->fat_seq);
+    uint32_t ent = tf_atomic_load_acq(&fs->fat[clus_id]);
+
+    if ((seq & 1) == 0 && tf_atomic_load(&fs->fat_seq) == seq) {
+        return ent;
+    }
+
+    tf_mutex_lock(&fs->fat_lock);
+    ent = tf_atomic_load(&fs->fat[clus_id]);
+    tf_mutex_unlock(&fs->fat_lock);
+    return ent;
 }
 
 
 /**
- * @brief parse a directory item from raw data
+ * @brief get next cluster id from fat table, use cache
  *
- * @param raw
- * @param item
+ * @param fs
+ * @param clus_id
+ * @return uint32_t next cluster id, 0x0FFFFFFF when no next or io error
  */
-static void tf_item_parse(uint8_t* raw, tf_item_t* item) {
-    uint8_t attr = util_get_value_from_block(raw, 11, 1);   // DIR_Attr  11  1
+static uint32_t tf_next_cluster(tf_fs_t* fs, uint32_t clus_id) {
+    TF_TRACE_SCOPE(TF_TRACE_NEXT_CLUS, clus_id);
 
-    if (attr == 0) {
-        item->attr = TF_FILEATTR_EMPTY;
-    } else if (raw[0] == 0xE5) {
-        item->attr = TF_FILEATTR_DELETED;
-    } else if (TF_MASK_MATCH(attr, TF_FILEATTR_LONG_FILE_NAME)) {
-        // lfn
-        item->attr = attr;
-#if TF_LFN_SUPPORTTED
-        item->name[TF_LFN_LEN_MAX - 1] = util_get_value_from_block(raw, 0, 1);   // LDIR_Ord 0   1
-        memcpy(item->name + 0, raw + 1, 10);                                     // p1       1   10
-        memcpy(item->name + 10, raw + 14, 12);                                   // p2       14  12
-        memcpy(item->name + 22, raw + 28, 4);                                    // p3       28  4
-#endif
-    } else {
-        // sfn
-        item->attr = attr;
+    if (clus_id >= fs->clus_num) {
+        return 0x0FFFFFFF;
+    }
 
-        memcpy(item->sfn, raw + 0, 11);   // DIR_Name  0   11
-        item->sfn[TF_SFN_LEN - 1] = '\0';
+    if (fs->fat != nullptr) {
+        return tf_fat_resident_get(fs, clus_id) & 0x0FFFFFFF;
+    }
+
+    uint32_t clus_per_sec = fs->sec_size / 4;
+    uint32_t next         = 0x0FFFFFFF;
 
-        uint16_t temp          = util_get_value_from_block(raw, 24, 2);      // DIR_WrtDate    24 2
-        item->write_time.year  = 1980 + (temp >> 9);                         // [15:9]
-        item->write_time.month = (temp >> 9) & 0x0F;                         // [8:5]
-        item->write_time.day   = temp & 0x1F;                                // [4:0]
+    // the window read is done with the lock held, chains are mostly walked once into the extent maps
+    tf_mutex_lock(&fs->fat_lock);
 
-        temp                   = util_get_value_from_block(raw, 22, 2);      // DIR_WrtTime    22 2
-        item->write_time.year  = temp >> 11;                                 // [15:11]
-        item->write_time.month = (temp >> 5) & 0x3F;                         // [10:5]
-        item->write_time.day   = temp & 0x1F;                                // [4:0]
+    uint32_t* cached = tf_fat_sec_get(fs, clus_id / clus_per_sec);
+    if (cached != nullptr) {
+        next = cached[clus_id % clus_per_sec] & 0x0FFFFFFF;
+    }
 
-        temp                    = util_get_value_from_block(raw, 16, 2);     // DIR_CrtDate    16 2
-        item->create_time.year  = 1980 + (temp >> 9);                        // [15:9]
-        item->create_time.month = (temp >> 9) & 0x0F;                        // [8:5]
-        item->create_time.day   = temp & 0x1F;                               // [4:0]
+    tf_mutex_unlock(&fs->fat_lock);
 
-        temp                    = util_get_value_from_block(raw, 14, 2);     // DIR_CrtTime    14 2
-        item->create_time.year  = temp >> 11;                                // [15:11]
-        item->create_time.month = (temp >> 5) & 0x3F;                        // [10:5]
-        item->create_time.day   = temp & 0x1F;                               // [4:0]
+    return next;
+}
 
-        item->first_clus = (util_get_value_from_block(raw, 20, 2) << 16) |   // DIR_FstClusHI  20 2
-                           util_get_value_from_block(raw, 26, 2);            // DIR_FstClusLO  26 2
-        item->size = util_get_value_from_block(raw, 28, 4);                  // DIR_FileSize   28 4
 
-        item->cur_clus = item->first_clus;
+/**
+ * @brief set the bits of used clusters of FAT entries, scalar
+ *
+ * @param ents FAT entries
+ * @param num count of ents
+ * @param base cluster id of ents[0]
+ * @param map bitmap, bits of ents should be cleared
+ * @return uint32_t count of free entries
+ */
+static uint32_t tf_fat_scan_used_c(const uint32_t* ents, uint32_t num, uint32_t base, uint32_t* map) {
+    uint32_t free_num = 0;
+
+    for (uint32_t i = 0; i < num; i++) {
+        if (ents[i] & 0x0FFFFFFF) {
+            util_bitmap_set(map, base + i);
+        } else {
+            free_num++;
+        }
     }
+    return free_num;
 }
 
 
+#if TF_FAT_SIMD_X86
 /**
- * @brief mount a device to file system
+ * @brief tf_fat_scan_used_c with SSE2, 4 entries a step, a bitmap word of 32 entries at once
  *
- * @param dev device id
- * @param label
- * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_MOUNT_LABEL_USED, TF_ERR_NO_FREE_FS, TF_ERR_NO_FAT32LBA
+ * @param base should be a multiple of 32
  */
-int tf_mount(int dev, char label) {
-    uint16_t volume_ofs = 0;
+__attribute__((target("sse2"))) static uint32_t tf_fat_scan_used_sse2(const uint32_t* ents, uint32_t num,
+                                                                      uint32_t base, uint32_t* map) {
+    const __m128i mask     = _mm_set1_epi32(0x0FFFFFFF);
+    const __m128i zero     = _mm_setzero_si128();
+    uint32_t      free_num = 0;
+    uint32_t      i        = 0;
 
-    if (label == 0) {
-        return TF_ERR_WRONG_PARAM;
-    }
+    for (; i + 32 <= num; i += 32) {
+        uint32_t freebits = 0;
 
-    int free = TF_MAX_FS_NUM;
-    for (int i = 0; i < TF_MAX_FS_NUM; i++) {
-        if (fs_pool[i].label == label) {
-            return TF_ERR_MOUNT_LABEL_USED;
+        for (uint32_t j = 0; j < 32; j += 4) {
+            __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i*)&ents[i + j]), mask);
+            freebits |= (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, zero))) << j;
         }
+        map[(base + i) / 32] |= ~freebits;
+        free_num += __builtin_popcount(freebits);
+    }
+    return free_num + tf_fat_scan_used_c(&ents[i], num - i, base + i, map);
+}
 
-        if (free == TF_MAX_FS_NUM && fs_pool[i].label == 0) {
-            free = i;
+
+/**
+ * @brief tf_fat_scan_used_c with AVX2, 8 entries a step, a bitmap word of 32 entries at once
+ *
+ * @param base should be a multiple of 32
+ */
+__attribute__((target("avx2"))) static uint32_t tf_fat_scan_used_avx2(const uint32_t* ents, uint32_t num,
+                                                                      uint32_t base, uint32_t* map) {
+    const __m256i mask     = _mm256_set1_epi32(0x0FFFFFFF);
+    const __m256i zero     = _mm256_setzero_si256();
+    uint32_t      free_num = 0;
+    uint32_t      i        = 0;
+
+    for (; i + 32 <= num; i += 32) {
+        uint32_t freebits = 0;
+
+        for (uint32_t j = 0; j < 32; j += 8) {
+            __m256i v = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)&ents[i + j]), mask);
+            freebits |= (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, zero))) << j;
         }
+        map[(base + i) / 32] |= ~freebits;
+        free_num += __builtin_popcount(freebits);
     }
-    if (free == TF_MAX_FS_NUM) {
-        return TF_ERR_NO_FREE_FS;
-    }
-
-    tf_fs_t* fs = &fs_pool[free];
-    memset(fs, 0, sizeof(tf_fs_t));
-    fs->label    = label;
-    fs->dev      = dev;
-    fs->sec_size = TF_DEFALUT_SECTOR_SIZE;
+    return free_num + tf_fat_scan_used_c(&ents[i], num - i, base + i, map);
+}
+#endif
 
-    // read first sector
-    tf_fs_disk_read(fs, 0);
 
-#if TF_WITH_MBR
-    // find first FAT32(LBA) partition
-    int i = 0;
-    for (i = 0; i < 4; i++) {
-        if (util_get_value_from_block(fs->cache, 446 + 16 * i + 4, 1) == 0x0C) {   // 0x0C: FAT32 (LBA)
-            volume_ofs = util_get_value_from_block(fs->cache, 446 + 16 * i + 8, 4);
-            break;
+/**
+ * @brief set the bits of used clusters of FAT entries, with the vector kernel the cpu supports
+ *
+ * @param ents FAT entries
+ * @param num count of ents
+ * @param base cluster id of ents[0]
+ * @param map bitmap, bits of ents should be cleared
+ * @return uint32_t count of free entries
+ */
+static uint32_t tf_fat_scan_used(const uint32_t* ents, uint32_t num, uint32_t base, uint32_t* map) {
+#if TF_FAT_SIMD_X86
+    // whole words of the bitmap are written, base is a sector of FAT, aligned when sec_size >= 128
+    if (base % 32 == 0) {
+        if (__builtin_cpu_supports("avx2")) {
+            return tf_fat_scan_used_avx2(ents, num, base, map);
+        }
+        if (__builtin_cpu_supports("sse2")) {
+            return tf_fat_scan_used_sse2(ents, num, base, map);
         }
     }
-    if (i == 4) {        // no fat32lba partition
-        fs->label = 0;   // free
-        return TF_ERR_NO_FAT32LBA;
+#endif
+    return tf_fat_scan_used_c(ents, num, base, map);
+}
+
+
+#if TF_INDEX
+/**
+ * @brief stop using the sidecar index at the first change of the volume, and mark the file stale,
+ * so it's not used by later mounts either
+ *
+ * called with fs->write_lock held. the mapping is kept until unmount, lookups going on may read it
+ *
+ * @param fs
+ */
+static void tf_index_stale(tf_fs_t* fs) {
+    if (fs->index_fd < 0) {
+        return;
     }
-#else
-    // no MBR
+
+    tf_atomic_store(&fs->index_on, 0);
+
+    uint32_t stale = 1;
+    if (pwrite(fs->index_fd, &stale, sizeof(stale), offsetof(tf_index_hdr_t, stale)) != sizeof(stale)) {
+        // opened read only, a later mount still finds a changed FAT by fat_sum
+    }
+    close(fs->index_fd);
+    fs->index_fd = -1;
+}
 #endif
 
-    // read Boot sector
-    tf_fs_disk_read(fs, volume_ofs);
 
-    // check partition at volume_ofs is FAT32LBA
-    // todo
+/**
+ * @brief set a FAT entry, the change is written to disk at tf_fat_flush
+ *
+ * @param fs
+ * @param clus_id
+ * @param value next cluster id, 0 for free, 0x0FFFFFFF for end of chain
+ * @return int 0, TF_ERR_DISK_IO
+ */
+static int tf_fat_set(tf_fs_t* fs, uint32_t clus_id, uint32_t value) {
+    uint32_t clus_per_sec = fs->sec_size / 4;
+    uint32_t fat_sec      = clus_id / clus_per_sec;
+    int      ret          = 0;
 
-    fs->sec_size            = util_get_value_from_block(fs->cache, 11, 2);   // BPB_BytsPerSec
-    fs->clus_sec_num        = util_get_value_from_block(fs->cache, 13, 1);   // BPB_SecPerClus
-    uint16_t resv_sec_num   = util_get_value_from_block(fs->cache, 14, 2);   // BPB_RsvdSecCnt
-    uint8_t  fat_num        = util_get_value_from_block(fs->cache, 16, 1);   // BPB_NumFATs
-    // uint32_t hidden_sec_num = util_get_value_from_block(fs->cache, 28, 4);   // BPB_HiddSec
-    fs->sec_num_total       = util_get_value_from_block(fs->cache, 32, 4);   // BPB_TotSec32
-    uint32_t fat_sec_num    = util_get_value_from_block(fs->cache, 36, 4);   // BPB_FATSz32
-    uint16_t fsinfo_sec     = util_get_value_from_block(fs->cache, 48, 2);   // BPB_FSInfo
+#if TF_INDEX
+    tf_index_stale(fs);
+#endif
 
-    // read FSInfo sector
-    tf_fs_disk_read(fs, volume_ofs + fsinfo_sec);
+    tf_mutex_lock(&fs->fat_lock);
 
-    fs->free_clus_num  = util_get_value_from_block(fs->cache, 488, 4);   // FSI_Free_Count
-    fs->next_free_clus = util_get_value_from_block(fs->cache, 492, 4);   // FSI_Nxt_Free
+    if (fs->fat != nullptr) {
+        // the high 4 bits are reserved, keep them. tf_next_cluster reads it without fat_lock
+        tf_atomic_store_rel(&fs->fat[clus_id], (fs->fat[clus_id] & 0xF0000000) | (value & 0x0FFFFFFF));
+        util_bitmap_set(fs->fatdirty, fat_sec);
+    } else {
+        uint32_t* cached = tf_fat_sec_get(fs, fat_sec);
+        if (cached != nullptr) {
+            uint32_t* ent = &cached[clus_id % clus_per_sec];
+            *ent          = (*ent & 0xF0000000) | (value & 0x0FFFFFFF);
+            tf_cache_mark_dirty(&fs->fatcache, fat_sec);
+        } else {
+            ret = TF_ERR_DISK_IO;
+        }
+    }
 
-    fs->fat_sec_ofs = volume_ofs + resv_sec_num;
-    fs->dat_sec_ofs = fs->fat_sec_ofs + fat_sec_num * fat_num;
+    tf_mutex_unlock(&fs->fat_lock);
 
-    return 0;
+    return ret;
 }
 
+
 /**
- * @brief unmount device
+ * @brief write the changed FAT sectors to all copies of FAT, continuous ones together
  *
- * @param dev id
- * @return int 0, TF_ERR_FS_UNMOUNT
+ * @param fs
+ * @return int 0, TF_ERR_DISK_IO
  */
-int tf_unmount(int dev) {
-    int i;
-    for (i = 0; i < TF_MAX_FS_NUM; i++) {
-        if (fs_pool[i].dev == dev) {
-            break;
+static int tf_fat_flush(tf_fs_t* fs) {
+    int ret = 0;
+
+    tf_mutex_lock(&fs->fat_lock);
+
+    if (fs->fat != nullptr) {
+        for (uint32_t sec = 0; sec < fs->fat_sec_num;) {
+            if (!util_bitmap_chk(fs->fatdirty, sec)) {
+                sec++;
+                continue;
+            }
+
+            uint32_t end = sec;
+            while (end < fs->fat_sec_num && util_bitmap_chk(fs->fatdirty, end)) {
+                util_bitmap_clr(fs->fatdirty, end);
+                end++;
+            }
+            if (tf_fat_wb(fs, sec, end - sec, (uint8_t*)fs->fat + sec * fs->sec_size) != 0) {
+                ret = TF_ERR_DISK_IO;
+            }
+            sec = end;
         }
-    }
-    if (i == TF_MAX_FS_NUM) {
-        return TF_ERR_FS_UNMOUNT;
+    } else if (tf_cache_flush(&fs->fatcache) != 0) {
+        ret = TF_ERR_DISK_IO;
     }
 
-    fs_pool[i].label = 0;
+    tf_mutex_unlock(&fs->fat_lock);
 
-    return 0;
+    return ret;
 }
 
 
 /**
- * @brief open a file or dir
+ * @brief read FAT sectors in a large piece for scanning the whole FAT, not through the FAT cache,
+ * with the changes not written yet
  *
- * @param path absolute path, like "/xxx" or "X:/xxx"
- * @param item the file or dir at the path, result value
- * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_PATH_INVALID, TF_ERR_PATH_NOT_FOUND, TF_ERR_ITEM_NOT_DIR
+ * @param fs FAT not resident
+ * @param sec sector index in FAT
+ * @param sec_num
+ * @param buf result value
+ * @return int 0, TF_ERR_DISK_IO
  */
-int tf_item_open(const char* path, tf_item_t* item) {
-    if (path == nullptr || item == nullptr) {
-        return TF_ERR_WRONG_PARAM;
+static int tf_fat_scan_read(tf_fs_t* fs, uint32_t sec, uint32_t sec_num, uint8_t* buf) {
+    if (tf_disk_readn_co(fs->dev, fs->fat_sec_ofs + sec, sec_num, fs->sec_size, buf) != 0) {
+        return TF_ERR_DISK_IO;
     }
 
-    int pathlen = strlen(path);
-
-    if (pathlen == 0) {
-        return TF_ERR_PATH_INVALID;
+    tf_mutex_lock(&fs->fat_lock);
+    for (uint32_t i = 0; i < sec_num && fs->fatcache.dirty_num > 0; i++) {
+        uint8_t* dirty = tf_cache_dirty_data(&fs->fatcache, sec + i);
+        if (dirty != nullptr) {
+            memcpy(buf + i * fs->sec_size, dirty, fs->sec_size);
+        }
     }
+    tf_mutex_unlock(&fs->fat_lock);
 
-    // path could be like "/a/b/c" or "x:/a/b/c"
-    if (!(path[0] == '/') && !(pathlen >= 3 && path[1] == ':' && path[2] == '/')) {
-        return TF_ERR_PATH_INVALID;
+    return 0;
+}
+
+
+/**
+ * @brief build the bitmap of used clusters from FAT
+ *
+ * @param fs
+ * @param map result value, free it after used
+ * @param free_num result value, count of free clusters
+ * @return int 0, TF_ERR_NO_MEM, TF_ERR_DISK_IO
+ */
+static int tf_clusmap_build(tf_fs_t* fs, uint32_t** map, uint32_t* free_num) {
+    uint32_t words = (fs->clus_num + 31) / 32;
+
+    *map = calloc(words, sizeof(uint32_t));
+    if (*map == nullptr) {
+        return TF_ERR_NO_MEM;
     }
 
-    const char* subpath = nullptr;
-    int         i;
+    if (fs->fat != nullptr) {
+        tf_mutex_lock(&fs->fat_lock);
+        *free_num = tf_fat_scan_used(fs->fat, fs->clus_num, 0, *map);
+        tf_mutex_unlock(&fs->fat_lock);
+    } else {
+        // read FAT in large pieces, not through the FAT cache
+        uint32_t clus_per_sec = fs->sec_size / 4;
+        uint8_t* buf          = malloc(TF_CLUSMAP_SCAN_SEC * fs->sec_size);
 
-    // which fs of this path
-    for (i = 0; i < TF_MAX_FS_NUM; i++) {
-        if (fs_pool[i].label == 0) {
-            continue;
+        if (buf == nullptr) {
+            free(*map);
+            return TF_ERR_NO_MEM;
         }
 
-        // path like "/a/b/c", first fs
-        if (path[0] == '/') {
-            subpath = &path[1];
-            break;
+        *free_num = 0;
+        for (uint32_t sec = 0; sec * clus_per_sec < fs->clus_num; sec += TF_CLUSMAP_SCAN_SEC) {
+            uint32_t n = fs->fat_sec_num - sec < TF_CLUSMAP_SCAN_SEC ? fs->fat_sec_num - sec : TF_CLUSMAP_SCAN_SEC;
+
+            if (tf_fat_scan_read(fs, sec, n, buf) != 0) {
+                free(buf);
+                free(*map);
+                return TF_ERR_DISK_IO;
+            }
+
+            uint32_t num = fs->clus_num - sec * clus_per_sec;
+            if (num > n * clus_per_sec) {
+                num = n * clus_per_sec;
+            }
+            *free_num += tf_fat_scan_used((uint32_t*)buf, num, sec * clus_per_sec, *map);
         }
+        free(buf);
+    }
 
-        // path like "x:/a/b/c"
-        if (path[0] == fs_pool[i].label) {
-            subpath = &path[3];
-            break;
+    // the 2 reserved, and the bits beyond the last cluster are never free
+    for (uint32_t clus = 0; clus < 2; clus++) {
+        if (!util_bitmap_chk(*map, clus)) {
+            util_bitmap_set(*map, clus);
+            (*free_num)--;
         }
     }
-    if (i == TF_MAX_FS_NUM) {
-        return TF_ERR_PATH_NOT_FOUND;
+    for (uint32_t clus = fs->clus_num; clus < words * 32; clus++) {
+        util_bitmap_set(*map, clus);
     }
 
-    // set item as root dir, cluster id start at 2
-    item->fs     = &fs_pool[i];
-    item->attr   = TF_FILEATTR_DIRECTORY;
-    item->sfn[0] = fs_pool[i].label;
-    item->sfn[1] = '\0';
-
-    item->first_clus = 2;
-    item->cur_clus   = item->first_clus;
-    item->cur_ofs    = 0;
-
-    // search subpath
-    return tf_dir_find(item, subpath, item);
+    return 0;
 }
 
 
+#if TF_INDEX
+#define TF_FAT_SUM_PRIME 1099511628211ull
+
 /**
- * @brief close a file or dir
+ * @brief hash FAT entries into 4 FNV-1a lanes, entry i goes to lane i % 4, the reserved high 4 bits
+ * are not counted
  *
- * @param dir
- * @return int 0, TF_ERR_WRONG_PARAM
+ * @param lanes
+ * @param ents
+ * @param num a multiple of 4 but the last piece
  */
-int tf_item_close(tf_item_t* item) {
-    if (item == nullptr) {
-        return TF_ERR_WRONG_PARAM;
+static void tf_fat_sum_add(uint64_t* lanes, const uint32_t* ents, uint32_t num) {
+    uint64_t h0 = lanes[0];
+    uint64_t h1 = lanes[1];
+    uint64_t h2 = lanes[2];
+    uint64_t h3 = lanes[3];
+    uint32_t i  = 0;
+
+    // the lanes don't wait for each other's multiply
+    for (; i + 4 <= num; i += 4) {
+        h0 = (h0 ^ (ents[i] & 0x0FFFFFFF)) * TF_FAT_SUM_PRIME;
+        h1 = (h1 ^ (ents[i + 1] & 0x0FFFFFFF)) * TF_FAT_SUM_PRIME;
+        h2 = (h2 ^ (ents[i + 2] & 0x0FFFFFFF)) * TF_FAT_SUM_PRIME;
+        h3 = (h3 ^ (ents[i + 3] & 0x0FFFFFFF)) * TF_FAT_SUM_PRIME;
     }
-    return 0;
-};
+    lanes[0] = h0;
+    lanes[1] = h1;
+    lanes[2] = h2;
+    lanes[3] = h3;
+    for (int k = 0; i < num; i++, k++) {
+        lanes[k] = (lanes[k] ^ (ents[i] & 0x0FFFFFFF)) * TF_FAT_SUM_PRIME;
+    }
+}
 
 
 /**
- * @brief read item from dir
+ * @brief hash the entries of the first FAT
  *
- * @param dir should be dir really
- * @param item the item read from the dir, result value
- * @return int 0, TF_STA_READDIR_END, TF_ERR_WRONG_PARAM, TF_ERR_ITEM_NOT_DIR
+ * @param fs
+ * @param sum result value
+ * @return int 0, TF_ERR_NO_MEM, TF_ERR_DISK_IO
  */
-int tf_dir_read(tf_item_t* dir, tf_item_t* item) {
-    if (dir == nullptr || item == nullptr) {
-        return TF_ERR_WRONG_PARAM;
-    }
+static int tf_fat_sum(tf_fs_t* fs, uint64_t* sum) {
+    uint64_t lanes[4];
 
-    if (!TF_MASK_MATCH(dir->attr, TF_FILEATTR_DIRECTORY)) {
-        return TF_ERR_ITEM_NOT_DIR;
+    for (int k = 0; k < 4; k++) {
+        lanes[k] = 14695981039346656037ull + k;
     }
 
-    tf_fs_t* fs = dir->fs;
+    if (fs->fat != nullptr) {
+        tf_mutex_lock(&fs->fat_lock);
+        tf_fat_sum_add(lanes, fs->fat, fs->clus_num);
+        tf_mutex_unlock(&fs->fat_lock);
+    } else {
+        uint32_t clus_per_sec = fs->sec_size / 4;
+        uint8_t* buf          = malloc(TF_CLUSMAP_SCAN_SEC * fs->sec_size);
 
-    while (true) {
-        if (!tf_item_data_prefetch(dir)) {
-            return TF_STA_READDIR_END;
+        if (buf == nullptr) {
+            return TF_ERR_NO_MEM;
         }
 
-        tf_item_parse(fs->cache + (dir->cur_ofs % fs->sec_size), item);
-        dir->cur_ofs += TF_DIRITEM_SIZE;
+        for (uint32_t sec = 0; sec * clus_per_sec < fs->clus_num; sec += TF_CLUSMAP_SCAN_SEC) {
+            uint32_t n = fs->fat_sec_num - sec < TF_CLUSMAP_SCAN_SEC ? fs->fat_sec_num - sec : TF_CLUSMAP_SCAN_SEC;
 
-        item->fs = dir->fs;
+            if (tf_fat_scan_read(fs, sec, n, buf) != 0) {
+                free(buf);
+                return TF_ERR_DISK_IO;
+            }
 
-        if (TF_MASK_MATCH(item->attr, TF_FILEATTR_EMPTY)) {
-            return TF_STA_READDIR_END;
+            uint32_t num = fs->clus_num - sec * clus_per_sec;
+            if (num > n * clus_per_sec) {
+                num = n * clus_per_sec;
+            }
+            tf_fat_sum_add(lanes, (uint32_t*)buf, num);
         }
+        free(buf);
+    }
 
-        if (TF_MASK_MATCH(item->attr, TF_FILEATTR_DELETED)) {   // deleted item, ignore it
-            continue;
-        }
+    *sum = 14695981039346656037ull;
+    for (int k = 0; k < 4; k++) {
+        *sum = (*sum ^ lanes[k]) * TF_FAT_SUM_PRIME;
+    }
+    return 0;
+}
+#endif
 
-        if (TF_MASK_MATCH(item->attr, TF_FILEATTR_LONG_FILE_NAME)) {
-            // lfn item, ignore
-            continue;
-#if TF_LFN_SUPPORTTED
-            // for lfn
-            uint8_t ord = item->name[TF_LFN_LEN_MAX - 1];
 
-            if (TF_MASK_MATCH(ord, 0x40)) {   // first lfn
-                seq = (ord & 0x3F) - 1;
-            } else if (seq != ord) {          // invalid lfn item
-                seq = 0;
-                continue;
-            } else {
-                seq = ord - 1;
-            }
+/**
+ * @brief get the bitmap of used clusters, build it when not built yet
+ *
+ * called with fs->write_lock held, or at mount
+ *
+ * @param fs
+ * @return uint32_t* nullptr when not enough memory or io error, search FAT instead
+ */
+static uint32_t* tf_clusmap_get(tf_fs_t* fs) {
+#if TF_CLUSMAP
+    uint32_t free_num;
 
-            if (seq >= TF_LFN_LEN_MAX / 26 - 1) {   // lfn too long, not supported
-                seq = 0;
-                continue;
-            }
+    if (fs->clusmap == nullptr && tf_clusmap_build(fs, &fs->clusmap, &free_num) == 0) {
+        // FSI_Free_Count is only a hint, written at the next sync after an allocation
+        fs->free_clus_num = free_num;
+    }
+#endif
+    return fs->clusmap;
+}
 
-            if (seq != 0) {
-                // current sequense, 13 wchar in lfn item
-                for (int i = 0; i < 26; i++) {
-                    item->name[i + 26 * seq] = item->name[i];
-                }
-            } else {
-                // name: utf-16 -> ascii
-                int i = 0;
-                for (i = 1; i < TF_LFN_LEN_MAX / 2; i++) {
-                    item->name[i] = item->name[i << 1];
-                }
 
-                with_lfn = true;
-                seq      = 0;
-                continue;
+/**
+ * @brief read FAT again after it's changed by others, the entries changed and not written yet are
+ * kept, and the bitmap of used clusters is built again
+ *
+ * called with fs->write_lock held
+ *
+ * @param fs
+ * @return int 0, TF_ERR_NO_MEM, TF_ERR_DISK_IO
+ */
+static int tf_fat_reload(tf_fs_t* fs) {
+    if (fs->fat != nullptr) {
+        // read without fat_lock, FAT is not changed meanwhile by write_lock
+        uint8_t* buf = malloc(fs->fat_sec_num * fs->sec_size);
+        if (buf == nullptr) {
+            return TF_ERR_NO_MEM;
+        }
+        if (tf_disk_readn_co(fs->dev, fs->fat_sec_ofs, fs->fat_sec_num, fs->sec_size, buf) != 0) {
+            free(buf);
+            return TF_ERR_DISK_IO;
+        }
+
+        // readers take fat_lock only while fat_seq is odd, see tf_fat_resident_get
+        uint32_t  clus_per_sec = fs->sec_size / 4;
+        uint32_t* ents         = (uint32_t*)buf;
+
+        tf_mutex_lock(&fs->fat_lock);
+        tf_atomic_store_rel(&fs->fat_seq, fs->fat_seq + 1);
+        for (uint32_t clus = 0; clus < fs->clus_num; clus++) {
+            if (!util_bitmap_chk(fs->fatdirty, clus / clus_per_sec)) {
+                tf_atomic_store_rel(&fs->fat[clus], ents[clus]);
             }
+        }
+        tf_atomic_store_rel(&fs->fat_seq, fs->fat_seq + 1);
+        tf_mutex_unlock(&fs->fat_lock);
+        free(buf);
+    } else {
+        tf_mutex_lock(&fs->fat_lock);
+        tf_cache_drop_clean(&fs->fatcache);
+        tf_mutex_unlock(&fs->fat_lock);
+    }
+
+    free(fs->clusmap);
+    fs->clusmap = nullptr;
+#if TF_CLUSMAP && !TF_CLUSMAP_LAZY
+    tf_clusmap_get(fs);
 #endif
+    return 0;
+}
+
+
+/**
+ * @brief find the first free cluster in clusmap
+ *
+ * @param fs
+ * @param clus_id search from it
+ * @return uint32_t the free cluster, clus_num when not found
+ */
+static uint32_t tf_clusmap_next_free(tf_fs_t* fs, uint32_t clus_id) {
+    while (clus_id < fs->clus_num) {
+        if (fs->clusmap[clus_id / 32] == 0xFFFFFFFF) {
+            clus_id = (clus_id / 32 + 1) * 32;   // all used, skip the word
+        } else if (util_bitmap_chk(fs->clusmap, clus_id)) {
+            clus_id++;
         } else {
-            // sfn
-            return 0;
+            return clus_id;
         }
     }
+    return fs->clus_num;
 }
 
 
 /**
- * @brief find an item from dir of subpath
+ * @brief count the continuous free clusters in clusmap
  *
- * @param dir should be dir really
- * @param subpath should not start by '/'
- * @param item the item found in the dir, result value
- * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_ITEM_NOT_DIR, TF_ERR_PATH_INVALID, TF_ERR_PATH_NOT_FOUND
+ * @param fs
+ * @param clus_id the first one, should be free
+ * @param max stop counting at max
+ * @return uint32_t
  */
-int tf_dir_find(tf_item_t* dir, const char* subpath, tf_item_t* item) {
-    if (dir == nullptr || subpath == nullptr || item == nullptr) {
-        return TF_ERR_WRONG_PARAM;
+static uint32_t tf_clusmap_run_len(tf_fs_t* fs, uint32_t clus_id, uint32_t max) {
+    uint32_t len = 0;
+
+    while (len < max && clus_id + len < fs->clus_num) {
+        uint32_t clus = clus_id + len;
+
+        if (clus % 32 == 0 && fs->clusmap[clus / 32] == 0 && max - len >= 32) {
+            len += 32;   // all free, take the word
+        } else if (!util_bitmap_chk(fs->clusmap, clus)) {
+            len++;
+        } else {
+            break;
+        }
     }
-    if (!TF_MASK_MATCH(dir->attr, TF_FILEATTR_DIRECTORY)) {
-        return TF_ERR_ITEM_NOT_DIR;
+    return len < max ? len : max;
+}
+
+
+/**
+ * @brief find free clusters, continuous ones when possible
+ *
+ * @param fs
+ * @param prev last cluster of the chain, the ones following it are taken first
+ * @param want clusters wanted
+ * @param clus_id result value, the first one found
+ * @param num result value, 1..want, the run found may be shorter
+ * @return int 0, TF_ERR_NO_SPACE
+ */
+static int tf_fat_find_free(tf_fs_t* fs, uint32_t prev, uint32_t want, uint32_t* clus_id, uint32_t* num) {
+    uint32_t hint = fs->next_free_clus >= 2 && fs->next_free_clus < fs->clus_num ? fs->next_free_clus : 2;
+
+    if (tf_clusmap_get(fs) == nullptr) {
+        // no bitmap, search FAT from the hint one by one, and wrap around
+        uint32_t clus = hint;
+
+        while (tf_next_cluster(fs, clus) != 0) {
+            if (++clus == fs->clus_num) {
+                clus = 2;
+            }
+            if (clus == hint) {
+                return TF_ERR_NO_SPACE;
+            }
+        }
+        *clus_id = clus;
+        *num     = 1;
+        return 0;
     }
 
-    static tf_item_t tempbase;
-    static char      name[TF_FN_LEN_MAX] = {0};
-    static char      sfn[TF_SFN_LEN]     = {0};
-    bool             part_found;
+    // grow the chain in place
+    if (prev >= 2 && prev + 1 < fs->clus_num && !util_bitmap_chk(fs->clusmap, prev + 1)) {
+        *clus_id = prev + 1;
+        *num     = tf_clusmap_run_len(fs, prev + 1, want);
+        return 0;
+    }
 
-    memcpy(&tempbase, dir, sizeof(tf_item_t));
+    // the first run long enough from the hint, or the longest one, small requests take the head
+    // of a run not shorter than TF_CLUSMAP_RUN_MIN, so the chain can grow in place later
+    uint32_t run      = want > TF_CLUSMAP_RUN_MIN ? want : TF_CLUSMAP_RUN_MIN;
+    uint32_t best     = 0;
+    uint32_t best_len = 0;
 
-    while (true) {
-        util_logger("<tf_dir_find> enter dir `%s`, try find `%s`\n", dir->sfn, subpath);
+    for (int pass = 0; pass < 2 && best_len < run; pass++) {
+        uint32_t clus = pass == 0 ? hint : 2;
+        uint32_t end  = pass == 0 ? fs->clus_num : hint;
 
-        if (subpath[0] == '\0') {
-            // subpath like "a/b/c/"
-            util_logger("<tf_dir_find> found `%s`\n", subpath);
-            memcpy(item, &tempbase, sizeof(tf_item_t));
-            return 0;
+        while (best_len < run && (clus = tf_clusmap_next_free(fs, clus)) < end) {
+            uint32_t len = tf_clusmap_run_len(fs, clus, run);
+            if (len > best_len) {
+                best     = clus;
+                best_len = len;
+            }
+            clus += len;
         }
+    }
 
-        if (subpath[0] == '/') {
-            return TF_ERR_PATH_INVALID;
+    if (best_len == 0) {
+        return TF_ERR_NO_SPACE;
+    }
+    *clus_id = best;
+    *num     = best_len < want ? best_len : want;
+    return 0;
+}
+
+
+/**
+ * @brief alloc free clusters, continuous ones when possible, and link them to the end of a chain
+ *
+ * called with fs->write_lock held
+ *
+ * @param fs
+ * @param prev last cluster of the chain, 0 for a new chain
+ * @param want clusters wanted
+ * @param clus_id result value, the first one allocated
+ * @param num result value, clusters allocated and linked, 1..want, call again for the others
+ * @return int 0, TF_ERR_NO_SPACE, TF_ERR_DISK_IO
+ */
+static int tf_fat_alloc_run(tf_fs_t* fs, uint32_t prev, uint32_t want, uint32_t* clus_id, uint32_t* num) {
+    uint32_t first;
+    uint32_t len;
+
+    int ret = tf_fat_find_free(fs, prev, want, &first, &len);
+    if (ret != 0) {
+        return ret;
+    }
+
+    for (uint32_t i = 0; i < len; i++) {
+        if (tf_fat_set(fs, first + i, i + 1 < len ? first + i + 1 : 0x0FFFFFFF) != 0) {
+            ret = TF_ERR_DISK_IO;
+        }
+    }
+    if (ret == 0 && prev >= 2 && tf_fat_set(fs, prev, first) != 0) {
+        ret = TF_ERR_DISK_IO;
+    }
+    if (ret != 0) {
+        for (uint32_t i = 0; i < len; i++) {
+            tf_fat_set(fs, first + i, 0);
         }
+        return ret;
+    }
 
-        // first part of subpath
-        int sep = util_get_1st_subpath(subpath, name);
-        util_name2sfn(name, sfn);
+    if (fs->clusmap != nullptr) {
+        for (uint32_t i = 0; i < len; i++) {
+            util_bitmap_set(fs->clusmap, first + i);
+        }
+        fs->free_clus_num -= len;
+    } else if (fs->free_clus_num != 0xFFFFFFFF) {   // 0xFFFFFFFF is unknown
+        fs->free_clus_num = fs->free_clus_num > len ? fs->free_clus_num - len : 0;
+    }
+    fs->next_free_clus = first + len;
+    fs->fsinfo_dirty   = true;
 
-        part_found = false;
-        while (tf_dir_read(&tempbase, item) == 0) {
-            if (strcmp(item->sfn, sfn) == 0) {
-                if (strcmp(name, "..") == 0 && item->first_clus == 0) {
-                    // ".." is the root cluster
-                    item->cur_clus = item->first_clus = 2;
-                }
+    *clus_id = first;
+    *num     = len;
+    return 0;
+}
 
-                if (subpath[sep] == '\0') {
-                    // item is the wanted file/dir
-                    util_logger("<tf_dir_find> found `%s`\n", subpath);
-                    return 0;
-                }
 
-                // subpath[sep] == '/'
-                // item is a subdir contains the wanted file/dir
+/**
+ * @brief alloc a free cluster, and link it to the end of a chain
+ *
+ * called with fs->write_lock held
+ *
+ * @param fs
+ * @param prev last cluster of the chain, 0 for a new chain
+ * @param clus_id result value
+ * @return int 0, TF_ERR_NO_SPACE, TF_ERR_DISK_IO
+ */
+static int tf_fat_alloc(tf_fs_t* fs, uint32_t prev, uint32_t* clus_id) {
+    uint32_t num;
+    return tf_fat_alloc_run(fs, prev, 1, clus_id, &num);
+}
 
-                // confirm item is a dir
-                if (!TF_MASK_MATCH(item->attr, TF_FILEATTR_DIRECTORY)) {
-                    return TF_ERR_PATH_NOT_DIR;
-                }
 
-                memcpy(&tempbase, item, sizeof(tf_item_t));
-                subpath += sep + 1;
-                part_found = true;
-                break;
+/**
+ * @brief write back sectors of the sector cache
+ *
+ * @param ctx the fs
+ * @param sec
+ * @param sec_num
+ * @param data
+ * @return int 0, -1
+ */
+static int tf_fs_cache_wb(void* ctx, uint32_t sec, uint32_t sec_num, const uint8_t* data) {
+    tf_fs_t* fs = ctx;
+
+    tf_atomic_add(&fs->cache_wb_num, 1);
+    return tf_disk_writen_co(fs->dev, sec, sec_num, fs->sec_size, data) == 0 ? 0 : -1;
+}
+
+
+/**
+ * @brief init the sector cache, split to shards when TF_THREAD_SAFE
+ *
+ * @param fs
+ * @return int 0, TF_ERR_NO_MEM
+ */
+static int tf_fs_cache_init(tf_fs_t* fs) {
+    for (int i = 0; i < TF_CACHE_SHARD_NUM; i++) {
+        if (tf_cache_init(&fs->cache[i], fs->cache_sec_num / TF_CACHE_SHARD_NUM, fs->sec_size) != 0) {
+            while (--i >= 0) {
+                tf_cache_deinit(&fs->cache[i]);
+                tf_mutex_deinit(&fs->cache_lock[i]);
             }
+            return TF_ERR_NO_MEM;
         }
-        if (!part_found) {
-            // path part not found
-            return TF_ERR_PATH_NOT_FOUND;
-        }
+        fs->cache[i].wb     = tf_fs_cache_wb;
+        fs->cache[i].wb_ctx = fs;
+        tf_mutex_init(&fs->cache_lock[i]);
     }
+    return 0;
 }
 
 
 /**
- * @brief read file content, once read, the file ptr will move
+ * @brief free the sector cache
  *
- * @param file should be really file
- * @param buffer should be large enough to store the data you want
- * @param size the data size wanted
- * @return int the data size really read
+ * @param fs
  */
-int tf_file_read(tf_file_t* file, uint8_t* buffer, uint32_t size) {
-    if (file == nullptr || buffer == nullptr) {
-        return TF_ERR_WRONG_PARAM;
+static void tf_fs_cache_deinit(tf_fs_t* fs) {
+    for (int i = 0; i < TF_CACHE_SHARD_NUM; i++) {
+        tf_cache_deinit(&fs->cache[i]);
+        tf_mutex_deinit(&fs->cache_lock[i]);
     }
+}
+
+
+/**
+ * @brief put a sector read from disk into the sector cache, if not cached yet
+ *
+ * a range read from disk may cover dirty sectors, they are not replaced while cached, but once
+ * written back by an eviction (even of the puts of the same range) the data read is older than
+ * disk, so nothing is put after any write back since the read
+ *
+ * @param fs
+ * @param sec
+ * @param data
+ * @param wb_num fs->cache_wb_num before the read
+ */
+static void tf_fs_cache_put(tf_fs_t* fs, uint32_t sec, const uint8_t* data, uint32_t wb_num) {
+    uint32_t shard = sec % TF_CACHE_SHARD_NUM;
 
-    if (TF_MASK_MATCH(file->attr, TF_FILEATTR_ARCHIVE) && (size > file->size - file->cur_ofs)) {
-        size = file->size - file->cur_ofs;
+    tf_mutex_lock(&fs->cache_lock[shard]);
+    if (!tf_cache_contains(&fs->cache[shard], sec) &&   // may be read by another one meanwhile
+        tf_atomic_load(&fs->cache_wb_num) == wb_num) {
+        memcpy(tf_cache_insert(&fs->cache[shard], sec), data, fs->sec_size);
     }
+    tf_mutex_unlock(&fs->cache_lock[shard]);
+}
 
-    uint32_t size_read = 0;
-    tf_fs_t* fs        = file->fs;
 
-    while (size > 0) {
-        if (!tf_item_data_prefetch(file)) {
-            break;
+/**
+ * @brief read sector from disk, use cache
+ *
+ * @param fs
+ * @param sec
+ * @param ofs byte offset in the sector
+ * @param data result value
+ * @param size should not cross the sector
+ * @return int 0, TF_ERR_DISK_IO
+ */
+static int tf_fs_disk_read(tf_fs_t* fs, uint32_t sec, uint16_t ofs, uint8_t* data, uint16_t size) {
+    uint32_t    shard = sec % TF_CACHE_SHARD_NUM;
+    tf_cache_t* cache = &fs->cache[shard];
+    uint8_t     buf[TF_MAX_SECTOR_SIZE];
+
+    tf_mutex_lock(&fs->cache_lock[shard]);
+    uint8_t* cached = tf_cache_lookup(cache, sec);
+    if (cached != nullptr) {
+        memcpy(data, cached + ofs, size);
+    }
+    tf_mutex_unlock(&fs->cache_lock[shard]);
+
+    if (cached != nullptr) {
+        return 0;
+    }
+
+    // read without the lock, hits of other readers are not blocked by the io
+    uint32_t wb_num = tf_atomic_load(&fs->cache_wb_num);
+    if (tf_disk_read_co(fs->dev, sec, fs->sec_size, buf) != 0) {
+        return TF_ERR_DISK_IO;
+    }
+
+    tf_fs_cache_put(fs, sec, buf, wb_num);
+
+    memcpy(data, buf + ofs, size);
+    return 0;
+}
+
+
+/**
+ * @brief write data to a sector in the sector cache, it's written to disk when evicted or synced
+ *
+ * @param fs
+ * @param sec
+ * @param ofs byte offset in the sector
+ * @param data
+ * @param size should not cross the sector
+ * @param fresh the sector has no valid data, not read from disk but zero filled
+ * @return int 0, TF_ERR_DISK_IO
+ */
+static int tf_fs_disk_write(tf_fs_t* fs, uint32_t sec, uint16_t ofs, const uint8_t* data, uint16_t size, bool fresh) {
+    uint32_t    shard = sec % TF_CACHE_SHARD_NUM;
+    tf_cache_t* cache = &fs->cache[shard];
+    uint8_t     buf[TF_MAX_SECTOR_SIZE];
+
+    tf_mutex_lock(&fs->cache_lock[shard]);
+    uint8_t* cached = tf_cache_lookup(cache, sec);
+    if (cached == nullptr) {
+        tf_mutex_unlock(&fs->cache_lock[shard]);
+
+        // read modify write, the io without the lock
+        if (!fresh && tf_disk_read_co(fs->dev, sec, fs->sec_size, buf) != 0) {
+            return TF_ERR_DISK_IO;
+        }
+
+        tf_mutex_lock(&fs->cache_lock[shard]);
+        // writers are serialized, a sector put by a reader meanwhile has the same data
+        cached = tf_cache_lookup(cache, sec);
+        if (cached == nullptr) {
+            cached = tf_cache_insert(cache, sec);
+            if (!fresh) {
+                memcpy(cached, buf, fs->sec_size);
+            }
         }
-        // size may larger than a sector
-        // if the wanted data all in this sector, read all
-        // or read remain data in this sector this time
+    }
+    if (fresh) {
+        memset(cached, 0, fs->sec_size);
+    }
+    memcpy(cached + ofs, data, size);
+    tf_cache_mark_dirty(cache, sec);
+    tf_mutex_unlock(&fs->cache_lock[shard]);
 
-        uint16_t ofs     = file->cur_ofs % fs->sec_size;
-        uint16_t readnow = ofs + size < fs->sec_size ? size : fs->sec_size - ofs;
+    return 0;
+}
 
-        memcpy(&buffer[size_read], &fs->cache[ofs], readnow);
-        file->cur_ofs += readnow;
-        size_read += readnow;
-        size -= readnow;
+
+/**
+ * @brief drop sectors from the sector cache, like when they are written to disk directly
+ *
+ * @param fs
+ * @param sec
+ * @param sec_num
+ */
+static void tf_fs_cache_drop(tf_fs_t* fs, uint32_t sec, uint32_t sec_num) {
+    for (uint32_t i = 0; i < sec_num; i++) {
+        uint32_t shard = (sec + i) % TF_CACHE_SHARD_NUM;
+
+        tf_mutex_lock(&fs->cache_lock[shard]);
+        tf_cache_drop(&fs->cache[shard], sec + i);
+        tf_mutex_unlock(&fs->cache_lock[shard]);
     }
+}
 
-    return size_read;
+
+/**
+ * @brief copy the changed sectors not written back over the data read from disk directly
+ *
+ * @param fs
+ * @param sec
+ * @param sec_num
+ * @param data
+ */
+static void tf_fs_dirty_overlay(tf_fs_t* fs, uint32_t sec, uint32_t sec_num, uint8_t* data) {
+    for (uint32_t i = 0; i < sec_num; i++) {
+        uint32_t shard = (sec + i) % TF_CACHE_SHARD_NUM;
+
+        tf_mutex_lock(&fs->cache_lock[shard]);
+        if (fs->cache[shard].dirty_num > 0) {
+            uint8_t* dirty = tf_cache_dirty_data(&fs->cache[shard], sec + i);
+            if (dirty != nullptr) {
+                memcpy(data + i * fs->sec_size, dirty, fs->sec_size);
+            }
+        }
+        tf_mutex_unlock(&fs->cache_lock[shard]);
+    }
+}
+
+
+/**
+ * @brief write back the changed sectors of a range, they stay in the sector cache clean
+ *
+ * @param fs
+ * @param sec
+ * @param sec_num
+ * @return int 0, TF_ERR_DISK_IO
+ */
+static int tf_fs_dirty_clean(tf_fs_t* fs, uint32_t sec, uint32_t sec_num) {
+    bool dirty = false;
+    int  ret   = 0;
+
+    // mostly nothing changed, skip the lookups
+    for (int i = 0; i < TF_CACHE_SHARD_NUM && !dirty; i++) {
+        tf_mutex_lock(&fs->cache_lock[i]);
+        dirty = fs->cache[i].dirty_num > 0;
+        tf_mutex_unlock(&fs->cache_lock[i]);
+    }
+    if (!dirty) {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < sec_num; i++) {
+        uint32_t shard = (sec + i) % TF_CACHE_SHARD_NUM;
+
+        tf_mutex_lock(&fs->cache_lock[shard]);
+        if (fs->cache[shard].dirty_num > 0 && tf_cache_clean(&fs->cache[shard], sec + i) != 0) {
+            ret = TF_ERR_DISK_IO;
+        }
+        tf_mutex_unlock(&fs->cache_lock[shard]);
+    }
+
+    return ret;
+}
+
+
+/**
+ * @brief write all changed data of fs to disk, the sectors, then FAT, then FSInfo
+ *
+ * called with fs->write_lock held
+ *
+ * @param fs
+ * @return int 0, TF_ERR_DISK_IO
+ */
+static int tf_fs_sync(tf_fs_t* fs) {
+    int ret = 0;
+
+    for (int i = 0; i < TF_CACHE_SHARD_NUM; i++) {
+        tf_mutex_lock(&fs->cache_lock[i]);
+        if (tf_cache_flush(&fs->cache[i]) != 0) {
+            ret = TF_ERR_DISK_IO;
+        }
+        tf_mutex_unlock(&fs->cache_lock[i]);
+    }
+
+    if (tf_fat_flush(fs) != 0) {
+        ret = TF_ERR_DISK_IO;
+    }
+
+    if (fs->fsinfo_dirty) {
+        uint8_t sec[TF_MAX_SECTOR_SIZE];
+
+        if (tf_disk_read_co(fs->dev, fs->fsinfo_sec, fs->sec_size, sec) != 0) {
+            return TF_ERR_DISK_IO;
+        }
+        util_set_value_to_block(sec, 488, 4, fs->free_clus_num);    // FSI_Free_Count
+        util_set_value_to_block(sec, 492, 4, fs->next_free_clus);   // FSI_Nxt_Free
+        if (tf_disk_writen_co(fs->dev, fs->fsinfo_sec, 1, fs->sec_size, sec) != 0) {
+            return TF_ERR_DISK_IO;
+        }
+        fs->fsinfo_dirty = false;
+    }
+
+    return ret;
+}
+
+
+/**
+ * @brief check if a sector in the sector cache
+ *
+ * @param fs
+ * @param sec
+ * @return bool
+ */
+static bool tf_fs_sec_cached(tf_fs_t* fs, uint32_t sec) {
+    uint32_t shard = sec % TF_CACHE_SHARD_NUM;
+
+    tf_mutex_lock(&fs->cache_lock[shard]);
+    bool cached = tf_cache_contains(&fs->cache[shard], sec);
+    tf_mutex_unlock(&fs->cache_lock[shard]);
+
+    return cached;
+}
+
+
+/**
+ * @brief make sure cur_clus is the cluster contains cur_ofs, move to next cluster when needed
+ *
+ * @param item: file or dir
+ * @return bool: return false when no next cluster (all cluster has been read)
+ */
+static bool tf_item_clus_locate(tf_item_t* item) {
+    tf_fs_t* fs = item->fs;
+
+    // if current cluster read finished, try find next cluster
+    if (item->cur_ofs != 0 && item->cur_ofs % (fs->sec_size * fs->clus_sec_num) == 0) {
+        // find next cluster
+        uint32_t next_clus = tf_next_cluster(fs, item->cur_clus);
+        TF_STAT_ADD(fs, chain_links, 1);
+
+        if (TF_CLUSTER_ID_VALID(next_clus)) {
+            item->cur_clus = next_clus;
+        } else {
+            // no next cluster
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/**
+ * @brief prefetch file data from disk to ram cache, and copy out the data at cur_ofs
+ *
+ * @param item: file or dir
+ * @param data: result value
+ * @param size: should not cross the sector
+ * @return bool: return false when no data can prefetch (all cluster has been read)
+ */
+static bool tf_item_data_prefetch(tf_item_t* item, uint8_t* data, uint16_t size) {
+    TF_TRACE_SCOPE(TF_TRACE_PREFETCH, item->cur_ofs);
+
+    tf_fs_t* fs = item->fs;
+
+    if (!tf_item_clus_locate(item)) {
+        return false;
+    }
+
+    // byte offset in current cluster
+    uint32_t cur_clus_ofs = item->cur_ofs % (fs->sec_size * fs->clus_sec_num);
+
+    return tf_fs_disk_read(fs, fs->dat_sec_ofs + fs->clus_sec_num * (item->cur_clus - 2) + (cur_clus_ofs / fs->sec_size),
+                           item->cur_ofs % fs->sec_size, data, size) == 0;
+}
+
+
+#if TF_INDEX
+/**
+ * @brief the next node of a hash chain, links go to later nodes only, a broken one ends the chain
+ *
+ * @param hdr
+ * @param n the node, -1 for the hash table
+ * @param next its link
+ * @return int32_t -1 for the end
+ */
+static int32_t tf_index_next(const tf_index_hdr_t* hdr, int32_t n, int32_t next) {
+    return next > n && (uint32_t)next < hdr->node_num ? next : -1;
+}
+
+
+/**
+ * @brief find the item of a chain in the sidecar index, "." and ".." are not found
+ *
+ * @param fs
+ * @param first_clus
+ * @return const tf_index_node_t* nullptr when not found, or the index not used
+ */
+static const tf_index_node_t* tf_index_node(tf_fs_t* fs, uint32_t first_clus) {
+    const tf_index_hdr_t* hdr = fs->index;
+
+    if (hdr == nullptr || !tf_atomic_load(&fs->index_on)) {
+        return nullptr;
+    }
+
+    const tf_index_node_t* nodes = TF_INDEX_NODES(hdr);
+    uint32_t               h     = (first_clus * 2654435761u) >> (32 - hdr->hash_bits);
+
+    for (int32_t n = tf_index_next(hdr, -1, TF_INDEX_CLUS_HASH(hdr)[h]); n >= 0;
+         n = tf_index_next(hdr, n, nodes[n].clus_next)) {
+        if (nodes[n].ent.first_clus == first_clus) {
+            return &nodes[n];
+        }
+    }
+    return nullptr;
+}
+
+
+/**
+ * @brief copy the extent list of a chain from the sidecar index, no FAT read
+ *
+ * @param fs
+ * @param first_clus
+ * @param map result value
+ * @return int 0, TF_ERR_NO_MEM, 1 when the chain is not in the index
+ */
+static int tf_index_extmap(tf_fs_t* fs, uint32_t first_clus, tf_extmap_t* map) {
+    const tf_index_node_t* node = tf_index_node(fs, first_clus);
+
+    if (node == nullptr || (uint64_t)node->ext_first + node->ext_num > fs->index->ext_num) {
+        return 1;
+    }
+
+    map->exts = malloc(sizeof(tf_extent_t) * (node->ext_num > 0 ? node->ext_num : 1));
+    if (map->exts == nullptr) {
+        return TF_ERR_NO_MEM;
+    }
+    memcpy(map->exts, TF_INDEX_EXTS(fs->index) + node->ext_first, sizeof(tf_extent_t) * node->ext_num);
+
+    // a broken extent would read out of the volume, build from FAT instead
+    uint32_t fclus = 0;
+    for (uint32_t i = 0; i < node->ext_num; i++) {
+        tf_extent_t* ext = &map->exts[i];
+
+        if (ext->fclus != fclus || ext->len == 0 || ext->len > fs->clus_num || ext->clus < 2 ||
+            (uint64_t)ext->clus + ext->len > fs->clus_num) {
+            break;
+        }
+        fclus += ext->len;
+    }
+    if (fclus != node->clus_total || fclus > fs->clus_num) {
+        free(map->exts);
+        map->exts = nullptr;
+        return 1;
+    }
+    map->ext_num    = node->ext_num;
+    map->first_clus = first_clus;
+    map->clus_total = node->clus_total;
+
+    return 0;
+}
+#endif
+
+
+/**
+ * @brief build the extent list of a cluster chain
+ *
+ * @param fs
+ * @param first_clus
+ * @param map result value
+ * @return int 0, TF_ERR_NO_MEM
+ */
+static int tf_extmap_build(tf_fs_t* fs, uint32_t first_clus, tf_extmap_t* map) {
+    uint32_t cap   = 8;
+    uint32_t clus  = first_clus;
+    uint32_t fclus = 0;
+
+#if TF_INDEX
+    int ret = tf_index_extmap(fs, first_clus, map);
+    if (ret <= 0) {
+        return ret;
+    }
+#endif
+
+    map->exts    = malloc(sizeof(tf_extent_t) * cap);
+    map->ext_num = 0;
+    if (map->exts == nullptr) {
+        return TF_ERR_NO_MEM;
+    }
+
+    // fclus < clus_num stops a looped chain
+    while (clus >= 2 && TF_CLUSTER_ID_VALID(clus) && fclus < fs->clus_num) {
+        tf_extent_t* last = map->ext_num > 0 ? &map->exts[map->ext_num - 1] : nullptr;
+
+        if (last != nullptr && last->clus + last->len == clus) {
+            last->len++;
+        } else {
+            if (map->ext_num == cap) {
+                tf_extent_t* exts = realloc(map->exts, sizeof(tf_extent_t) * cap * 2);
+                if (exts == nullptr) {
+                    free(map->exts);
+                    map->exts = nullptr;
+                    return TF_ERR_NO_MEM;
+                }
+                map->exts = exts;
+                cap *= 2;
+            }
+            map->exts[map->ext_num].fclus = fclus;
+            map->exts[map->ext_num].clus  = clus;
+            map->exts[map->ext_num].len   = 1;
+            map->ext_num++;
+        }
+
+        fclus++;
+        clus = tf_next_cluster(fs, clus);
+    }
+
+    map->first_clus = first_clus;
+    map->clus_total = fclus;
+    TF_STAT_ADD(fs, chain_links, fclus);
+
+    return 0;
+}
+
+
+/**
+ * @brief find a cached extent map and pin it, or the lru one not in use as victim
+ *
+ * called with fs->meta_lock held
+ *
+ * @param fs
+ * @param first_clus
+ * @param victim result value, nullptr when all in use
+ * @return tf_extmap_t* nullptr when not cached
+ */
+static tf_extmap_t* tf_extmap_find_cached(tf_fs_t* fs, uint32_t first_clus, tf_extmap_t** victim) {
+    *victim = nullptr;
+
+    fs->extmap_tick++;
+    for (int i = 0; i < TF_EXTMAP_NUM; i++) {
+        tf_extmap_t* map = &fs->extmaps[i];
+
+        if (map->exts != nullptr && !map->stale && map->first_clus == first_clus) {
+            map->tick = fs->extmap_tick;
+            map->refs++;
+            return map;
+        }
+        if (map->refs == 0 && (*victim == nullptr || map->tick < (*victim)->tick)) {   // free one has tick 0
+            *victim = map;
+        }
+    }
+
+    return nullptr;
+}
+
+
+/**
+ * @brief get the extent map of a cluster chain, build it when not cached, release it by tf_extmap_put
+ *
+ * @param fs
+ * @param first_clus
+ * @return tf_extmap_t* nullptr when no memory
+ */
+static tf_extmap_t* tf_extmap_get(tf_fs_t* fs, uint32_t first_clus) {
+    tf_extmap_t* victim;
+    tf_extmap_t  built = {0};
+
+    tf_mutex_lock(&fs->meta_lock);
+    tf_extmap_t* map = tf_extmap_find_cached(fs, first_clus, &victim);
+    uint32_t     gen = fs->meta_gen;
+    tf_mutex_unlock(&fs->meta_lock);
+
+    if (map != nullptr) {
+        return map;
+    }
+
+    // walking the chain may read FAT, don't block others
+    if (tf_extmap_build(fs, first_clus, &built) != 0) {
+        return nullptr;
+    }
+
+    tf_mutex_lock(&fs->meta_lock);
+    map = tf_extmap_find_cached(fs, first_clus, &victim);
+    if (map != nullptr) {
+        // built by another reader meanwhile
+        free(built.exts);
+    } else if (victim != nullptr && gen == fs->meta_gen) {
+        free(victim->exts);
+        map  = victim;
+        *map = built;
+    } else {
+        // all slots in use, or invalidated while building, keep it private
+        map = malloc(sizeof(tf_extmap_t));
+        if (map == nullptr) {
+            free(built.exts);
+        } else {
+            *map      = built;
+            map->heap = true;
+        }
+    }
+    if (map != nullptr && map->refs == 0) {
+        map->tick = fs->extmap_tick;
+        map->refs = 1;
+    }
+    tf_mutex_unlock(&fs->meta_lock);
+
+    return map;
+}
+
+
+/**
+ * @brief release an extent map got by tf_extmap_get
+ *
+ * @param fs
+ * @param map
+ */
+static void tf_extmap_put(tf_fs_t* fs, tf_extmap_t* map) {
+    tf_mutex_lock(&fs->meta_lock);
+    if (--map->refs == 0 && (map->heap || map->stale)) {
+        free(map->exts);
+        if (map->heap) {
+            free(map);
+        } else {
+            memset(map, 0, sizeof(tf_extmap_t));
+        }
+    }
+    tf_mutex_unlock(&fs->meta_lock);
+}
+
+
+/**
+ * @brief free all cached extent maps, the ones in use are freed by the last tf_extmap_put
+ *
+ * called with fs->meta_lock held
+ *
+ * @param fs
+ */
+static void tf_extmap_clear(tf_fs_t* fs) {
+    for (int i = 0; i < TF_EXTMAP_NUM; i++) {
+        tf_extmap_t* map = &fs->extmaps[i];
+
+        if (map->refs > 0) {
+            map->stale = true;
+        } else {
+            free(map->exts);
+            memset(map, 0, sizeof(tf_extmap_t));
+        }
+    }
+}
+
+
+/**
+ * @brief free the cached extent map of a chain, like when the chain grows
+ *
+ * called with fs->meta_lock held
+ *
+ * @param fs
+ * @param first_clus
+ */
+static void tf_extmap_drop(tf_fs_t* fs, uint32_t first_clus) {
+    for (int i = 0; i < TF_EXTMAP_NUM; i++) {
+        tf_extmap_t* map = &fs->extmaps[i];
+
+        if (map->exts == nullptr || map->stale || map->first_clus != first_clus) {
+            continue;
+        }
+        if (map->refs > 0) {
+            map->stale = true;
+        } else {
+            free(map->exts);
+            memset(map, 0, sizeof(tf_extmap_t));
+        }
+    }
+}
+
+
+/**
+ * @brief find the extent contains a cluster of file, binary search
+ *
+ * @param map
+ * @param fclus cluster index in file
+ * @return tf_extent_t* nullptr when fclus beyond the chain
+ */
+static tf_extent_t* tf_extmap_find(tf_extmap_t* map, uint32_t fclus) {
+    if (fclus >= map->clus_total) {
+        return nullptr;
+    }
+
+    uint32_t lo = 0;
+    uint32_t hi = map->ext_num - 1;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi + 1) / 2;
+        if (map->exts[mid].fclus <= fclus) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    return &map->exts[lo];
+}
+
+
+#if TF_READAHEAD
+/**
+ * @brief read sector ranges to the staging buffer in one batch, then put them into the sector cache
+ *
+ * the caller holds fs->ra_lock, except the readahead thread which owns rabuf
+ *
+ * @param fs
+ * @param reqs the ranges, sectors of all should not larger than ra_sec_max
+ * @param req_num should not larger than TF_READAHEAD_QUEUE
+ */
+static void tf_readahead_fill(tf_fs_t* fs, const tf_ra_req_t* reqs, uint32_t req_num) {
+    tf_disk_req_t dreqs[TF_READAHEAD_QUEUE];
+    uint8_t*      data = fs->rabuf;
+
+    for (uint32_t i = 0; i < req_num; i++) {
+        dreqs[i].sec     = reqs[i].sec;
+        dreqs[i].sec_num = reqs[i].sec_num;
+        dreqs[i].data    = data;
+        data += reqs[i].sec_num * fs->sec_size;
+    }
+
+    // fragmented ranges are all in flight together
+    uint32_t wb_num = tf_atomic_load(&fs->cache_wb_num);
+    tf_disk_read_batch(fs->dev, dreqs, req_num, fs->sec_size);
+
+    for (uint32_t i = 0; i < req_num; i++) {
+        for (uint32_t j = 0; dreqs[i].ret == 0 && j < dreqs[i].sec_num; j++) {
+            tf_fs_cache_put(fs, dreqs[i].sec + j, dreqs[i].data + j * fs->sec_size, wb_num);
+        }
+    }
+}
+
+
+#if TF_READAHEAD_THREAD
+/**
+ * @brief background readahead, fill the cache while the caller processes data
+ *
+ * @param arg fs
+ * @return void*
+ */
+static void* tf_readahead_worker(void* arg) {
+    tf_fs_t* fs = arg;
+
+    tf_mutex_lock(&fs->ra_lock);
+    while (true) {
+        while (fs->ra_head == fs->ra_tail && !fs->ra_stop) {
+            pthread_cond_wait(&fs->ra_cond, &fs->ra_lock);
+        }
+        if (fs->ra_stop) {
+            break;
+        }
+
+        // take all pending ones fit in rabuf, as a batch
+        tf_ra_req_t reqs[TF_READAHEAD_QUEUE];
+        uint32_t    req_num = 0;
+        uint32_t    sec_num = 0;
+        while (fs->ra_head != fs->ra_tail &&
+               sec_num + fs->ra_queue[fs->ra_head % TF_READAHEAD_QUEUE].sec_num <= fs->ra_sec_max) {
+            reqs[req_num] = fs->ra_queue[fs->ra_head % TF_READAHEAD_QUEUE];
+            sec_num += reqs[req_num].sec_num;
+            req_num++;
+            fs->ra_head++;
+        }
+
+        tf_mutex_unlock(&fs->ra_lock);
+        tf_readahead_fill(fs, reqs, req_num);
+        tf_mutex_lock(&fs->ra_lock);
+    }
+    tf_mutex_unlock(&fs->ra_lock);
+
+    return nullptr;
+}
+#endif
+
+
+/**
+ * @brief read data of item into the sector cache before it's wanted, following the extents,
+ *        the fragments are read in one batch
+ *
+ * @param item
+ * @param map extent map of item
+ * @param ofs byte offset in item
+ * @param len bytes
+ */
+static void tf_readahead_issue(tf_item_t* item, tf_extmap_t* map, uint32_t ofs, uint32_t len) {
+    tf_fs_t* fs        = item->fs;
+    uint32_t clus_size = fs->sec_size * fs->clus_sec_num;
+    uint64_t end       = (uint64_t)ofs + len;
+
+    tf_ra_req_t reqs[TF_READAHEAD_QUEUE];
+    uint32_t    req_num   = 0;
+    uint32_t    sec_total = 0;
+
+    ofs -= ofs % fs->sec_size;
+    while (ofs < end && req_num < TF_READAHEAD_QUEUE && sec_total < fs->ra_sec_max) {
+        tf_extent_t* ext = tf_extmap_find(map, ofs / clus_size);
+        if (ext == nullptr) {
+            break;
+        }
+
+        uint64_t ext_end    = (uint64_t)(ext->fclus + ext->len) * clus_size;
+        uint32_t sec_in_ext = (ofs - ext->fclus * clus_size) / fs->sec_size;
+        uint32_t sec        = fs->dat_sec_ofs + fs->clus_sec_num * (ext->clus - 2) + sec_in_ext;
+        uint32_t sec_num    = ((end < ext_end ? end : ext_end) - ofs + fs->sec_size - 1) / fs->sec_size;
+
+        if (sec_num > fs->ra_sec_max - sec_total) {
+            sec_num = fs->ra_sec_max - sec_total;
+        }
+        ofs += sec_num * fs->sec_size;
+
+        // skip the head already cached
+        while (sec_num > 0 && tf_fs_sec_cached(fs, sec)) {
+            sec++;
+            sec_num--;
+        }
+        if (sec_num == 0) {
+            continue;
+        }
+
+        reqs[req_num].sec     = sec;
+        reqs[req_num].sec_num = sec_num;
+        req_num++;
+        sec_total += sec_num;
+    }
+
+    if (req_num == 0) {
+        return;
+    }
+
+#if TF_READAHEAD_THREAD
+    tf_mutex_lock(&fs->ra_lock);
+    for (uint32_t i = 0; i < req_num && fs->ra_tail - fs->ra_head < TF_READAHEAD_QUEUE; i++) {   // queue full, drop
+        fs->ra_queue[fs->ra_tail % TF_READAHEAD_QUEUE] = reqs[i];
+        fs->ra_tail++;
+    }
+    pthread_cond_signal(&fs->ra_cond);
+    tf_mutex_unlock(&fs->ra_lock);
+#else
+    // rabuf is busy with another reader, it's only a hint, drop it
+    if (tf_mutex_trylock(&fs->ra_lock) != 0) {
+        return;
+    }
+    tf_readahead_fill(fs, reqs, req_num);
+    tf_mutex_unlock(&fs->ra_lock);
+#endif
+}
+
+
+/**
+ * @brief detect sequential access of item, and keep a window of data ahead of the reader
+ *
+ * the window starts at one cluster, doubles while the access keeps sequential, up to
+ * TF_READAHEAD_MAX clusters (and half of the cache fifo), halves when the data read ahead
+ * was evicted before used, and is reset by a random access.
+ *
+ * @param item
+ * @param ofs byte offset of the read going to do
+ * @param len bytes of the read going to do
+ */
+static void tf_readahead(tf_item_t* item, uint32_t ofs, uint32_t len) {
+    tf_fs_t* fs = item->fs;
+
+    if (item->first_clus < 2) {
+        return;
+    }
+
+    if (ofs != item->ra_next) {
+        // random access
+        item->ra_win  = 0;
+        item->ra_next = ofs + len;
+        item->ra_done = ofs + len;
+        return;
+    }
+    item->ra_next = ofs + len;
+
+    uint32_t clus_size = fs->sec_size * fs->clus_sec_num;
+    uint32_t sec       = fs->dat_sec_ofs;   // only for checking the cache
+
+    tf_extmap_t* map = tf_extmap_get(fs, item->first_clus);
+    if (map == nullptr) {
+        return;
+    }
+
+    tf_extent_t* ext = tf_extmap_find(map, ofs / clus_size);
+    if (ext != nullptr) {
+        sec += fs->clus_sec_num * (ext->clus - 2) + (ofs - ext->fclus * clus_size) / fs->sec_size;
+    }
+
+    if (ofs < item->ra_done && ext != nullptr && !tf_fs_sec_cached(fs, sec)) {
+        // data read ahead was evicted, the window is too large for the cache
+        item->ra_win  = item->ra_win > 1 ? item->ra_win / 2 : 1;
+        item->ra_done = ofs;
+    } else if (item->ra_win == 0) {
+        item->ra_win = 1;
+    }
+
+    uint32_t win = item->ra_win * clus_size;
+    if (win > fs->ra_sec_max * fs->sec_size) {
+        win = fs->ra_sec_max * fs->sec_size;
+    }
+
+    // keep at least half window ahead of the reader
+    uint32_t start = ofs + len > item->ra_done ? ofs + len : item->ra_done;
+    uint32_t end   = start + win;
+    if (!TF_MASK_MATCH(item->attr, TF_FILEATTR_DIRECTORY) && end > item->size) {
+        end = item->size;
+    }
+
+#if !TF_READAHEAD_THREAD
+    // large reads are already issued as multi-sector requests, nothing to overlap with
+    if (len >= win) {
+        end = start;
+    }
+#endif
+
+    if (start - (ofs + len) < win / 2 && start < end) {
+        tf_readahead_issue(item, map, start, end - start);
+        item->ra_done = end;
+
+        // still sequential, enlarge the window for the next time
+        if (item->ra_win < TF_READAHEAD_MAX) {
+            item->ra_win *= 2;
+        }
+    }
+
+    tf_extmap_put(fs, map);
+}
+
+
+/**
+ * @brief init readahead of a fs, start the background thread when enabled
+ *
+ * @param fs
+ * @return int 0, TF_ERR_NO_MEM
+ */
+static int tf_readahead_init(tf_fs_t* fs) {
+    // data read ahead enters the cache fifo, don't let it flush itself
+    // sequential sectors are spread over all shards
+    uint32_t a1in_max = fs->cache[0].a1in_max * TF_CACHE_SHARD_NUM;
+
+    fs->ra_sec_max = TF_READAHEAD_MAX * fs->clus_sec_num;
+    if (fs->ra_sec_max > a1in_max / 2) {
+        fs->ra_sec_max = a1in_max / 2 > 0 ? a1in_max / 2 : 1;
+    }
+
+    fs->rabuf = malloc(fs->ra_sec_max * fs->sec_size);
+    if (fs->rabuf == nullptr) {
+        return TF_ERR_NO_MEM;
+    }
+    tf_mutex_init(&fs->ra_lock);
+
+#if TF_READAHEAD_THREAD
+    pthread_cond_init(&fs->ra_cond, nullptr);
+    fs->ra_head = fs->ra_tail = 0;
+    fs->ra_stop               = false;
+    if (pthread_create(&fs->ra_thread, nullptr, tf_readahead_worker, fs) != 0) {
+        pthread_cond_destroy(&fs->ra_cond);
+        tf_mutex_deinit(&fs->ra_lock);
+        free(fs->rabuf);
+        fs->rabuf = nullptr;
+        return TF_ERR_NO_MEM;
+    }
+#endif
+
+    return 0;
+}
+
+
+/**
+ * @brief stop readahead of a fs
+ *
+ * @param fs
+ */
+static void tf_readahead_deinit(tf_fs_t* fs) {
+#if TF_READAHEAD_THREAD
+    tf_mutex_lock(&fs->ra_lock);
+    fs->ra_stop = true;
+    pthread_cond_signal(&fs->ra_cond);
+    tf_mutex_unlock(&fs->ra_lock);
+    pthread_join(fs->ra_thread, nullptr);
+
+    pthread_cond_destroy(&fs->ra_cond);
+#endif
+    tf_mutex_deinit(&fs->ra_lock);
+
+    free(fs->rabuf);
+    fs->rabuf = nullptr;
+}
+#endif
+
+
+/**
+ * @brief parse the date and time fields of a directory item
+ *
+ * @param date like DIR_WrtDate
+ * @param time like DIR_WrtTime
+ * @param t result value
+ */
+static void tf_time_parse(uint16_t date, uint16_t time, tf_time_t* t) {
+    t->year   = 1980 + (date >> 9);   // [15:9]
+    t->month  = (date >> 5) & 0x0F;   // [8:5]
+    t->day    = date & 0x1F;          // [4:0]
+    t->hour   = time >> 11;           // [15:11]
+    t->minite = (time >> 5) & 0x3F;   // [10:5]
+    t->second = (time & 0x1F) * 2;    // [4:0], 2 seconds a count
+}
+
+
+/**
+ * @brief parse a directory item from raw data
+ *
+ * @param raw
+ * @param item
+ */
+static void tf_item_parse(uint8_t* raw, tf_item_t* item) {
+    uint8_t attr = util_get_value_from_block(raw, 11, 1);   // DIR_Attr  11  1
+
+    if (attr == 0) {
+        item->attr = TF_FILEATTR_EMPTY;
+    } else if (raw[0] == 0xE5) {
+        item->attr = TF_FILEATTR_DELETED;
+    } else if (TF_MASK_MATCH(attr, TF_FILEATTR_LONG_FILE_NAME)) {
+        // lfn
+        item->attr = attr;
+#if TF_LFN_SUPPORTTED
+        item->name[TF_LFN_LEN_MAX - 1] = util_get_value_from_block(raw, 0, 1);   // LDIR_Ord 0   1
+        memcpy(item->name + 0, raw + 1, 10);                                     // p1       1   10
+        memcpy(item->name + 10, raw + 14, 12);                                   // p2       14  12
+        memcpy(item->name + 22, raw + 28, 4);                                    // p3       28  4
+#endif
+    } else {
+        // sfn
+        item->attr = attr;
+
+        memcpy(item->sfn, raw + 0, 11);   // DIR_Name  0   11
+        item->sfn[TF_SFN_LEN - 1] = '\0';
+
+        tf_time_parse(util_get_value_from_block(raw, 24, 2),                 // DIR_WrtDate    24 2
+                      util_get_value_from_block(raw, 22, 2),                 // DIR_WrtTime    22 2
+                      &item->write_time);
+        tf_time_parse(util_get_value_from_block(raw, 16, 2),                 // DIR_CrtDate    16 2
+                      util_get_value_from_block(raw, 14, 2),                 // DIR_CrtTime    14 2
+                      &item->create_time);
+
+        item->first_clus = (util_get_value_from_block(raw, 20, 2) << 16) |   // DIR_FstClusHI  20 2
+                           util_get_value_from_block(raw, 26, 2);            // DIR_FstClusLO  26 2
+        item->size = util_get_value_from_block(raw, 28, 4);                  // DIR_FileSize   28 4
+
+        item->cur_clus = item->first_clus;
+        item->cur_ofs  = 0;
+        item->ra_next  = 0;
+        item->ra_done  = 0;
+        item->ra_win   = 0;
+        item->dirty    = false;
+    }
+}
+
+
+/**
+ * @brief fill an opened item from the parsed dir item
+ *
+ * @param ent
+ * @param fs
+ * @param item result value
+ */
+static void tf_dirent_to_item(const tf_dirent_t* ent, tf_fs_t* fs, tf_item_t* item) {
+    memcpy(item->sfn, ent->sfn, TF_SFN_LEN);
+    item->attr        = ent->attr;
+    item->size        = ent->size;
+    item->first_clus  = ent->first_clus;
+    item->cur_clus    = ent->first_clus;
+    item->cur_ofs     = 0;
+    item->ra_next     = 0;
+    item->ra_done     = 0;
+    item->ra_win      = 0;
+    item->dir_clus    = ent->dir_clus;
+    item->dir_ofs     = ent->ofs;
+    item->dirty       = false;
+    item->write_time  = ent->write_time;
+    item->create_time = ent->create_time;
+    item->fs          = fs;
+}
+
+
+#if TF_DIR_INDEX || TF_INDEX
+/**
+ * @brief hash of the 11 bytes sfn, FNV-1a
+ *
+ * @param sfn
+ * @return uint32_t
+ */
+static uint32_t tf_sfn_hash(const char* sfn) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < TF_SFN_LEN - 1; i++) {
+        h = (h ^ (uint8_t)sfn[i]) * 16777619u;
+    }
+    return h;
+}
+#endif
+
+
+/**
+ * @brief find the first item of the sfn or the end item in a dir sector, items of other names are
+ * skipped without parsing
+ *
+ * only the names are compared, the caller checks the attr of the item found
+ *
+ * @param raw items of the sector
+ * @param from index of the item to start with
+ * @param num item number of the sector
+ * @param sfn 11 bytes sfn
+ * @return uint32_t index of the item found, num when neither
+ */
+static uint32_t tf_dirsec_find(const uint8_t* raw, uint32_t from, uint32_t num, const char* sfn) {
+    for (uint32_t i = from; i < num; i++) {
+        const uint8_t* ent = raw + i * TF_DIRITEM_SIZE;
+
+        // compiled to word compares, a SSE2 compare of 4 items a time is not faster for 16 items a sector
+        if (ent[11] == 0 || memcmp(ent, sfn, TF_SFN_LEN - 1) == 0) {
+            return i;
+        }
+    }
+    return num;
+}
+
+
+/**
+ * @brief read the dir sector at dir->cur_ofs, for scanning the dir by sectors
+ *
+ * @param dir cur_ofs should be aligned to sector
+ * @param data sector size
+ * @return bool false when no more sector
+ */
+static bool tf_dirsec_read(tf_item_t* dir, uint8_t* data) {
+#if TF_READAHEAD
+    tf_readahead(dir, dir->cur_ofs, dir->fs->sec_size);
+#endif
+    return tf_item_data_prefetch(dir, data, dir->fs->sec_size);
+}
+
+
+#if TF_DIR_INDEX || TF_INDEX
+/**
+ * @brief build the name index of a dir by scanning all its items
+ *
+ * @param dir
+ * @param idx result value
+ * @return int 0, TF_ERR_NO_MEM
+ */
+static int tf_diridx_build(tf_item_t* dir, tf_diridx_t* idx) {
+    tf_item_t scan;
+    tf_item_t item;
+    uint32_t  cap = 16;
+
+    memcpy(&scan, dir, sizeof(tf_item_t));
+    scan.cur_ofs  = 0;
+    scan.cur_clus = scan.first_clus;
+
+    idx->ents    = malloc(sizeof(tf_dirent_t) * cap);
+    idx->ent_num = 0;
+    if (idx->ents == nullptr) {
+        return TF_ERR_NO_MEM;
+    }
+
+    uint8_t  sec[TF_MAX_SECTOR_SIZE];
+    uint32_t num = dir->fs->sec_size / TF_DIRITEM_SIZE;
+
+    while (tf_dirsec_read(&scan, sec)) {
+        uint32_t i = 0;
+
+        for (; i < num; i++) {
+            uint8_t* raw = sec + i * TF_DIRITEM_SIZE;
+
+            // deleted and lfn items are skipped before parsing, the same as tf_dir_read
+            if (raw[11] == 0) {
+                break;
+            }
+            if (raw[0] == 0xE5 || TF_MASK_MATCH(raw[11], TF_FILEATTR_LONG_FILE_NAME)) {
+                continue;
+            }
+            tf_item_parse(raw, &item);
+            if (TF_MASK_MATCH(item.attr, TF_FILEATTR_DELETED)) {
+                continue;
+            }
+            item.dir_clus = scan.first_clus;
+            item.dir_ofs  = scan.cur_ofs + i * TF_DIRITEM_SIZE;
+
+            if (idx->ent_num == cap) {
+                tf_dirent_t* ents = realloc(idx->ents, sizeof(tf_dirent_t) * cap * 2);
+                if (ents == nullptr) {
+                    goto err_mem;
+                }
+                idx->ents = ents;
+                cap *= 2;
+            }
+
+            tf_dirent_t* ent = &idx->ents[idx->ent_num++];
+            memcpy(ent->sfn, item.sfn, TF_SFN_LEN);
+            ent->attr        = item.attr;
+            ent->size        = item.size;
+            ent->first_clus  = item.first_clus;
+            ent->ofs         = item.dir_ofs;
+            ent->dir_clus    = item.dir_clus;
+            ent->write_time  = item.write_time;
+            ent->create_time = item.create_time;
+        }
+
+        TF_STAT_ADD(dir->fs, lookup_items, i < num ? i + 1 : num);
+        if (i < num) {
+            break;   // end item
+        }
+        scan.cur_ofs += dir->fs->sec_size;
+    }
+
+    // open addressing, load factor <= 1/2
+    idx->hash_bits = 4;
+    while ((1u << idx->hash_bits) < idx->ent_num * 2) {
+        idx->hash_bits++;
+    }
+    idx->hash = malloc(sizeof(int32_t) << idx->hash_bits);
+    if (idx->hash == nullptr) {
+        goto err_mem;
+    }
+    memset(idx->hash, 0xFF, sizeof(int32_t) << idx->hash_bits);   // all -1
+
+    uint32_t mask = (1u << idx->hash_bits) - 1;
+    for (uint32_t i = 0; i < idx->ent_num; i++) {
+        uint32_t h = tf_sfn_hash(idx->ents[i].sfn) & mask;
+        while (idx->hash[h] >= 0 && memcmp(idx->ents[idx->hash[h]].sfn, idx->ents[i].sfn, TF_SFN_LEN - 1) != 0) {
+            h = (h + 1) & mask;
+        }
+        if (idx->hash[h] < 0) {   // the first one wins like a linear scan
+            idx->hash[h] = i;
+        }
+    }
+
+    idx->first_clus = dir->first_clus;
+    return 0;
+
+err_mem:
+    free(idx->ents);
+    idx->ents = nullptr;
+    return TF_ERR_NO_MEM;
+}
+#endif
+
+
+#if TF_DIR_INDEX
+/**
+ * @brief find a cached name index of a dir, or the lru one as victim
+ *
+ * @param fs
+ * @param first_clus
+ * @param victim result value
+ * @return tf_diridx_t* nullptr when not cached
+ */
+static tf_diridx_t* tf_diridx_find_cached(tf_fs_t* fs, uint32_t first_clus, tf_diridx_t** victim) {
+    *victim = &fs->diridxs[0];
+
+    fs->diridx_tick++;
+    for (int i = 0; i < TF_DIRIDX_NUM; i++) {
+        tf_diridx_t* idx = &fs->diridxs[i];
+
+        if (idx->ents != nullptr && idx->first_clus == first_clus) {
+            idx->tick = fs->diridx_tick;
+            return idx;
+        }
+        if (idx->tick < (*victim)->tick) {   // free one has tick 0
+            *victim = idx;
+        }
+    }
+
+    return nullptr;
+}
+
+
+/**
+ * @brief get the name index of a dir, build it when not cached
+ *
+ * called with fs->meta_lock held, which is released while building, the index is valid until
+ * the lock released
+ *
+ * @param dir
+ * @param built result value, the index built but not cached, free it after used
+ * @return tf_diridx_t* nullptr when no memory
+ */
+static tf_diridx_t* tf_diridx_get(tf_item_t* dir, tf_diridx_t* built) {
+    tf_fs_t*     fs = dir->fs;
+    tf_diridx_t* victim;
+    tf_diridx_t* idx = tf_diridx_find_cached(fs, dir->first_clus, &victim);
+    uint32_t     gen = fs->meta_gen;
+
+    if (idx != nullptr) {
+        return idx;
+    }
+
+    // scanning the dir reads disk, don't block others
+    tf_mutex_unlock(&fs->meta_lock);
+    int ret = tf_diridx_build(dir, built);
+    tf_mutex_lock(&fs->meta_lock);
+
+    if (ret != 0) {
+        return nullptr;
+    }
+
+    idx = tf_diridx_find_cached(fs, dir->first_clus, &victim);
+    if (idx != nullptr || gen != fs->meta_gen) {
+        // built by another one meanwhile, or invalidated while building
+        return idx != nullptr ? idx : built;
+    }
+
+    free(victim->ents);
+    free(victim->hash);
+    *victim      = *built;
+    victim->tick = fs->diridx_tick;
+    built->ents  = nullptr;
+    built->hash  = nullptr;
+
+    return victim;
+}
+#endif
+
+
+/**
+ * @brief free all cached dir indexes
+ *
+ * called with fs->meta_lock held
+ *
+ * @param fs
+ */
+static void tf_diridx_clear(tf_fs_t* fs) {
+    for (int i = 0; i < TF_DIRIDX_NUM; i++) {
+        free(fs->diridxs[i].ents);
+        free(fs->diridxs[i].hash);
+    }
+    memset(fs->diridxs, 0, sizeof(fs->diridxs));
+}
+
+
+/**
+ * @brief free the cached name index of a dir, like when an item is added
+ *
+ * called with fs->meta_lock held
+ *
+ * @param fs
+ * @param first_clus
+ */
+static void tf_diridx_drop(tf_fs_t* fs, uint32_t first_clus) {
+    for (int i = 0; i < TF_DIRIDX_NUM; i++) {
+        tf_diridx_t* idx = &fs->diridxs[i];
+
+        if (idx->ents != nullptr && idx->first_clus == first_clus) {
+            free(idx->ents);
+            free(idx->hash);
+            memset(idx, 0, sizeof(tf_diridx_t));
+        }
+    }
+}
+
+
+#if TF_INDEX
+/**
+ * @brief hash of an item in the sidecar index, by its name and dir
+ *
+ * @param sfn 11 bytes sfn
+ * @param dir_clus first cluster of the dir
+ * @return uint32_t
+ */
+static uint32_t tf_index_name_hash(const char* sfn, uint32_t dir_clus) {
+    return tf_sfn_hash(sfn) ^ (dir_clus * 2654435761u);
+}
+
+
+/**
+ * @brief find an item of the sfn in dir by the sidecar index, no dir read
+ *
+ * all items of a dir are in the index when the dir is
+ *
+ * @param dir
+ * @param sfn 11 bytes sfn
+ * @param item result value
+ * @return int 0, TF_ERR_PATH_NOT_FOUND, 1 when the dir is not in the index, or the index not used
+ */
+static int tf_index_lookup(tf_item_t* dir, const char* sfn, tf_item_t* item) {
+    tf_fs_t*               fs   = dir->fs;
+    const tf_index_node_t* node = tf_index_node(fs, dir->first_clus);
+
+    if (node == nullptr || !TF_MASK_MATCH(node->ent.attr, TF_FILEATTR_DIRECTORY)) {
+        return 1;
+    }
+
+    const tf_index_hdr_t*  hdr   = fs->index;
+    const tf_index_node_t* nodes = TF_INDEX_NODES(hdr);
+    uint32_t               h     = tf_index_name_hash(sfn, dir->first_clus) & ((1u << hdr->hash_bits) - 1);
+
+    // a chain is in dir order, the first one wins like a dir scan
+    for (int32_t n = tf_index_next(hdr, -1, TF_INDEX_NAME_HASH(hdr)[h]); n >= 0;
+         n = tf_index_next(hdr, n, nodes[n].name_next)) {
+        if (nodes[n].ent.dir_clus == dir->first_clus && memcmp(nodes[n].ent.sfn, sfn, TF_SFN_LEN - 1) == 0 &&
+            nodes[n].ent.sfn[TF_SFN_LEN - 1] == '\0') {
+            tf_dirent_to_item(&nodes[n].ent, fs, item);
+            return 0;
+        }
+    }
+    return TF_ERR_PATH_NOT_FOUND;
+}
+#endif
+
+
+/**
+ * @brief find an item of the sfn in dir, not recursive
+ *
+ * @param dir should be dir really
+ * @param sfn 11 bytes sfn
+ * @param item result value
+ * @return int 0, TF_ERR_PATH_NOT_FOUND
+ */
+static int tf_dir_lookup(tf_item_t* dir, const char* sfn, tf_item_t* item) {
+    TF_TRACE_SCOPE(TF_TRACE_LOOKUP, dir->first_clus);
+
+    TF_STAT_ADD(dir->fs, lookups, 1);
+
+#if TF_INDEX
+    int found = tf_index_lookup(dir, sfn, item);
+    if (found <= 0) {
+        return found;
+    }
+#endif
+
+#if TF_DIR_INDEX
+    tf_fs_t*    fs    = dir->fs;
+    tf_diridx_t built = {0};
+    int         ret   = TF_ERR_PATH_NOT_FOUND;
+
+    tf_mutex_lock(&fs->meta_lock);
+    tf_diridx_t* idx = tf_diridx_get(dir, &built);
+
+    if (idx != nullptr) {
+        uint32_t mask = (1u << idx->hash_bits) - 1;
+
+        for (uint32_t h = tf_sfn_hash(sfn) & mask; idx->hash[h] >= 0; h = (h + 1) & mask) {
+            tf_dirent_t* ent = &idx->ents[idx->hash[h]];
+            if (memcmp(ent->sfn, sfn, TF_SFN_LEN - 1) == 0) {
+                tf_dirent_to_item(ent, dir->fs, item);
+                ret = 0;
+                break;
+            }
+        }
+    }
+    tf_mutex_unlock(&fs->meta_lock);
+
+    free(built.ents);
+    free(built.hash);
+
+    if (idx != nullptr) {
+        return ret;
+    }
+#endif
+
+    // no index, scan the dir by sectors, only the item of the name is parsed
+    tf_item_t scan;
+    uint8_t   sec[TF_MAX_SECTOR_SIZE];
+    uint32_t  num = dir->fs->sec_size / TF_DIRITEM_SIZE;
+
+    memcpy(&scan, dir, sizeof(tf_item_t));
+    scan.cur_ofs  = 0;
+    scan.cur_clus = scan.first_clus;
+
+    while (tf_dirsec_read(&scan, sec)) {
+        for (uint32_t i = tf_dirsec_find(sec, 0, num, sfn); i < num; i = tf_dirsec_find(sec, i + 1, num, sfn)) {
+            uint8_t* raw = sec + i * TF_DIRITEM_SIZE;
+
+            if (raw[11] == 0) {
+                TF_STAT_ADD(dir->fs, lookup_items, i + 1);
+                return TF_ERR_PATH_NOT_FOUND;
+            }
+            tf_item_parse(raw, item);
+            if (TF_MASK_MATCH(item->attr, TF_FILEATTR_DELETED) ||
+                TF_MASK_MATCH(item->attr, TF_FILEATTR_LONG_FILE_NAME)) {
+                continue;
+            }
+            item->fs       = dir->fs;
+            item->dir_clus = scan.first_clus;
+            item->dir_ofs  = scan.cur_ofs + i * TF_DIRITEM_SIZE;
+            TF_STAT_ADD(dir->fs, lookup_items, i + 1);
+            return 0;
+        }
+        TF_STAT_ADD(dir->fs, lookup_items, num);
+        scan.cur_ofs += dir->fs->sec_size;
+    }
+    return TF_ERR_PATH_NOT_FOUND;
+}
+
+
+/**
+ * @brief find a path in the path cache
+ *
+ * @param fs
+ * @param subpath path without the "/" or "x:/" prefix
+ * @param hash hash of subpath
+ * @return tf_pathent_t* nullptr when miss
+ */
+static tf_pathent_t* tf_pathcache_find(tf_fs_t* fs, const char* subpath, uint32_t hash) {
+    for (int e = fs->pathhash[hash % TF_PATHCACHE_HASH]; e >= 0; e = fs->pathents[e].hnext) {
+        if (fs->pathents[e].hash == hash && strcmp(fs->pathents[e].path, subpath) == 0) {
+            return &fs->pathents[e];
+        }
+    }
+    return nullptr;
+}
+
+
+/**
+ * @brief remove an entry from the path cache
+ *
+ * @param fs
+ * @param e index of entry
+ */
+static void tf_pathcache_del(tf_fs_t* fs, int e) {
+    int16_t* link = &fs->pathhash[fs->pathents[e].hash % TF_PATHCACHE_HASH];
+    while (*link != e) {
+        link = &fs->pathents[*link].hnext;
+    }
+    *link = fs->pathents[e].hnext;
+
+    fs->pathents[e].path[0] = '\0';
+    fs->pathents[e].tick    = 0;
+}
+
+
+/**
+ * @brief put the result of a path search into the path cache, evict the lru one when full
+ *
+ * @param fs
+ * @param subpath path without the "/" or "x:/" prefix
+ * @param hash hash of subpath
+ * @param ret result of tf_dir_find
+ * @param item the item found when ret is 0
+ */
+static void tf_pathcache_put(tf_fs_t* fs, const char* subpath, uint32_t hash, int ret, tf_item_t* item) {
+    if (strlen(subpath) >= TF_PATHCACHE_PATH_LEN) {
+        return;
+    }
+
+    int victim = 0;
+    for (int e = 0; e < TF_PATHCACHE_NUM; e++) {
+        if (fs->pathents[e].tick < fs->pathents[victim].tick) {   // free one has tick 0
+            victim = e;
+        }
+    }
+    if (fs->pathents[victim].path[0] != '\0') {
+        tf_pathcache_del(fs, victim);
+    }
+
+    tf_pathent_t* pe = &fs->pathents[victim];
+    strcpy(pe->path, subpath);
+    pe->hash  = hash;
+    pe->ret   = ret;
+    pe->tick  = ++fs->path_tick;
+    pe->hnext = fs->pathhash[hash % TF_PATHCACHE_HASH];
+
+    fs->pathhash[hash % TF_PATHCACHE_HASH] = victim;
+
+    if (ret == 0) {
+        memcpy(pe->ent.sfn, item->sfn, TF_SFN_LEN);
+        pe->ent.attr        = item->attr;
+        pe->ent.size        = item->size;
+        pe->ent.first_clus  = item->first_clus;
+        pe->ent.ofs         = item->dir_ofs;
+        pe->ent.dir_clus    = item->dir_clus;
+        pe->ent.write_time  = item->write_time;
+        pe->ent.create_time = item->create_time;
+    }
+}
+
+
+/**
+ * @brief drop the cached results of a path and paths under it, and all not found results
+ *
+ * called with fs->meta_lock held
+ *
+ * @param fs
+ * @param subpath path without the "/" or "x:/" prefix, nullptr to drop all
+ */
+static void tf_pathcache_invalidate(tf_fs_t* fs, const char* subpath) {
+    int len = subpath != nullptr ? strlen(subpath) : 0;
+
+    for (int e = 0; e < TF_PATHCACHE_NUM; e++) {
+        tf_pathent_t* pe = &fs->pathents[e];
+
+        if (pe->path[0] == '\0') {
+            continue;
+        }
+        if (subpath == nullptr || pe->ret != 0 ||
+            (strncmp(pe->path, subpath, len) == 0 && (pe->path[len] == '\0' || pe->path[len] == '/'))) {
+            tf_pathcache_del(fs, e);
+        }
+    }
+}
+
+
+/**
+ * @brief init the path cache to empty
+ *
+ * @param fs
+ */
+static void tf_pathcache_init(tf_fs_t* fs) {
+    memset(fs->pathents, 0, sizeof(fs->pathents));
+    memset(fs->pathhash, 0xFF, sizeof(fs->pathhash));   // all -1
+    fs->path_tick = 0;
+}
+
+
+/**
+ * @brief read the boot sector of a volume, before the sector size is known
+ *
+ * sector ids (the volume offset in MBR too) are in the sectors of the device, which is what the BPB
+ * says, so each size FAT allows is tried until BPB_BytsPerSec is the size read with.
+ *
+ * @param dev device id
+ * @param volume_ofs first sector of the volume
+ * @param sec result value, TF_MAX_SECTOR_SIZE bytes
+ * @return int 0, TF_ERR_NO_FAT32LBA when no valid boot sector, TF_ERR_DISK_IO
+ */
+static int tf_fs_boot_read(int dev, uint32_t volume_ofs, uint8_t* sec) {
+    bool io_err = false;
+
+    for (uint32_t size = TF_DEFALUT_SECTOR_SIZE; size <= TF_MAX_SECTOR_SIZE; size *= 2) {
+        if (tf_disk_read_co(dev, volume_ofs, size, sec) != 0) {
+            io_err = true;   // may be out of the device, try the others
+            continue;
+        }
+        if (util_get_value_from_block(sec, 510, 2) == 0xAA55 && util_get_value_from_block(sec, 11, 2) == size) {
+            return 0;
+        }
+    }
+
+    return io_err ? TF_ERR_DISK_IO : TF_ERR_NO_FAT32LBA;
+}
+
+#if TF_INDEX
+/**
+ * @brief check a mapped sidecar index against the volume, a stale one is not used
+ *
+ * the nodes are not checked here, they are checked when used, so a broken file is not a crash
+ *
+ * @param fs FAT ready
+ * @param hdr
+ * @param size file size
+ * @return bool
+ */
+static bool tf_index_check(tf_fs_t* fs, const tf_index_hdr_t* hdr, uint64_t size) {
+    if (memcmp(hdr->magic, TF_INDEX_MAGIC, 4) != 0 || hdr->version != TF_INDEX_VERSION ||
+        hdr->node_size != sizeof(tf_index_node_t) || hdr->stale != 0 || hdr->vol_id != fs->vol_id ||
+        hdr->sec_num_total != fs->sec_num_total || hdr->fat_sec_num != fs->fat_sec_num ||
+        hdr->clus_num != fs->clus_num || hdr->sec_size != fs->sec_size || hdr->clus_sec_num != fs->clus_sec_num ||
+        hdr->hash_bits < 4 || hdr->hash_bits > 30 || hdr->node_num == 0 || hdr->node_num > INT32_MAX) {
+        return false;
+    }
+    if (size != sizeof(tf_index_hdr_t) + (uint64_t)hdr->node_num * sizeof(tf_index_node_t) +
+                    (uint64_t)hdr->ext_num * sizeof(tf_extent_t) + (sizeof(int32_t) << (hdr->hash_bits + 1))) {
+        return false;
+    }
+
+    uint64_t sum;
+    return tf_fat_sum(fs, &sum) == 0 && sum == hdr->fat_sum;
+}
+
+
+/**
+ * @brief map the sidecar index at mount, not used when it does not match the volume
+ *
+ * @param fs FAT ready
+ * @param path
+ */
+static void tf_index_load(tf_fs_t* fs, const char* path) {
+    // opened for writing when possible, to mark it stale
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        fd = open(path, O_RDONLY);
+    }
+    if (fd < 0) {
+        return;
+    }
+
+    off_t size = lseek(fd, 0, SEEK_END);
+    void* base = MAP_FAILED;
+    if (size >= (off_t)sizeof(tf_index_hdr_t)) {
+        base = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    if (base == MAP_FAILED || !tf_index_check(fs, base, size)) {
+        if (base != MAP_FAILED) {
+            munmap(base, size);
+        }
+        close(fd);
+        return;
+    }
+
+    fs->index      = base;
+    fs->index_size = size;
+    fs->index_fd   = fd;
+    fs->index_on   = 1;
+}
+
+
+/**
+ * @brief unmap the sidecar index at unmount
+ *
+ * @param fs
+ */
+static void tf_index_unload(tf_fs_t* fs) {
+    if (fs->index != nullptr) {
+        munmap((void*)fs->index, fs->index_size);
+        fs->index = nullptr;
+    }
+    if (fs->index_fd >= 0) {
+        close(fs->index_fd);
+        fs->index_fd = -1;
+    }
+}
+#endif
+
+/**
+ * @brief mount a device to a claimed fs, without fs_pool_lock, mounts of other devices go on meanwhile
+ *
+ * @param fs the slot claimed, label and dev set, others zero
+ * @param opt budgets, nullptr for the defaults
+ * @return int 0, TF_ERR_NO_FAT32LBA, TF_ERR_DISK_NOT_FOUND, TF_ERR_DISK_BUSY, TF_ERR_DISK_IO, TF_ERR_NO_MEM
+ */
+static int tf_fs_mount(tf_fs_t* fs, const tf_mount_opt_t* opt) {
+    int      dev        = fs->dev;
+    uint32_t volume_ofs = 0;
+    uint8_t  sec[TF_MAX_SECTOR_SIZE];
+
+    // device keeps opened until unmount
+    int ret = tf_disk_open(dev);
+    if (ret != 0) {
+        return ret;
+    }
+
+    fs->sec_size      = TF_DEFALUT_SECTOR_SIZE;
+    fs->cache_sec_num = opt != nullptr && opt->cache_sec_num != 0 ? opt->cache_sec_num : TF_CACHE_SEC_NUM;
+    fs->fatcache_size = opt != nullptr && opt->fatcache_size != 0 ? opt->fatcache_size : TF_FATCACHE_SIZE;
+    tf_pathcache_init(fs);
+#if TF_INDEX
+    fs->index_fd = -1;
+#endif
+
+    // the sectors for mount are used only once, read them without cache
+    // read first sector
+    if (tf_disk_read_co(dev, 0, fs->sec_size, sec) != 0) {
+        goto err_io;
+    }
+
+#if TF_WITH_MBR
+    // find first FAT32(LBA) partition
+    int i = 0;
+    for (i = 0; i < 4; i++) {
+        if (util_get_value_from_block(sec, 446 + 16 * i + 4, 1) == 0x0C) {   // 0x0C: FAT32 (LBA)
+            volume_ofs = util_get_value_from_block(sec, 446 + 16 * i + 8, 4);
+            break;
+        }
+    }
+    if (i == 4) {   // no fat32lba partition
+        tf_disk_close(dev);
+        return TF_ERR_NO_FAT32LBA;
+    }
+#else
+    // no MBR
+#endif
+
+    // read Boot sector, sector size of the device is BPB_BytsPerSec
+    ret = tf_fs_boot_read(dev, volume_ofs, sec);
+    if (ret != 0) {
+        tf_disk_close(dev);
+        return ret;
+    }
+
+    fs->sec_size            = util_get_value_from_block(sec, 11, 2);   // BPB_BytsPerSec
+    fs->clus_sec_num        = util_get_value_from_block(sec, 13, 1);   // BPB_SecPerClus
+    uint16_t resv_sec_num   = util_get_value_from_block(sec, 14, 2);   // BPB_RsvdSecCnt
+    uint8_t  fat_num        = util_get_value_from_block(sec, 16, 1);   // BPB_NumFATs
+    // uint32_t hidden_sec_num = util_get_value_from_block(sec, 28, 4);   // BPB_HiddSec
+    fs->sec_num_total       = util_get_value_from_block(sec, 32, 4);   // BPB_TotSec32
+    fs->fat_sec_num         = util_get_value_from_block(sec, 36, 4);   // BPB_FATSz32
+    uint16_t fsinfo_sec     = util_get_value_from_block(sec, 48, 2);   // BPB_FSInfo
+    fs->vol_id              = util_get_value_from_block(sec, 67, 4);   // BS_VolID
+
+    // a broken BPB would lead to dividing by zero or reading out of the volume
+    if (fs->clus_sec_num == 0 || (fs->clus_sec_num & (fs->clus_sec_num - 1)) != 0 || resv_sec_num == 0 ||
+        fat_num == 0 || fs->fat_sec_num == 0 ||
+        (uint64_t)resv_sec_num + (uint64_t)fs->fat_sec_num * fat_num + fs->clus_sec_num > fs->sec_num_total) {
+        tf_disk_close(dev);
+        return TF_ERR_NO_FAT32LBA;
+    }
+
+    // read FSInfo sector
+    if (tf_disk_read_co(dev, volume_ofs + fsinfo_sec, fs->sec_size, sec) != 0) {
+        goto err_io;
+    }
+
+    fs->free_clus_num  = util_get_value_from_block(sec, 488, 4);   // FSI_Free_Count
+    fs->next_free_clus = util_get_value_from_block(sec, 492, 4);   // FSI_Nxt_Free
+    fs->fsinfo_sec     = volume_ofs + fsinfo_sec;
+    fs->fat_num        = fat_num;
+
+    fs->fat_sec_ofs = volume_ofs + resv_sec_num;
+    fs->dat_sec_ofs = fs->fat_sec_ofs + fs->fat_sec_num * fat_num;
+    fs->clus_num    = (fs->sec_num_total - (fs->dat_sec_ofs - volume_ofs)) / fs->clus_sec_num + 2;
+    if (fs->clus_num > fs->fat_sec_num * (fs->sec_size / 4)) {
+        fs->clus_num = fs->fat_sec_num * (fs->sec_size / 4);
+    }
+
+    if (tf_fs_cache_init(fs) != 0) {
+        tf_disk_close(dev);
+        return TF_ERR_NO_MEM;
+    }
+
+    ret = tf_fat_init(fs);
+    if (ret != 0) {
+        tf_fs_cache_deinit(fs);
+        tf_disk_close(dev);
+        return ret;
+    }
+
+#if TF_READAHEAD
+    ret = tf_readahead_init(fs);
+    if (ret != 0) {
+        tf_fat_deinit(fs);
+        tf_fs_cache_deinit(fs);
+        tf_disk_close(dev);
+        return ret;
+    }
+#endif
+
+#if TF_CLUSMAP && !TF_CLUSMAP_LAZY
+    tf_clusmap_get(fs);   // not built when no memory, FAT is searched instead
+#endif
+
+#if TF_INDEX
+    if (opt != nullptr && opt->index_path != nullptr) {
+        tf_index_load(fs, opt->index_path);   // the volume is read as usual when not loaded
+    }
+#endif
+
+    tf_mutex_init(&fs->write_lock);
+    tf_mutex_init(&fs->meta_lock);
+
+    return 0;
+
+err_io:
+    tf_disk_close(dev);
+    return TF_ERR_DISK_IO;
+}
+
+/**
+ * @brief point fs_first to the mounted fs of the lowest slot
+ *
+ * called with fs_pool_lock held
+ */
+static void tf_fs_first_update(void) {
+    tf_fs_t* first = nullptr;
+
+    for (int i = 0; i < TF_MAX_FS_NUM && first == nullptr; i++) {
+        if (fs_by_label[(uint8_t)fs_pool[i].label] == &fs_pool[i]) {
+            first = &fs_pool[i];
+        }
+    }
+    tf_atomic_store_rel(&fs_first, first);
+}
+
+/**
+ * @brief get the mounted fs of a device, without a lock, the fs should not be unmounted meanwhile
+ *
+ * @param dev device id
+ * @return tf_fs_t* nullptr when not mounted
+ */
+static tf_fs_t* tf_fs_of_dev(int dev) {
+    if (dev < 0 || dev >= TF_MAX_DEV_NUM) {
+        return nullptr;
+    }
+    return tf_atomic_load_acq(&fs_by_dev[dev]);
+}
+
+/**
+ * @brief mount a device to file system
+ *
+ * @param dev device id
+ * @param label
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_MOUNT_LABEL_USED, TF_ERR_NO_FREE_FS, TF_ERR_NO_FAT32LBA,
+ *             TF_ERR_DISK_NOT_FOUND, TF_ERR_DISK_BUSY, TF_ERR_DISK_IO, TF_ERR_NO_MEM
+ */
+int tf_mount(int dev, char label) {
+    return tf_mount_ex(dev, label, nullptr);
+}
+
+/**
+ * @brief mount a device to file system, with the cache budgets of it
+ *
+ * @param dev device id
+ * @param label
+ * @param opt budgets, nullptr or zero fields for the defaults
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_MOUNT_LABEL_USED, TF_ERR_NO_FREE_FS, TF_ERR_NO_FAT32LBA,
+ *             TF_ERR_DISK_NOT_FOUND, TF_ERR_DISK_BUSY, TF_ERR_DISK_IO, TF_ERR_NO_MEM
+ */
+int tf_mount_ex(int dev, char label, const tf_mount_opt_t* opt) {
+    TF_TRACE_SCOPE(TF_TRACE_MOUNT, dev);
+
+    if (label == 0 || label == '/') {
+        return TF_ERR_WRONG_PARAM;
+    }
+
+    // claim a slot, the label and the device, the mount io is done without the lock
+    tf_mutex_lock(&fs_pool_lock);
+    int free = TF_MAX_FS_NUM;
+    for (int i = 0; i < TF_MAX_FS_NUM; i++) {
+        if (fs_pool[i].label == label) {
+            tf_mutex_unlock(&fs_pool_lock);
+            return TF_ERR_MOUNT_LABEL_USED;
+        }
+        if (fs_pool[i].label != 0 && fs_pool[i].dev == dev) {
+            tf_mutex_unlock(&fs_pool_lock);
+            return TF_ERR_DISK_BUSY;
+        }
+
+        if (free == TF_MAX_FS_NUM && fs_pool[i].label == 0) {
+            free = i;
+        }
+    }
+    if (free == TF_MAX_FS_NUM) {
+        tf_mutex_unlock(&fs_pool_lock);
+        return TF_ERR_NO_FREE_FS;
+    }
+
+    tf_fs_t* fs = &fs_pool[free];
+    memset(fs, 0, sizeof(tf_fs_t));
+    fs->label = label;
+    fs->dev   = dev;
+    tf_mutex_unlock(&fs_pool_lock);
+
+    int ret = tf_fs_mount(fs, opt);
+
+    // the fs is found by paths and device ids only from now on
+    tf_mutex_lock(&fs_pool_lock);
+    if (ret == 0) {
+        tf_atomic_store_rel(&fs_by_label[(uint8_t)label], fs);
+        tf_atomic_store_rel(&fs_by_dev[dev], fs);
+        tf_fs_first_update();
+    } else {
+        fs->label = 0;   // free
+    }
+    tf_mutex_unlock(&fs_pool_lock);
+
+    return ret;
+}
+
+/**
+ * @brief unmount device, changed data is written to disk first
+ *
+ * @param dev id
+ * @return int 0, TF_ERR_FS_UNMOUNT, TF_ERR_DISK_IO when write failed, the device is unmounted anyway
+ */
+int tf_unmount(int dev) {
+    TF_TRACE_SCOPE(TF_TRACE_UNMOUNT, dev);
+
+    // not found by others first, the slot is kept until the fs is torn down
+    tf_mutex_lock(&fs_pool_lock);
+    tf_fs_t* fs = tf_fs_of_dev(dev);
+    if (fs == nullptr) {
+        tf_mutex_unlock(&fs_pool_lock);
+        return TF_ERR_FS_UNMOUNT;
+    }
+    tf_atomic_store_rel(&fs_by_label[(uint8_t)fs->label], nullptr);
+    tf_atomic_store_rel(&fs_by_dev[dev], nullptr);
+    tf_fs_first_update();
+    tf_mutex_unlock(&fs_pool_lock);
+
+    tf_mutex_lock(&fs->write_lock);
+    int ret = tf_fs_sync(fs);
+    tf_mutex_unlock(&fs->write_lock);
+
+#if TF_READAHEAD
+    tf_readahead_deinit(fs);
+#endif
+    tf_extmap_clear(fs);
+    tf_diridx_clear(fs);
+#if TF_INDEX
+    tf_index_unload(fs);
+#endif
+    tf_mutex_deinit(&fs->meta_lock);
+    tf_mutex_deinit(&fs->write_lock);
+    tf_fs_cache_deinit(fs);
+    tf_fat_deinit(fs);
+    tf_disk_close(dev);
+
+    tf_mutex_lock(&fs_pool_lock);
+    fs->label = 0;   // free
+    tf_mutex_unlock(&fs_pool_lock);
+    return ret;
+}
+
+
+/**
+ * @brief open a file or dir
+ *
+ * @param path absolute path, like "/xxx" or "X:/xxx"
+ * @param item the file or dir at the path, result value
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_PATH_INVALID, TF_ERR_PATH_NOT_FOUND, TF_ERR_ITEM_NOT_DIR
+ */
+int tf_item_open(const char* path, tf_item_t* item) {
+    TF_TRACE_SCOPE(TF_TRACE_OPEN, 0);
+
+    if (path == nullptr || item == nullptr) {
+        return TF_ERR_WRONG_PARAM;
+    }
+
+    int pathlen = strlen(path);
+
+    if (pathlen == 0) {
+        return TF_ERR_PATH_INVALID;
+    }
+
+    // path could be like "/a/b/c" or "x:/a/b/c"
+    if (!(path[0] == '/') && !(pathlen >= 3 && path[1] == ':' && path[2] == '/')) {
+        return TF_ERR_PATH_INVALID;
+    }
+
+    // which fs of this path, "/a/b/c" is on the first fs, "x:/a/b/c" on the fs labeled x
+    tf_fs_t*    fs;
+    const char* subpath;
+    if (path[0] == '/') {
+        fs      = tf_atomic_load_acq(&fs_first);
+        subpath = &path[1];
+    } else {
+        fs      = tf_atomic_load_acq(&fs_by_label[(uint8_t)path[0]]);
+        subpath = &path[3];
+    }
+
+    if (fs == nullptr) {
+        return TF_ERR_PATH_NOT_FOUND;
+    }
+
+    // set item as root dir, cluster id start at 2
+    item->fs     = fs;
+    item->attr   = TF_FILEATTR_DIRECTORY;
+    item->sfn[0] = fs->label;
+    item->sfn[1] = '\0';
+    item->size   = 0;
+
+    item->first_clus = 2;
+    item->cur_clus   = item->first_clus;
+    item->cur_ofs    = 0;
+    item->ra_next    = 0;
+    item->ra_done    = 0;
+    item->ra_win     = 0;
+    item->dir_clus   = 0;
+    item->dir_ofs    = 0;
+    item->dirty      = false;
+
+    if (subpath[0] == '\0') {
+        return 0;
+    }
+
+    uint32_t hash = util_str_hash(subpath);
+    int      ret;
+
+    tf_mutex_lock(&fs->meta_lock);
+    tf_pathent_t* pe  = tf_pathcache_find(fs, subpath, hash);
+    uint32_t      gen = fs->meta_gen;
+    if (pe != nullptr) {
+        pe->tick = ++fs->path_tick;
+        ret      = pe->ret;
+        if (ret == 0) {
+            tf_dirent_to_item(&pe->ent, fs, item);
+        }
+    }
+    tf_mutex_unlock(&fs->meta_lock);
+
+    if (pe != nullptr) {
+        return ret;
+    }
+
+    // search subpath
+    ret = tf_dir_find(item, subpath, item);
+
+    // not found results are cached too, for probing missing files
+    if (ret == 0 || ret == TF_ERR_PATH_NOT_FOUND || ret == TF_ERR_PATH_NOT_DIR) {
+        tf_mutex_lock(&fs->meta_lock);
+        if (gen == fs->meta_gen && tf_pathcache_find(fs, subpath, hash) == nullptr) {
+            tf_pathcache_put(fs, subpath, hash, ret, item);
+        }
+        tf_mutex_unlock(&fs->meta_lock);
+    }
+
+    return ret;
+}
+
+
+/**
+ * @brief get the sector of a byte offset in a cluster chain
+ *
+ * @param fs
+ * @param first_clus
+ * @param ofs
+ * @param sec result value
+ * @return int 0, TF_ERR_NO_MEM, TF_ERR_DISK_IO when ofs is beyond the chain
+ */
+static int tf_chain_sec(tf_fs_t* fs, uint32_t first_clus, uint32_t ofs, uint32_t* sec) {
+    uint32_t     clus_size = fs->sec_size * fs->clus_sec_num;
+    tf_extmap_t* map       = tf_extmap_get(fs, first_clus);
+
+    if (map == nullptr) {
+        return TF_ERR_NO_MEM;
+    }
+
+    tf_extent_t* ext = tf_extmap_find(map, ofs / clus_size);
+    if (ext != nullptr) {
+        *sec = fs->dat_sec_ofs + fs->clus_sec_num * (ext->clus - 2) + (ofs - ext->fclus * clus_size) / fs->sec_size;
+    }
+    tf_extmap_put(fs, map);
+
+    return ext != nullptr ? 0 : TF_ERR_DISK_IO;
+}
+
+
+/**
+ * @brief write the size and first cluster of a changed item to its dir item, in the sector cache
+ *
+ * called with fs->write_lock held
+ *
+ * @param item
+ * @return int 0, TF_ERR_NO_MEM, TF_ERR_DISK_IO
+ */
+static int tf_item_sync(tf_item_t* item) {
+    tf_fs_t* fs = item->fs;
+    uint32_t sec;
+    uint8_t  raw[TF_DIRITEM_SIZE];
+
+    if (!item->dirty || item->dir_clus == 0) {
+        item->dirty = false;
+        return 0;
+    }
+
+    int ret = tf_chain_sec(fs, item->dir_clus, item->dir_ofs, &sec);
+    if (ret != 0) {
+        return ret;
+    }
+    if (tf_fs_disk_read(fs, sec, item->dir_ofs % fs->sec_size, raw, TF_DIRITEM_SIZE) != 0) {
+        return TF_ERR_DISK_IO;
+    }
+
+    util_set_value_to_block(raw, 20, 2, item->first_clus >> 16);      // DIR_FstClusHI  20 2
+    util_set_value_to_block(raw, 26, 2, item->first_clus & 0xFFFF);   // DIR_FstClusLO  26 2
+    util_set_value_to_block(raw, 28, 4, item->size);                  // DIR_FileSize   28 4
+
+#if TF_INDEX
+    tf_index_stale(fs);
+#endif
+    if (tf_fs_disk_write(fs, sec, item->dir_ofs % fs->sec_size, raw, TF_DIRITEM_SIZE, false) != 0) {
+        return TF_ERR_DISK_IO;
+    }
+
+    // update the cached results of the item in place
+    tf_mutex_lock(&fs->meta_lock);
+    fs->meta_gen++;
+    for (int i = 0; i < TF_DIRIDX_NUM; i++) {
+        tf_diridx_t* idx = &fs->diridxs[i];
+
+        if (idx->ents == nullptr || idx->first_clus != item->dir_clus) {
+            continue;
+        }
+        for (uint32_t j = 0; j < idx->ent_num; j++) {
+            if (idx->ents[j].ofs == item->dir_ofs) {
+                idx->ents[j].size       = item->size;
+                idx->ents[j].first_clus = item->first_clus;
+            }
+        }
+    }
+    for (int e = 0; e < TF_PATHCACHE_NUM; e++) {
+        tf_pathent_t* pe = &fs->pathents[e];
+
+        if (pe->path[0] != '\0' && pe->ret == 0 && pe->ent.dir_clus == item->dir_clus &&
+            pe->ent.ofs == item->dir_ofs) {
+            pe->ent.size       = item->size;
+            pe->ent.first_clus = item->first_clus;
+        }
+    }
+    tf_mutex_unlock(&fs->meta_lock);
+
+    item->dirty = false;
+    return 0;
+}
+
+
+/**
+ * @brief close a file or dir, the dir item of a written file is updated in cache
+ *
+ * @param dir
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_DISK_IO
+ */
+int tf_item_close(tf_item_t* item) {
+    if (item == nullptr) {
+        return TF_ERR_WRONG_PARAM;
+    }
+    if (!item->dirty) {
+        return 0;
+    }
+
+    tf_mutex_lock(&item->fs->write_lock);
+    int ret = tf_item_sync(item);
+    tf_mutex_unlock(&item->fs->write_lock);
+
+    return ret;
+};
+
+
+/**
+ * @brief read item from dir
+ *
+ * @param dir should be dir really
+ * @param item the item read from the dir, result value
+ * @return int 0, TF_STA_READDIR_END, TF_ERR_WRONG_PARAM, TF_ERR_ITEM_NOT_DIR
+ */
+int tf_dir_read(tf_item_t* dir, tf_item_t* item) {
+    TF_TRACE_SCOPE(TF_TRACE_DIR_READ, 0);
+
+    if (dir == nullptr || item == nullptr) {
+        return TF_ERR_WRONG_PARAM;
+    }
+
+    if (!TF_MASK_MATCH(dir->attr, TF_FILEATTR_DIRECTORY)) {
+        return TF_ERR_ITEM_NOT_DIR;
+    }
+
+    uint8_t raw[TF_DIRITEM_SIZE];
+
+#if TF_READAHEAD
+    tf_readahead(dir, dir->cur_ofs, TF_DIRITEM_SIZE);
+#endif
+
+    while (true) {
+        if (!tf_item_data_prefetch(dir, raw, TF_DIRITEM_SIZE)) {
+            return TF_STA_READDIR_END;
+        }
+
+        tf_item_parse(raw, item);
+        dir->cur_ofs += TF_DIRITEM_SIZE;
+
+        item->fs       = dir->fs;
+        item->dir_clus = dir->first_clus;
+        item->dir_ofs  = dir->cur_ofs - TF_DIRITEM_SIZE;
+
+        if (TF_MASK_MATCH(item->attr, TF_FILEATTR_EMPTY)) {
+            return TF_STA_READDIR_END;
+        }
+
+        if (TF_MASK_MATCH(item->attr, TF_FILEATTR_DELETED)) {   // deleted item, ignore it
+            continue;
+        }
+
+        if (TF_MASK_MATCH(item->attr, TF_FILEATTR_LONG_FILE_NAME)) {
+            // lfn item, ignore
+            continue;
+#if TF_LFN_SUPPORTTED
+            // for lfn
+            uint8_t ord = item->name[TF_LFN_LEN_MAX - 1];
+
+            if (TF_MASK_MATCH(ord, 0x40)) {   // first lfn
+                seq = (ord & 0x3F) - 1;
+            } else if (seq != ord) {          // invalid lfn item
+                seq = 0;
+                continue;
+            } else {
+                seq = ord - 1;
+            }
+
+            if (seq >= TF_LFN_LEN_MAX / 26 - 1) {   // lfn too long, not supported
+                seq = 0;
+                continue;
+            }
+
+            if (seq != 0) {
+                // current sequense, 13 wchar in lfn item
+                for (int i = 0; i < 26; i++) {
+                    item->name[i + 26 * seq] = item->name[i];
+                }
+            } else {
+                // name: utf-16 -> ascii
+                int i = 0;
+                for (i = 1; i < TF_LFN_LEN_MAX / 2; i++) {
+                    item->name[i] = item->name[i << 1];
+                }
+
+                with_lfn = true;
+                seq      = 0;
+                continue;
+            }
+#endif
+        } else {
+            // sfn
+            return 0;
+        }
+    }
+}
+
+
+/**
+ * @brief parse the fields in mask of a sfn dir item, attr is always set
+ *
+ * @param raw
+ * @param mask TF_DIRENT_*
+ * @param ent result value
+ */
+static void tf_dirent_parse(uint8_t* raw, uint32_t mask, tf_dirent_t* ent) {
+    ent->attr = raw[11];
+
+    if (mask & TF_DIRENT_NAME) {
+        memcpy(ent->sfn, raw + 0, 11);   // DIR_Name  0   11
+        ent->sfn[TF_SFN_LEN - 1] = '\0';
+    }
+    if (mask & TF_DIRENT_SIZE) {
+        ent->first_clus = (util_get_value_from_block(raw, 20, 2) << 16) |   // DIR_FstClusHI  20 2
+                          util_get_value_from_block(raw, 26, 2);            // DIR_FstClusLO  26 2
+        ent->size = util_get_value_from_block(raw, 28, 4);                  // DIR_FileSize   28 4
+    }
+    if (mask & TF_DIRENT_TIME) {
+        tf_time_parse(util_get_value_from_block(raw, 24, 2), util_get_value_from_block(raw, 22, 2), &ent->write_time);
+        tf_time_parse(util_get_value_from_block(raw, 16, 2), util_get_value_from_block(raw, 14, 2), &ent->create_time);
+    }
+}
+
+
+/**
+ * @brief read many items from dir at once, continues from where tf_dir_read or the last batch stops
+ *
+ * continuous dir clusters are read in one request, up to the sectors num items need, and the items
+ * are parsed right from the buffer, the deleted and lfn ones skipped without parsing.
+ *
+ * @param dir should be dir really
+ * @param ents the items read, result value
+ * @param num max items to read
+ * @param mask TF_DIRENT_* fields to fill, attr, ofs and dir_clus are always filled
+ * @return int items read, TF_STA_READDIR_END when no more, TF_ERR_WRONG_PARAM, TF_ERR_ITEM_NOT_DIR,
+ *             TF_ERR_NO_MEM
+ */
+int tf_dir_read_batch(tf_item_t* dir, tf_dirent_t* ents, int num, uint32_t mask) {
+    TF_TRACE_SCOPE(TF_TRACE_DIR_READ_BATCH, num);
+
+    if (dir == nullptr || (ents == nullptr && num > 0) || num < 0) {
+        return TF_ERR_WRONG_PARAM;
+    }
+
+    if (!TF_MASK_MATCH(dir->attr, TF_FILEATTR_DIRECTORY)) {
+        return TF_ERR_ITEM_NOT_DIR;
+    }
+    if (num == 0) {
+        return 0;
+    }
+
+    tf_fs_t*     fs        = dir->fs;
+    uint32_t     clus_size = fs->sec_size * fs->clus_sec_num;
+    uint32_t     per_sec   = fs->sec_size / TF_DIRITEM_SIZE;
+    tf_extmap_t* map       = tf_extmap_get(fs, dir->first_clus);
+
+    if (map == nullptr) {
+        return TF_ERR_NO_MEM;
+    }
+
+    // the sectors num items need, one more for a cursor in a sector, one sector when no memory
+    uint8_t  sec[TF_MAX_SECTOR_SIZE];
+    uint32_t buf_sec = ((uint64_t)num + per_sec - 1) / per_sec + 1;
+    if (buf_sec > TF_DIRBATCH_SIZE / fs->sec_size) {
+        buf_sec = TF_DIRBATCH_SIZE / fs->sec_size;
+    }
+    uint8_t* buf = malloc(buf_sec * fs->sec_size);
+    if (buf == nullptr) {
+        buf     = sec;
+        buf_sec = 1;
+    }
+
+    int  n   = 0;
+    bool end = false;
+
+    while (n < num && !end) {
+        tf_extent_t* ext = tf_extmap_find(map, dir->cur_ofs / clus_size);
+        if (ext == nullptr) {
+            break;   // no more cluster
+        }
+
+        // sectors from the one of cur_ofs to the extent end
+        uint32_t sec_in_ext = (dir->cur_ofs - ext->fclus * clus_size) / fs->sec_size;
+        uint32_t sec_num    = ext->len * fs->clus_sec_num - sec_in_ext;
+        if (sec_num > buf_sec) {
+            sec_num = buf_sec;
+        }
+        uint32_t first  = fs->dat_sec_ofs + fs->clus_sec_num * (ext->clus - 2) + sec_in_ext;
+        uint32_t wb_num = tf_atomic_load(&fs->cache_wb_num);
+        if (tf_fs_sec_cached(fs, first)) {
+            // recently read or written, like the sector of the cursor kept by the last call
+            sec_num = 1;
+            if (tf_fs_disk_read(fs, first, 0, buf, fs->sec_size) != 0) {
+                break;
+            }
+        } else {
+            if (tf_disk_readn_co(fs->dev, first, sec_num, fs->sec_size, buf) != 0) {
+                break;
+            }
+            tf_fs_dirty_overlay(fs, first, sec_num, buf);
+        }
+
+        // byte offset in dir of buf
+        uint32_t base = dir->cur_ofs - dir->cur_ofs % fs->sec_size;
+        uint32_t i    = (dir->cur_ofs - base) / TF_DIRITEM_SIZE;
+        for (; i < sec_num * per_sec && n < num; i++) {
+            uint8_t* raw = buf + i * TF_DIRITEM_SIZE;
+
+            if (raw[11] == 0) {
+                end = true;   // end item, the cursor stays on it
+                break;
+            }
+            if (raw[0] != 0xE5 && !TF_MASK_MATCH(raw[11], TF_FILEATTR_LONG_FILE_NAME)) {
+                tf_dirent_parse(raw, mask, &ents[n]);
+                ents[n].dir_clus = dir->first_clus;
+                ents[n].ofs      = base + i * TF_DIRITEM_SIZE;
+                n++;
+            }
+        }
+        dir->cur_ofs = base + i * TF_DIRITEM_SIZE;
+
+        // the next call starts in the sector of the cursor, like on the end item, keep it
+        if (i < sec_num * per_sec) {
+            tf_fs_cache_put(fs, first + i / per_sec, buf + i / per_sec * fs->sec_size, wb_num);
+        }
+    }
+
+    // cur_clus keeps the cluster of the last byte read, like tf_item_clus_locate
+    if (dir->cur_ofs > 0) {
+        tf_extent_t* ext = tf_extmap_find(map, (dir->cur_ofs - 1) / clus_size);
+        if (ext != nullptr) {
+            dir->cur_clus = ext->clus + (dir->cur_ofs - 1) / clus_size - ext->fclus;
+        }
+    }
+
+    tf_extmap_put(fs, map);
+    if (buf != sec) {
+        free(buf);
+    }
+
+    return n > 0 ? n : TF_STA_READDIR_END;
+}
+
+
+typedef struct tf_walk_node {
+    struct tf_walk_node* parent;
+    uint32_t             pending;   // its own listing, and the subdirs not finished
+    int                  depth;
+    tf_dirent_t          ent;
+    char                 path[];
+} tf_walk_node_t;
+
+typedef struct {
+    tf_mutex_t       lock;
+    tf_walk_node_t** nodes;   // ring, the owner works at tail, thieves take from head
+    uint32_t         head;
+    uint32_t         tail;
+    uint32_t         cap;     // power of 2
+} tf_walk_deque_t;
+
+typedef struct {
+    tf_fs_t*        fs;
+    tf_walk_fn_t    fn;
+    void*           ctx;
+    uint32_t        flags;
+    int             worker_num;
+    tf_walk_deque_t deques[TF_WALK_THREADS];
+    uint32_t        tasks;   // dirs queued or being listed, the walk is done at 0
+    int             ret;     // the first stop value or error, the walk stops when not 0
+#if TF_THREAD_SAFE
+    tf_mutex_t     lock;     // for idle and sleeping
+    pthread_cond_t cond;
+    uint32_t       idle;
+#endif
+} tf_walk_t;
+
+typedef struct {
+    tf_walk_t* walk;
+    int        id;
+} tf_walk_worker_t;
+
+
+/**
+ * @brief push a dir to list to the tail of a deque
+ *
+ * @return int 0, TF_ERR_NO_MEM
+ */
+static int tf_walk_push(tf_walk_deque_t* dq, tf_walk_node_t* node) {
+    tf_mutex_lock(&dq->lock);
+    if (dq->tail - dq->head == dq->cap) {
+        uint32_t         cap   = dq->cap > 0 ? dq->cap * 2 : 64;
+        tf_walk_node_t** nodes = malloc(sizeof(tf_walk_node_t*) * cap);
+        if (nodes == nullptr) {
+            tf_mutex_unlock(&dq->lock);
+            return TF_ERR_NO_MEM;
+        }
+        for (uint32_t i = dq->head; i != dq->tail; i++) {
+            nodes[i & (cap - 1)] = dq->nodes[i & (dq->cap - 1)];
+        }
+        free(dq->nodes);
+        dq->nodes = nodes;
+        dq->cap   = cap;
+    }
+    dq->nodes[dq->tail++ & (dq->cap - 1)] = node;
+    tf_mutex_unlock(&dq->lock);
+    return 0;
+}
+
+/**
+ * @brief take a dir from a deque, the newest one for its owner (depth first, the dirs are warm), the
+ * oldest one for thieves (near the root, large subtrees)
+ *
+ * @return tf_walk_node_t* nullptr when empty
+ */
+static tf_walk_node_t* tf_walk_take(tf_walk_deque_t* dq, bool own) {
+    tf_walk_node_t* node = nullptr;
+
+    tf_mutex_lock(&dq->lock);
+    if (dq->head != dq->tail) {
+        node = own ? dq->nodes[--dq->tail & (dq->cap - 1)] : dq->nodes[dq->head++ & (dq->cap - 1)];
+    }
+    tf_mutex_unlock(&dq->lock);
+    return node;
+}
+
+/**
+ * @brief take a dir from the own deque, or steal one from the others
+ */
+static tf_walk_node_t* tf_walk_next(tf_walk_t* walk, int id) {
+    tf_walk_node_t* node = tf_walk_take(&walk->deques[id], true);
+
+    for (int i = 1; i < walk->worker_num && node == nullptr; i++) {
+        node = tf_walk_take(&walk->deques[(id + i) % walk->worker_num], false);
+    }
+    return node;
+}
+
+/**
+ * @brief keep the first stop value or error
+ */
+static void tf_walk_stop(tf_walk_t* walk, int ret) {
+    int zero = 0;
+    __atomic_compare_exchange_n(&walk->ret, &zero, ret, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+static bool tf_walk_stopped(tf_walk_t* walk) {
+    return tf_atomic_load(&walk->ret) != 0;
+}
+
+/**
+ * @brief call the visitor, a stop value stops the walk
+ *
+ * @return int the visitor result
+ */
+static int tf_walk_visit(tf_walk_t* walk, const char* path, const tf_dirent_t* ent, int depth, int type) {
+    int ret = walk->fn(path, ent, depth, type, walk->ctx);
+    if (ret != 0 && ret != TF_WALK_SKIP) {
+        tf_walk_stop(walk, ret);
+    }
+    return ret;
+}
+
+/**
+ * @brief a listing or a subdir of the dir is finished, the post-order visit is done after the last one,
+ * and so on up to the root
+ */
+static void tf_walk_done(tf_walk_t* walk, tf_walk_node_t* node) {
+    while (node != nullptr && __atomic_sub_fetch(&node->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+        tf_walk_node_t* parent = node->parent;
+
+        if ((walk->flags & TF_WALK_POST) && !tf_walk_stopped(walk)) {
+            tf_walk_visit(walk, node->path, &node->ent, node->depth, TF_WALK_DP);
+        }
+        free(node);
+        node = parent;
+    }
+}
+
+/**
+ * @brief tell the sleeping workers there are dirs to steal, or the walk is done
+ */
+static void tf_walk_wake(tf_walk_t* walk, bool all) {
+#if TF_THREAD_SAFE
+    if (all || tf_atomic_load(&walk->idle) > 0) {
+        tf_mutex_lock(&walk->lock);
+        if (all) {
+            pthread_cond_broadcast(&walk->cond);
+        } else {
+            pthread_cond_signal(&walk->cond);
+        }
+        tf_mutex_unlock(&walk->lock);
+    }
+#else
+    (void)walk;
+    (void)all;
+#endif
+}
+
+/**
+ * @brief list a dir, visit its files, and its subdirs in pre-order, then queue the subdirs
+ */
+static void tf_walk_list(tf_walk_t* walk, int id, tf_walk_node_t* node) {
+    tf_item_t   dir;
+    tf_dirent_t ents[TF_WALK_BATCH];
+    size_t      path_len = strlen(node->path);
+    bool        slash    = path_len > 0 && node->path[path_len - 1] != '/';
+    int         num      = 0;
+
+    tf_dirent_to_item(&node->ent, walk->fs, &dir);
+
+    while (!tf_walk_stopped(walk) && (num = tf_dir_read_batch(&dir, ents, TF_WALK_BATCH, TF_DIRENT_ALL)) > 0) {
+        for (int i = 0; i < num && !tf_walk_stopped(walk); i++) {
+            tf_dirent_t* ent = &ents[i];
+
+            if (ent->sfn[0] == '.' || TF_MASK_MATCH(ent->attr, TF_FILEATTR_VOLUME_ID)) {
+                continue;   // "." and "..", the volume label
+            }
+
+            char name[TF_FN_LEN_MAX];
+            util_sfn2name(ent->sfn, name);
+
+            tf_walk_node_t* child = malloc(sizeof(tf_walk_node_t) + path_len + 1 + strlen(name) + 1);
+            if (child == nullptr) {
+                tf_walk_stop(walk, TF_ERR_NO_MEM);
+                break;
+            }
+            sprintf(child->path, "%s%s%s", node->path, slash ? "/" : "", name);
+
+            if (!TF_MASK_MATCH(ent->attr, TF_FILEATTR_DIRECTORY)) {
+                tf_walk_visit(walk, child->path, ent, node->depth + 1, TF_WALK_F);
+                free(child);
+                continue;
+            }
+
+            if ((walk->flags & TF_WALK_PRE) && tf_walk_visit(walk, child->path, ent, node->depth + 1, TF_WALK_D) != 0) {
+                free(child);
+                continue;   // pruned, or stopped
+            }
+
+            child->parent  = node;
+            child->pending = 1;
+            child->depth   = node->depth + 1;
+            child->ent     = *ent;
+
+            __atomic_add_fetch(&node->pending, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&walk->tasks, 1, __ATOMIC_RELAXED);
+            if (tf_walk_push(&walk->deques[id], child) != 0) {
+                __atomic_sub_fetch(&walk->tasks, 1, __ATOMIC_RELAXED);
+                __atomic_sub_fetch(&node->pending, 1, __ATOMIC_RELAXED);
+                free(child);
+                tf_walk_stop(walk, TF_ERR_NO_MEM);
+                break;
+            }
+            tf_walk_wake(walk, false);
+        }
+    }
+    if (num < 0 && num != TF_STA_READDIR_END) {
+        tf_walk_stop(walk, num);
+    }
+
+    tf_walk_done(walk, node);
+    if (__atomic_sub_fetch(&walk->tasks, 1, __ATOMIC_ACQ_REL) == 0) {
+        tf_walk_wake(walk, true);
+    }
+}
+
+/**
+ * @brief list dirs until no dir is queued or being listed, dirs queued after a stop are dropped
+ */
+static void* tf_walk_worker(void* arg) {
+    tf_walk_worker_t* worker = arg;
+    tf_walk_t*        walk   = worker->walk;
+
+    while (true) {
+        tf_walk_node_t* node = tf_walk_next(walk, worker->id);
+        if (node != nullptr) {
+            tf_walk_list(walk, worker->id, node);
+            continue;
+        }
+
+#if TF_THREAD_SAFE
+        // nothing to steal, sleep until some dir is queued, a push after the check below wakes us
+        tf_mutex_lock(&walk->lock);
+        tf_atomic_add(&walk->idle, 1);
+        while (__atomic_load_n(&walk->tasks, __ATOMIC_ACQUIRE) > 0 &&
+               (node = tf_walk_next(walk, worker->id)) == nullptr) {
+            pthread_cond_wait(&walk->cond, &walk->lock);
+        }
+        tf_atomic_add(&walk->idle, -1);
+        tf_mutex_unlock(&walk->lock);
+
+        if (node != nullptr) {
+            tf_walk_list(walk, worker->id, node);
+            continue;
+        }
+#endif
+        break;   // all done
+    }
+    return nullptr;
+}
+
+
+/**
+ * @brief visit every item below a dir, the subdirs are listed by a pool of threads
+ *
+ * the visitor is called from many threads at once, in no given order except that a dir is visited in
+ * pre-order before its items and in post-order after all items below it.
+ *
+ * @param path absolute path of the dir to start, or of a file to visit only
+ * @param fn the visitor
+ * @param ctx passed to fn
+ * @param flags TF_WALK_PRE, TF_WALK_POST, for the visits of dirs
+ * @param threads workers include the caller, up to TF_WALK_THREADS, 0 for all; 1 when not TF_THREAD_SAFE
+ * @return int 0, the first value of fn not 0 or TF_WALK_SKIP, TF_ERR_WRONG_PARAM, TF_ERR_PATH_INVALID,
+ *             TF_ERR_PATH_NOT_FOUND, TF_ERR_NO_MEM, TF_ERR_DISK_IO
+ */
+int tf_walk(const char* path, tf_walk_fn_t fn, void* ctx, uint32_t flags, int threads) {
+    if (path == nullptr || fn == nullptr || threads < 0) {
+        return TF_ERR_WRONG_PARAM;
+    }
+
+    tf_item_t root;
+    int       ret = tf_item_open(path, &root);
+    if (ret != 0) {
+        return ret;
+    }
+
+    tf_walk_node_t* node = malloc(sizeof(tf_walk_node_t) + strlen(path) + 1);
+    if (node == nullptr) {
+        return TF_ERR_NO_MEM;
+    }
+    strcpy(node->path, path);
+    node->parent  = nullptr;
+    node->pending = 1;
+    node->depth   = 0;
+
+    tf_dirent_t* ent = &node->ent;
+    memcpy(ent->sfn, root.sfn, TF_SFN_LEN);
+    ent->attr        = root.attr;
+    ent->size        = root.size;
+    ent->first_clus  = root.first_clus;
+    ent->ofs         = root.dir_ofs;
+    ent->dir_clus    = root.dir_clus;
+    ent->write_time  = root.write_time;
+    ent->create_time = root.create_time;
+
+    if (!TF_MASK_MATCH(root.attr, TF_FILEATTR_DIRECTORY)) {
+        ret = fn(path, ent, 0, TF_WALK_F, ctx);
+        free(node);
+        return ret == TF_WALK_SKIP ? 0 : ret;
+    }
+
+    if (flags & TF_WALK_PRE) {
+        ret = fn(path, ent, 0, TF_WALK_D, ctx);
+        if (ret != 0) {
+            free(node);
+            return ret == TF_WALK_SKIP ? 0 : ret;
+        }
+    }
+
+    tf_walk_t* walk = calloc(1, sizeof(tf_walk_t));
+    if (walk == nullptr) {
+        free(node);
+        return TF_ERR_NO_MEM;
+    }
+    walk->fs         = root.fs;
+    walk->fn         = fn;
+    walk->ctx        = ctx;
+    walk->flags      = flags;
+    walk->worker_num = threads == 0 || threads > TF_WALK_THREADS ? TF_WALK_THREADS : threads;
+    walk->tasks      = 1;
+#if !TF_THREAD_SAFE
+    walk->worker_num = 1;
+#endif
+    for (int i = 0; i < walk->worker_num; i++) {
+        tf_mutex_init(&walk->deques[i].lock);
+    }
+    if (tf_walk_push(&walk->deques[0], node) != 0) {
+        free(node);
+        walk->tasks = 0;
+        walk->ret   = TF_ERR_NO_MEM;
+    }
+
+    tf_walk_worker_t workers[TF_WALK_THREADS];
+#if TF_THREAD_SAFE
+    pthread_t tids[TF_WALK_THREADS];
+    int       started = 1;
+
+    tf_mutex_init(&walk->lock);
+    pthread_cond_init(&walk->cond, nullptr);
+    for (; started < walk->worker_num; started++) {
+        workers[started].walk = walk;
+        workers[started].id   = started;
+        if (pthread_create(&tids[started], nullptr, tf_walk_worker, &workers[started]) != 0) {
+            break;   // fewer workers, the others steal its deque
+        }
+    }
+#endif
+
+    workers[0].walk = walk;
+    workers[0].id   = 0;
+    tf_walk_worker(&workers[0]);
+
+#if TF_THREAD_SAFE
+    for (int i = 1; i < started; i++) {
+        pthread_join(tids[i], nullptr);
+    }
+    pthread_cond_destroy(&walk->cond);
+    tf_mutex_deinit(&walk->lock);
+#endif
+
+    for (int i = 0; i < walk->worker_num; i++) {
+        free(walk->deques[i].nodes);
+        tf_mutex_deinit(&walk->deques[i].lock);
+    }
+    ret = walk->ret;
+    free(walk);
+    return ret;
+}
+
+
+/**
+ * @brief find an item from dir of subpath
+ *
+ * @param dir should be dir really
+ * @param subpath should not start by '/'
+ * @param item the item found in the dir, result value
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_ITEM_NOT_DIR, TF_ERR_PATH_INVALID, TF_ERR_PATH_NOT_FOUND
+ */
+int tf_dir_find(tf_item_t* dir, const char* subpath, tf_item_t* item) {
+    if (dir == nullptr || subpath == nullptr || item == nullptr) {
+        return TF_ERR_WRONG_PARAM;
+    }
+    if (!TF_MASK_MATCH(dir->attr, TF_FILEATTR_DIRECTORY)) {
+        return TF_ERR_ITEM_NOT_DIR;
+    }
+
+    tf_item_t tempbase;
+    char      name[TF_FN_LEN_MAX] = {0};
+    char      sfn[TF_SFN_LEN]     = {0};
+
+    memcpy(&tempbase, dir, sizeof(tf_item_t));
+
+    while (true) {
+        util_logger("<tf_dir_find> enter dir `%s`, try find `%s`\n", dir->sfn, subpath);
+
+        if (subpath[0] == '\0') {
+            // subpath like "a/b/c/"
+            util_logger("<tf_dir_find> found `%s`\n", subpath);
+            memcpy(item, &tempbase, sizeof(tf_item_t));
+            return 0;
+        }
+
+        if (subpath[0] == '/') {
+            return TF_ERR_PATH_INVALID;
+        }
+
+        // first part of subpath
+        int sep = util_get_1st_subpath(subpath, name);
+        if (sep < 0) {
+            return sep;
+        }
+        util_name2sfn(name, sfn);
+
+        if (tf_dir_lookup(&tempbase, sfn, item) != 0) {
+            // path part not found
+            return TF_ERR_PATH_NOT_FOUND;
+        }
+
+        if (strcmp(name, "..") == 0 && item->first_clus == 0) {
+            // ".." is the root cluster
+            item->cur_clus = item->first_clus = 2;
+        }
+
+        if (subpath[sep] == '\0') {
+            // item is the wanted file/dir
+            util_logger("<tf_dir_find> found `%s`\n", subpath);
+            return 0;
+        }
+
+        // subpath[sep] == '/'
+        // item is a subdir contains the wanted file/dir
+
+        // confirm item is a dir
+        if (!TF_MASK_MATCH(item->attr, TF_FILEATTR_DIRECTORY)) {
+            return TF_ERR_PATH_NOT_DIR;
+        }
+
+        memcpy(&tempbase, item, sizeof(tf_item_t));
+        subpath += sep + 1;
+    }
+}
+
+
+/**
+ * @brief convert the name of a new item to sfn, the name should be 8.3
+ *
+ * @param name
+ * @param sfn result value
+ * @return int 0, TF_ERR_PATH_INVALID, TF_ERR_LFN_NOT_SUPPORTED
+ */
+static int tf_name_to_sfn(const char* name, char* sfn) {
+    const char* dot  = strchr(name, '.');
+    int         base = dot != nullptr ? dot - name : (int)strlen(name);
+    int         ext  = dot != nullptr ? (int)strlen(dot + 1) : 0;
+
+    // "", ".", "..", ".x", "x."
+    if (base == 0 || (dot != nullptr && ext == 0)) {
+        return TF_ERR_PATH_INVALID;
+    }
+    for (const char* c = name; *c != '\0'; c++) {
+        if ((uint8_t)*c < 0x20 || strchr("\"*+,/:;<=>?[\\]| ", *c) != nullptr) {
+            return TF_ERR_PATH_INVALID;
+        }
+    }
+    if (base > 8 || ext > 3 || (dot != nullptr && strchr(dot + 1, '.') != nullptr)) {
+        return TF_ERR_LFN_NOT_SUPPORTED;
+    }
+
+    util_name2sfn(name, sfn);
+    return 0;
+}
+
+
+/**
+ * @brief make a raw dir item
+ *
+ * @param raw result value
+ * @param sfn 11 bytes sfn
+ * @param attr
+ * @param first_clus
+ */
+static void tf_dirent_make(uint8_t* raw, const char* sfn, uint8_t attr, uint32_t first_clus) {
+    memset(raw, 0, TF_DIRITEM_SIZE);
+    memcpy(raw, sfn, TF_SFN_LEN - 1);                                 // DIR_Name       0  11
+    util_set_value_to_block(raw, 11, 1, attr);                        // DIR_Attr       11 1
+    util_set_value_to_block(raw, 16, 2, TF_DATE_NO_RTC);              // DIR_CrtDate    16 2
+    util_set_value_to_block(raw, 18, 2, TF_DATE_NO_RTC);              // DIR_LstAccDate 18 2
+    util_set_value_to_block(raw, 20, 2, first_clus >> 16);            // DIR_FstClusHI  20 2
+    util_set_value_to_block(raw, 24, 2, TF_DATE_NO_RTC);              // DIR_WrtDate    24 2
+    util_set_value_to_block(raw, 26, 2, first_clus & 0xFFFF);         // DIR_FstClusLO  26 2
+}
+
+
+/**
+ * @brief fill a new cluster with zero, on disk directly
+ *
+ * @param fs
+ * @param clus
+ * @return int 0, TF_ERR_NO_MEM, TF_ERR_DISK_IO
+ */
+static int tf_clus_zero(tf_fs_t* fs, uint32_t clus) {
+    uint32_t sec  = fs->dat_sec_ofs + fs->clus_sec_num * (clus - 2);
+    uint8_t* zero = calloc(fs->clus_sec_num, fs->sec_size);
+
+    if (zero == nullptr) {
+        return TF_ERR_NO_MEM;
+    }
+
+    tf_fs_cache_drop(fs, sec, fs->clus_sec_num);
+    int ret = tf_disk_writen_co(fs->dev, sec, fs->clus_sec_num, fs->sec_size, zero) == 0 ? 0 : TF_ERR_DISK_IO;
+
+    free(zero);
+    return ret;
+}
+
+
+/**
+ * @brief create an empty file or dir
+ *
+ * @param path absolute path, the dir contains it should exist
+ * @param attr TF_FILEATTR_ARCHIVE or TF_FILEATTR_DIRECTORY
+ * @param item the item created, result value, may be nullptr
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_PATH_INVALID, TF_ERR_PATH_NOT_FOUND, TF_ERR_PATH_EXISTS,
+ *             TF_ERR_LFN_NOT_SUPPORTED, TF_ERR_NO_SPACE, TF_ERR_DISK_IO, TF_ERR_NO_MEM
+ */
+static int tf_item_create(const char* path, uint8_t attr, tf_item_t* item) {
+    if (path == nullptr) {
+        return TF_ERR_WRONG_PARAM;
+    }
+
+    const char* name = strrchr(path, '/');
+    char        sfn[TF_SFN_LEN];
+
+    if (name == nullptr) {
+        return TF_ERR_PATH_INVALID;
+    }
+    name++;
+
+    int ret = tf_name_to_sfn(name, sfn);
+    if (ret != 0) {
+        return ret;
+    }
+
+    // open the dir contains it, the path keeps the last '/'
+    char*     dirpath = malloc(name - path + 1);
+    tf_item_t dir;
+    if (dirpath == nullptr) {
+        return TF_ERR_NO_MEM;
+    }
+    memcpy(dirpath, path, name - path);
+    dirpath[name - path] = '\0';
+    ret                  = tf_item_open(dirpath, &dir);
+    free(dirpath);
+
+    if (ret == TF_ERR_PATH_NOT_DIR) {
+        return TF_ERR_PATH_NOT_FOUND;
+    }
+    if (ret != 0) {
+        return ret;
+    }
+
+    tf_fs_t*  fs        = dir.fs;
+    uint32_t  clus_size = fs->sec_size * fs->clus_sec_num;
+    uint32_t  first     = 0;
+    uint32_t  sec;
+    uint8_t   raw[TF_DIRITEM_SIZE];
+    tf_item_t scan;
+
+    tf_mutex_lock(&fs->write_lock);
+
+    if (tf_dir_lookup(&dir, sfn, &scan) == 0) {
+        ret = TF_ERR_PATH_EXISTS;
+        goto out;
+    }
+#if TF_INDEX
+    tf_index_stale(fs);
+#endif
+
+    // the first free item, or the end of the dir
+    memcpy(&scan, &dir, sizeof(tf_item_t));
+    while (tf_item_data_prefetch(&scan, raw, TF_DIRITEM_SIZE) && raw[0] != 0x00 && raw[0] != 0xE5) {
+        scan.cur_ofs += TF_DIRITEM_SIZE;
+    }
+
+    if (scan.cur_ofs % clus_size == 0 && tf_chain_sec(fs, dir.first_clus, scan.cur_ofs, &sec) != 0) {
+        // dir is full, add a cluster, scan.cur_clus is the last one
+        uint32_t clus;
+
+        if (scan.cur_ofs >= TF_DIR_SIZE_MAX) {
+            ret = TF_ERR_NO_SPACE;
+            goto out;
+        }
+        ret = tf_fat_alloc(fs, scan.cur_clus, &clus);
+        if (ret == 0) {
+            ret = tf_clus_zero(fs, clus);
+        }
+        if (ret != 0) {
+            goto out;
+        }
+
+        tf_mutex_lock(&fs->meta_lock);
+        fs->meta_gen++;
+        tf_extmap_drop(fs, dir.first_clus);
+        tf_mutex_unlock(&fs->meta_lock);
+    }
+
+    if (TF_MASK_MATCH(attr, TF_FILEATTR_DIRECTORY)) {
+        // new dir has "." and "..", ".." of the dir in root dir is 0
+        char dotsfn[TF_SFN_LEN];
+
+        ret = tf_fat_alloc(fs, 0, &first);
+        if (ret == 0) {
+            ret = tf_clus_zero(fs, first);
+        }
+        if (ret != 0) {
+            goto out;
+        }
+
+        uint32_t dot_sec = fs->dat_sec_ofs + fs->clus_sec_num * (first - 2);
+
+        util_name2sfn(".", dotsfn);
+        tf_dirent_make(raw, dotsfn, TF_FILEATTR_DIRECTORY, first);
+        if (tf_fs_disk_write(fs, dot_sec, 0, raw, TF_DIRITEM_SIZE, true) != 0) {
+            ret = TF_ERR_DISK_IO;
+            goto out;
+        }
+        util_name2sfn("..", dotsfn);
+        tf_dirent_make(raw, dotsfn, TF_FILEATTR_DIRECTORY, dir.first_clus == 2 ? 0 : dir.first_clus);
+        if (tf_fs_disk_write(fs, dot_sec, TF_DIRITEM_SIZE, raw, TF_DIRITEM_SIZE, false) != 0) {
+            ret = TF_ERR_DISK_IO;
+            goto out;
+        }
+    }
+
+    uint32_t ofs = scan.cur_ofs;
+    ret          = tf_chain_sec(fs, dir.first_clus, ofs, &sec);
+    if (ret != 0) {
+        goto out;
+    }
+
+    tf_dirent_make(raw, sfn, attr, first);
+    if (tf_fs_disk_write(fs, sec, ofs % fs->sec_size, raw, TF_DIRITEM_SIZE, false) != 0) {
+        ret = TF_ERR_DISK_IO;
+        goto out;
+    }
+
+    // the dir is changed, and the new path is not "not found" any more
+    tf_mutex_lock(&fs->meta_lock);
+    fs->meta_gen++;
+    tf_diridx_drop(fs, dir.first_clus);
+    tf_pathcache_invalidate(fs, path[0] == '/' ? &path[1] : &path[3]);
+    tf_mutex_unlock(&fs->meta_lock);
+
+    if (item != nullptr) {
+        tf_item_parse(raw, item);
+        item->fs       = fs;
+        item->dir_clus = dir.first_clus;
+        item->dir_ofs  = ofs;
+    }
+
+out:
+    tf_mutex_unlock(&fs->write_lock);
+    return ret;
+}
+
+
+/**
+ * @brief create an empty file
+ *
+ * @param path absolute path, the dir contains it should exist
+ * @param item the file created, result value, may be nullptr
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_PATH_INVALID, TF_ERR_PATH_NOT_FOUND, TF_ERR_PATH_EXISTS,
+ *             TF_ERR_LFN_NOT_SUPPORTED, TF_ERR_NO_SPACE, TF_ERR_DISK_IO
+ */
+int tf_file_create(const char* path, tf_file_t* item) {
+    return tf_item_create(path, TF_FILEATTR_ARCHIVE, item);
+}
+
+
+/**
+ * @brief create an empty dir
+ *
+ * @param path absolute path, the dir contains it should exist
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_PATH_INVALID, TF_ERR_PATH_NOT_FOUND, TF_ERR_PATH_EXISTS,
+ *             TF_ERR_LFN_NOT_SUPPORTED, TF_ERR_NO_SPACE, TF_ERR_DISK_IO
+ */
+int tf_dir_create(const char* path) {
+    return tf_item_create(path, TF_FILEATTR_DIRECTORY, nullptr);
+}
+
+
+/**
+ * @brief read file content at ofs, the file is not changed
+ *
+ * @param file
+ * @param ofs byte offset in file
+ * @param buffer
+ * @param size the data size wanted
+ * @param last_clus result value, cluster of the last byte read, may be nullptr
+ * @return int the data size really read, TF_ERR_NO_MEM
+ */
+static int tf_file_read_at(tf_file_t* file, uint32_t ofs, uint8_t* buffer, uint32_t size, uint32_t* last_clus) {
+    if (!TF_MASK_MATCH(file->attr, TF_FILEATTR_DIRECTORY)) {
+        if (ofs >= file->size) {
+            return 0;
+        }
+        if (size > file->size - ofs) {
+            size = file->size - ofs;
+        }
+    }
+    if (size == 0) {
+        return 0;
+    }
+
+    uint32_t     size_read = 0;
+    tf_fs_t*     fs        = file->fs;
+    uint32_t     clus_size = fs->sec_size * fs->clus_sec_num;
+    tf_extmap_t* map       = tf_extmap_get(fs, file->first_clus);
+
+    if (map == nullptr) {
+        return TF_ERR_NO_MEM;
+    }
+
+    while (size > 0) {
+        tf_extent_t* ext = tf_extmap_find(map, ofs / clus_size);
+        if (ext == nullptr) {
+            // no more cluster
+            break;
+        }
+
+        // bytes to the extent end, and the sector of ofs
+        uint64_t ext_remain = (uint64_t)(ext->fclus + ext->len) * clus_size - ofs;
+        uint32_t sec_in_ext = (ofs - ext->fclus * clus_size) / fs->sec_size;
+        uint32_t sec        = fs->dat_sec_ofs + fs->clus_sec_num * (ext->clus - 2) + sec_in_ext;
+        uint16_t sec_ofs    = ofs % fs->sec_size;
+        uint32_t readnow;
+
+        if (sec_ofs == 0 && size >= fs->sec_size && !tf_fs_sec_cached(fs, sec)) {
+            // aligned whole sectors of the extent go to the buffer directly
+            readnow = (size < ext_remain ? size : ext_remain) / fs->sec_size * fs->sec_size;
+            if (tf_disk_readn_co(fs->dev, sec, readnow / fs->sec_size, fs->sec_size, &buffer[size_read]) != 0) {
+                break;
+            }
+            tf_fs_dirty_overlay(fs, sec, readnow / fs->sec_size, &buffer[size_read]);
+        } else {
+            // unaligned head or tail, or data read ahead, through the cache
+            // if the wanted data all in this sector, read all
+            // or read remain data in this sector this time
+            readnow = sec_ofs + size < fs->sec_size ? size : fs->sec_size - sec_ofs;
+            if (tf_fs_disk_read(fs, sec, sec_ofs, &buffer[size_read], readnow) != 0) {
+                break;
+            }
+        }
+
+        ofs += readnow;
+        size_read += readnow;
+        size -= readnow;
+
+        if (last_clus != nullptr) {
+            *last_clus = ext->clus + (ofs - 1) / clus_size - ext->fclus;
+        }
+    }
+
+    tf_extmap_put(fs, map);
+    TF_STAT_ADD(fs, bytes_read, size_read);
+    return size_read;
+}
+
+
+/**
+ * @brief read file content, once read, the file ptr will move
+ *
+ * @param file should be really file
+ * @param buffer should be large enough to store the data you want
+ * @param size the data size wanted
+ * @return int the data size really read
+ */
+int tf_file_read(tf_file_t* file, uint8_t* buffer, uint32_t size) {
+    TF_TRACE_SCOPE(TF_TRACE_FILE_READ, size);
+
+    if (file == nullptr || buffer == nullptr) {
+        return TF_ERR_WRONG_PARAM;
+    }
+
+#if TF_READAHEAD
+    tf_readahead(file, file->cur_ofs, size);
+#endif
+
+    // cur_clus keeps the cluster of the last byte read
+    int size_read = tf_file_read_at(file, file->cur_ofs, buffer, size, &file->cur_clus);
+    if (size_read > 0) {
+        file->cur_ofs += size_read;
+    }
+
+    return size_read;
+}
+
+
+/**
+ * @brief read file content at a position, the file ptr will not move
+ *
+ * @param file should be really file
+ * @param ofs byte offset in file
+ * @param buffer should be large enough to store the data you want
+ * @param size the data size wanted
+ * @return int the data size really read
+ */
+int tf_file_pread(tf_file_t* file, uint32_t ofs, uint8_t* buffer, uint32_t size) {
+    TF_TRACE_SCOPE(TF_TRACE_FILE_PREAD, size);
+
+    if (file == nullptr || buffer == nullptr) {
+        return TF_ERR_WRONG_PARAM;
+    }
+
+    return tf_file_read_at(file, ofs, buffer, size, nullptr);
+}
+
+
+/**
+ * @brief read file content at a position to several buffers, the file ptr will not move
+ *
+ * @param file should be really file
+ * @param ofs byte offset in file
+ * @param iov buffers, filled in order
+ * @param iovcnt count of iov
+ * @return int the data size really read
+ */
+int tf_file_preadv(tf_file_t* file, uint32_t ofs, const tf_iovec_t* iov, int iovcnt) {
+    if (file == nullptr || (iov == nullptr && iovcnt > 0)) {
+        return TF_ERR_WRONG_PARAM;
+    }
+
+    int size_read = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].base == nullptr) {
+            return TF_ERR_WRONG_PARAM;
+        }
+
+        int readnow = tf_file_read_at(file, ofs + size_read, iov[i].base, iov[i].len, nullptr);
+        if (readnow < 0) {
+            return size_read > 0 ? size_read : readnow;
+        }
+
+        size_read += readnow;
+        if ((uint32_t)readnow < iov[i].len) {
+            break;
+        }
+    }
+
+    return size_read;
+}
+
+
+/**
+ * @brief get pointers to file content right in the image, one per continuous cluster run, no copy
+ *
+ * @param file should be really file
+ * @param ofs byte offset in file
+ * @param size the data size wanted
+ * @param views result value, in file order
+ * @param num max views
+ * @return int views got, 0 at the end of file, TF_ERR_WRONG_PARAM, TF_ERR_ITEM_IS_DIR,
+ *             TF_ERR_DISK_NOT_MAPPED, TF_ERR_NO_MEM, TF_ERR_DISK_IO
+ */
+int tf_file_map(tf_file_t* file, uint32_t ofs, uint32_t size, tf_view_t* views, int num) {
+    TF_TRACE_SCOPE(TF_TRACE_FILE_MAP, size);
+
+    if (file == nullptr || views == nullptr || num <= 0) {
+        return TF_ERR_WRONG_PARAM;
+    }
+    if (TF_MASK_MATCH(file->attr, TF_FILEATTR_DIRECTORY)) {
+        return TF_ERR_ITEM_IS_DIR;
+    }
+    if (ofs >= file->size) {
+        return 0;
+    }
+    if (size > file->size - ofs) {
+        size = file->size - ofs;
+    }
+
+    tf_fs_t* fs        = file->fs;
+    uint32_t clus_size = fs->sec_size * fs->clus_sec_num;
+    int      view_num  = 0;
+    int      ret       = 0;
+
+    if (tf_disk_map(fs->dev, 0, 0, fs->sec_size) == nullptr) {
+        return TF_ERR_DISK_NOT_MAPPED;
+    }
+
+    tf_extmap_t* map = tf_extmap_get(fs, file->first_clus);
+    if (map == nullptr) {
+        return TF_ERR_NO_MEM;
+    }
+
+    while (size > 0 && view_num < num) {
+        tf_extent_t* ext = tf_extmap_find(map, ofs / clus_size);
+        if (ext == nullptr) {
+            break;
+        }
+
+        // the rest of the extent, from the sector of ofs
+        uint64_t ext_remain = (uint64_t)(ext->fclus + ext->len) * clus_size - ofs;
+        uint32_t sec_in_ext = (ofs - ext->fclus * clus_size) / fs->sec_size;
+        uint32_t sec        = fs->dat_sec_ofs + fs->clus_sec_num * (ext->clus - 2) + sec_in_ext;
+        uint16_t sec_ofs    = ofs % fs->sec_size;
+        uint32_t len        = size < ext_remain ? size : ext_remain;
+        uint32_t sec_num    = (sec_ofs + len + fs->sec_size - 1) / fs->sec_size;
+        uint8_t* base       = tf_disk_map(fs->dev, sec, sec_num, fs->sec_size);
+
+        if (base == nullptr) {
+            ret = TF_ERR_DISK_IO;   // beyond the image
+            break;
+        }
+        if (tf_fs_dirty_clean(fs, sec, sec_num) != 0) {
+            ret = TF_ERR_DISK_IO;
+            break;
+        }
+
+        views[view_num].base = base + sec_ofs;
+        views[view_num].ofs  = ofs;
+        views[view_num].len  = len;
+        view_num++;
+
+        ofs += len;
+        size -= len;
+    }
+
+    tf_extmap_put(fs, map);
+    return view_num > 0 ? view_num : ret;
+}
+
+
+/**
+ * @brief get a pointer to file content right in the image, like tf_file_map with one view
+ *
+ * @param file should be really file
+ * @param ofs byte offset in file
+ * @param size the data size wanted
+ * @param data result value, valid until the fs is unmounted
+ * @return int bytes at data, less than size when the run of clusters ends first, 0 at the end of file,
+ *             TF_ERR_WRONG_PARAM, TF_ERR_ITEM_IS_DIR, TF_ERR_DISK_NOT_MAPPED, TF_ERR_NO_MEM, TF_ERR_DISK_IO
+ */
+int tf_file_view(tf_file_t* file, uint32_t ofs, uint32_t size, const uint8_t** data) {
+    tf_view_t view;
+
+    if (data == nullptr) {
+        return TF_ERR_WRONG_PARAM;
+    }
+
+    int ret = tf_file_map(file, ofs, size, &view, 1);
+    if (ret <= 0) {
+        return ret;
+    }
+
+    *data = view.base;
+    return view.len;
+}
+
+
+/**
+ * @brief get the runs of continuous clusters of a file or dir, like for measuring fragmentation
+ *
+ * @param item file or dir
+ * @param exts result value, in file order, may be nullptr when num is 0
+ * @param num max extents to fill
+ * @return int extent count of the whole chain, may be larger than num, TF_ERR_WRONG_PARAM, TF_ERR_NO_MEM
+ */
+int tf_item_extents(tf_item_t* item, tf_extent_t* exts, int num) {
+    if (item == nullptr || (exts == nullptr && num > 0) || num < 0) {
+        return TF_ERR_WRONG_PARAM;
+    }
+    if (item->first_clus < 2) {
+        return 0;   // empty file
+    }
+
+    tf_extmap_t* map = tf_extmap_get(item->fs, item->first_clus);
+    if (map == nullptr) {
+        return TF_ERR_NO_MEM;
+    }
+
+    int ext_num = map->ext_num;
+    for (int i = 0; i < ext_num && i < num; i++) {
+        exts[i] = map->exts[i];
+    }
+    tf_extmap_put(item->fs, map);
+
+    return ext_num;
+}
+
+
+/**
+ * @brief a disk read of tf_file_read_batch, to the buffer directly or through a bounce sector
+ */
+typedef struct {
+    int      owner;   // index of the tf_read_req_t
+    uint8_t* dst;     // data goes to dst + ofs when bounced, nullptr when read to buffer directly
+    uint16_t ofs;
+    uint16_t len;
+} tf_batch_seg_t;
+
+/**
+ * @brief collect disk reads of a read request, the parts cached are copied at once
+ *
+ * @param req
+ * @param owner index of req
+ * @param dreqs result value, grown as needed
+ * @param segs result value, same size as dreqs
+ * @param num count of dreqs and segs
+ * @param cap capacity of dreqs and segs
+ * @return int 0, TF_ERR_NO_MEM
+ */
+static int tf_file_batch_collect(tf_read_req_t* req, int owner, tf_disk_req_t** dreqs, tf_batch_seg_t** segs,
+                                 uint32_t* num, uint32_t* cap) {
+    tf_file_t* file = req->file;
+    tf_fs_t*   fs   = file->fs;
+    uint32_t   ofs  = req->ofs;
+    uint32_t   size = req->size;
+
+    if (!TF_MASK_MATCH(file->attr, TF_FILEATTR_DIRECTORY)) {
+        size = ofs >= file->size ? 0 : (size < file->size - ofs ? size : file->size - ofs);
+    }
+    req->ret = 0;
+    if (size == 0) {
+        return 0;
+    }
+
+    uint32_t     clus_size = fs->sec_size * fs->clus_sec_num;
+    tf_extmap_t* map       = tf_extmap_get(fs, file->first_clus);
+    if (map == nullptr) {
+        return TF_ERR_NO_MEM;
+    }
+
+    while (size > 0) {
+        tf_extent_t* ext = tf_extmap_find(map, ofs / clus_size);
+        if (ext == nullptr) {
+            break;
+        }
+
+        uint64_t ext_remain = (uint64_t)(ext->fclus + ext->len) * clus_size - ofs;
+        uint32_t sec_in_ext = (ofs - ext->fclus * clus_size) / fs->sec_size;
+        uint32_t sec        = fs->dat_sec_ofs + fs->clus_sec_num * (ext->clus - 2) + sec_in_ext;
+        uint16_t sec_ofs    = ofs % fs->sec_size;
+        uint8_t* dst        = req->buf + req->ret;
+        uint32_t readnow;
+        bool     cached = tf_fs_sec_cached(fs, sec);
+
+        if (sec_ofs == 0 && size >= fs->sec_size && !cached) {
+            readnow = (size < ext_remain ? size : ext_remain) / fs->sec_size * fs->sec_size;
+        } else {
+            readnow = sec_ofs + size < fs->sec_size ? size : fs->sec_size - sec_ofs;
+        }
+
+        if (!cached || tf_fs_disk_read(fs, sec, sec_ofs, dst, readnow) != 0) {
+            if (*num == *cap) {
+                uint32_t        ncap   = *cap > 0 ? *cap * 2 : 16;
+                tf_disk_req_t*  ndreqs = realloc(*dreqs, sizeof(tf_disk_req_t) * ncap);
+                tf_batch_seg_t* nsegs  = ndreqs != nullptr ? realloc(*segs, sizeof(tf_batch_seg_t) * ncap) : nullptr;
+                if (ndreqs != nullptr) {
+                    *dreqs = ndreqs;
+                }
+                if (nsegs == nullptr) {
+                    tf_extmap_put(fs, map);
+                    return TF_ERR_NO_MEM;
+                }
+                *segs = nsegs;
+                *cap  = ncap;
+            }
+
+            bool bounce = readnow % fs->sec_size != 0 || sec_ofs != 0;
+
+            (*dreqs)[*num].sec     = sec;
+            (*dreqs)[*num].sec_num = bounce ? 1 : readnow / fs->sec_size;
+            (*dreqs)[*num].data    = bounce ? nullptr : dst;   // bounce sector set later
+            (*segs)[*num].owner    = owner;
+            (*segs)[*num].dst      = bounce ? dst : nullptr;
+            (*segs)[*num].ofs      = sec_ofs;
+            (*segs)[*num].len      = readnow;
+            (*num)++;
+        }
+
+        ofs += readnow;
+        size -= readnow;
+        req->ret += readnow;
+    }
+
+    tf_extmap_put(fs, map);
+    return 0;
+}
+
+
+/**
+ * @brief read several files or parts of files, the disk reads are in flight together
+ *
+ * @param reqs the reads, ret of each is set
+ * @param req_num count of reqs
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_NO_MEM, TF_ERR_DISK_IO when any read failed
+ */
+int tf_file_read_batch(tf_read_req_t* reqs, int req_num) {
+    TF_TRACE_SCOPE(TF_TRACE_READ_BATCH, req_num);
+
+    if (reqs == nullptr && req_num > 0) {
+        return TF_ERR_WRONG_PARAM;
+    }
+    for (int i = 0; i < req_num; i++) {
+        if (reqs[i].file == nullptr || (reqs[i].buf == nullptr && reqs[i].size > 0)) {
+            return TF_ERR_WRONG_PARAM;
+        }
+    }
+
+    int             ret    = 0;
+    tf_disk_req_t*  dreqs  = nullptr;
+    tf_batch_seg_t* segs   = nullptr;
+    uint8_t*        bounce = nullptr;
+    uint32_t        cap    = 0;
+    tf_fs_t*        done_fs[TF_MAX_FS_NUM];
+    int             done_fs_num = 0;
+
+    // one batch for each fs
+    for (int i = 0; i < req_num; i++) {
+        tf_fs_t* fs   = reqs[i].file->fs;
+        uint32_t num  = 0;
+        bool     done = false;
+
+        for (int k = 0; k < done_fs_num; k++) {
+            done |= done_fs[k] == fs;
+        }
+        if (done) {
+            continue;
+        }
+
+        int err = 0;
+        for (int j = i; j < req_num && err == 0; j++) {
+            if (reqs[j].file->fs == fs) {
+                err = tf_file_batch_collect(&reqs[j], j, &dreqs, &segs, &num, &cap);
+            }
+        }
+
+        uint32_t bounce_num = 0;
+        for (uint32_t n = 0; n < num; n++) {
+            bounce_num += segs[n].dst != nullptr;
+        }
+        if (err == 0 && bounce_num > 0) {
+            free(bounce);
+            bounce = malloc(bounce_num * fs->sec_size);
+            err    = bounce == nullptr ? TF_ERR_NO_MEM : 0;
+        }
+        if (err != 0) {
+            // the parts read from cache are not counted either
+            for (int j = i; j < req_num; j++) {
+                if (reqs[j].file->fs == fs) {
+                    reqs[j].ret = err;
+                }
+            }
+            ret                    = err;
+            done_fs[done_fs_num++] = fs;
+            continue;
+        }
+
+        for (uint32_t n = 0, b = 0; n < num; n++) {
+            if (segs[n].dst != nullptr) {
+                dreqs[n].data = bounce + fs->sec_size * b++;
+            }
+        }
+
+        uint32_t wb_num = tf_atomic_load(&fs->cache_wb_num);
+        tf_disk_read_batch(fs->dev, dreqs, num, fs->sec_size);
+
+        for (uint32_t n = 0; n < num; n++) {
+            if (dreqs[n].ret != 0) {
+                reqs[segs[n].owner].ret = TF_ERR_DISK_IO;
+                ret                     = TF_ERR_DISK_IO;
+            } else if (segs[n].dst != nullptr) {
+                tf_fs_cache_put(fs, dreqs[n].sec, dreqs[n].data, wb_num);
+                memcpy(segs[n].dst, dreqs[n].data + segs[n].ofs, segs[n].len);
+            } else {
+                tf_fs_dirty_overlay(fs, dreqs[n].sec, dreqs[n].sec_num, dreqs[n].data);
+            }
+        }
+        for (int j = i; j < req_num; j++) {
+            if (reqs[j].file->fs == fs && reqs[j].ret > 0) {
+                TF_STAT_ADD(fs, bytes_read, reqs[j].ret);
+            }
+        }
+        done_fs[done_fs_num++] = fs;
+    }
+
+    free(dreqs);
+    free(segs);
+    free(bounce);
+
+    return ret;
+}
+
+
+/**
+ * @brief make the cluster chain of file long enough, alloc clusters when needed
+ *
+ * called with fs->write_lock held
+ *
+ * @param file
+ * @param end byte offset the chain should cover
+ * @param cap result value, bytes the chain covers, may less than end when no space
+ * @return int 0, TF_ERR_NO_MEM, TF_ERR_NO_SPACE, TF_ERR_DISK_IO
+ */
+static int tf_file_grow(tf_file_t* file, uint64_t end, uint64_t* cap) {
+    tf_fs_t* fs        = file->fs;
+    uint32_t clus_size = fs->sec_size * fs->clus_sec_num;
+    uint32_t need      = (end + clus_size - 1) / clus_size;
+    uint32_t have      = 0;
+    uint32_t last      = 0;
+    int      ret       = 0;
+
+    *cap = 0;
+    if (file->first_clus >= 2) {
+        tf_extmap_t* map = tf_extmap_get(fs, file->first_clus);
+        if (map == nullptr) {
+            return TF_ERR_NO_MEM;
+        }
+        have = map->clus_total;
+        if (map->ext_num > 0) {
+            last = map->exts[map->ext_num - 1].clus + map->exts[map->ext_num - 1].len - 1;
+        }
+        tf_extmap_put(fs, map);
+    }
+
+    uint32_t old = have;
+    while (have < need) {
+        uint32_t clus;
+        uint32_t num;
+
+        ret = tf_fat_alloc_run(fs, last, need - have, &clus, &num);
+        if (ret != 0) {
+            break;
+        }
+        if (have == 0) {
+            file->first_clus = clus;
+            file->cur_clus   = clus;
+            file->dirty      = true;
+        }
+        last = clus + num - 1;
+        have += num;
+    }
+
+    if (have != old) {
+        // the chain grows, the cached map is short
+        tf_mutex_lock(&fs->meta_lock);
+        fs->meta_gen++;
+        tf_extmap_drop(fs, file->first_clus);
+        tf_mutex_unlock(&fs->meta_lock);
+    }
+
+    *cap = (uint64_t)have * clus_size;
+    return ret;
+}
+
+
+/**
+ * @brief write file content at the file ptr, the file ptr will move, the file grows when needed
+ *
+ * whole sectors are written to disk directly, the others are merged in the sector cache, so
+ * small appends don't rewrite the sector each time
+ *
+ * @param file should be really file
+ * @param buffer data to write
+ * @param size the data size
+ * @return int the data size really written, TF_ERR_WRONG_PARAM, TF_ERR_ITEM_IS_DIR, TF_ERR_NO_SPACE,
+ *             TF_ERR_DISK_IO
+ */
+int tf_file_write(tf_file_t* file, const uint8_t* buffer, uint32_t size) {
+    TF_TRACE_SCOPE(TF_TRACE_FILE_WRITE, size);
+
+    if (file == nullptr || buffer == nullptr) {
+        return TF_ERR_WRONG_PARAM;
+    }
+    if (TF_MASK_MATCH(file->attr, TF_FILEATTR_DIRECTORY)) {
+        return TF_ERR_ITEM_IS_DIR;
+    }
+
+    // file size of FAT32 is 32 bits
+    if (size > UINT32_MAX - file->cur_ofs) {
+        size = UINT32_MAX - file->cur_ofs;
+    }
+    if (size == 0) {
+        return 0;
+    }
+
+    tf_fs_t* fs           = file->fs;
+    uint32_t clus_size    = fs->sec_size * fs->clus_sec_num;
+    uint32_t ofs          = file->cur_ofs;
+    uint32_t size_written = 0;
+    uint64_t cap;
+
+    tf_mutex_lock(&fs->write_lock);
+
+    int ret = tf_file_grow(file, (uint64_t)ofs + size, &cap);
+    if (cap <= ofs) {
+        tf_mutex_unlock(&fs->write_lock);
+        return ret;
+    }
+    if (size > cap - ofs) {
+        size = cap - ofs;
+    }
+
+    tf_extmap_t* map = tf_extmap_get(fs, file->first_clus);
+    if (map == nullptr) {
+        tf_mutex_unlock(&fs->write_lock);
+        return TF_ERR_NO_MEM;
+    }
+
+    while (size > 0) {
+        tf_extent_t* ext = tf_extmap_find(map, ofs / clus_size);
+        if (ext == nullptr) {
+            ret = TF_ERR_DISK_IO;
+            break;
+        }
+
+        uint64_t ext_remain = (uint64_t)(ext->fclus + ext->len) * clus_size - ofs;
+        uint32_t sec_in_ext = (ofs - ext->fclus * clus_size) / fs->sec_size;
+        uint32_t sec        = fs->dat_sec_ofs + fs->clus_sec_num * (ext->clus - 2) + sec_in_ext;
+        uint16_t sec_ofs    = ofs % fs->sec_size;
+        uint32_t writenow;
+
+        if (sec_ofs == 0 && size >= fs->sec_size) {
+            // aligned whole sectors of the extent go to disk directly, the cached copies are
+            // dropped before, so no old one is written back over them, and after, for the ones
+            // read meanwhile
+            writenow = (size < ext_remain ? size : ext_remain) / fs->sec_size * fs->sec_size;
+            tf_fs_cache_drop(fs, sec, writenow / fs->sec_size);
+            if (tf_disk_writen_co(fs->dev, sec, writenow / fs->sec_size, fs->sec_size, &buffer[size_written]) != 0) {
+                ret = TF_ERR_DISK_IO;
+                break;
+            }
+            tf_fs_cache_drop(fs, sec, writenow / fs->sec_size);
+        } else {
+            // partial sector, data beyond the file size is not read
+            writenow = sec_ofs + size < fs->sec_size ? size : fs->sec_size - sec_ofs;
+            if (tf_fs_disk_write(fs, sec, sec_ofs, &buffer[size_written], writenow, ofs - sec_ofs >= file->size) != 0) {
+                ret = TF_ERR_DISK_IO;
+                break;
+            }
+        }
+
+        ofs += writenow;
+        size_written += writenow;
+        size -= writenow;
+
+        // cur_clus keeps the cluster of the last byte, like read
+        file->cur_clus = ext->clus + (ofs - 1) / clus_size - ext->fclus;
+        if (ofs > file->size) {
+            file->size  = ofs;
+            file->dirty = true;
+        }
+    }
+
+    tf_extmap_put(fs, map);
+    file->cur_ofs = ofs;
+
+    tf_mutex_unlock(&fs->write_lock);
+
+    TF_STAT_ADD(fs, bytes_written, size_written);
+    return size_written > 0 ? (int)size_written : ret;
+}
+
+
+/**
+ * @brief update the dir item of file, and write all changed data of its fs to disk
+ *
+ * @param file
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_DISK_IO
+ */
+int tf_file_flush(tf_file_t* file) {
+    if (file == nullptr) {
+        return TF_ERR_WRONG_PARAM;
+    }
+
+    tf_fs_t* fs = file->fs;
+
+    tf_mutex_lock(&fs->write_lock);
+    int ret  = tf_item_sync(file);
+    int ret2 = tf_fs_sync(fs);
+    tf_mutex_unlock(&fs->write_lock);
+
+    return ret != 0 ? ret : ret2;
+}
+
+
+/**
+ * @brief write all changed data of a fs to disk: sectors, FAT copies and FSInfo
+ *
+ * @param dev device id
+ * @return int 0, TF_ERR_FS_UNMOUNT, TF_ERR_DISK_IO
+ */
+int tf_sync(int dev) {
+    TF_TRACE_SCOPE(TF_TRACE_SYNC, dev);
+
+    tf_fs_t* fs = tf_fs_of_dev(dev);
+    if (fs == nullptr) {
+        return TF_ERR_FS_UNMOUNT;
+    }
+
+    tf_mutex_lock(&fs->write_lock);
+    int ret = tf_fs_sync(fs);
+    tf_mutex_unlock(&fs->write_lock);
+
+    return ret;
+}
+
+
+/**
+ * @brief move the file ptr
+ *
+ * @param file file or dir
+ * @param ofs offset from whence
+ * @param whence TF_SEEK_SET, TF_SEEK_CUR, TF_SEEK_END
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_NO_MEM
+ */
+int tf_file_seek(tf_file_t* file, int64_t ofs, int whence) {
+    if (file == nullptr) {
+        return TF_ERR_WRONG_PARAM;
+    }
+
+    int64_t pos;
+    switch (whence) {
+        case TF_SEEK_SET:
+            pos = ofs;
+            break;
+        case TF_SEEK_CUR:
+            pos = (int64_t)file->cur_ofs + ofs;
+            break;
+        case TF_SEEK_END:
+            pos = (int64_t)file->size + ofs;
+            break;
+        default:
+            return TF_ERR_WRONG_PARAM;
+    }
+
+    bool is_dir = TF_MASK_MATCH(file->attr, TF_FILEATTR_DIRECTORY);
+    if (pos < 0 || pos > UINT32_MAX || (!is_dir && pos > file->size) || (is_dir && pos % TF_DIRITEM_SIZE != 0)) {
+        return TF_ERR_WRONG_PARAM;
+    }
+
+    // cur_clus is the cluster of the byte before cur_ofs, or the first one
+    uint32_t cur_clus = file->first_clus;
+    if (pos > 0 && file->first_clus >= 2) {
+        tf_fs_t*     fs        = file->fs;
+        uint32_t     clus_size = fs->sec_size * fs->clus_sec_num;
+        tf_extmap_t* map       = tf_extmap_get(fs, file->first_clus);
+
+        if (map == nullptr) {
+            return TF_ERR_NO_MEM;
+        }
+
+        tf_extent_t* ext = tf_extmap_find(map, (pos - 1) / clus_size);
+        if (ext != nullptr) {
+            cur_clus = ext->clus + (pos - 1) / clus_size - ext->fclus;
+        }
+        tf_extmap_put(fs, map);
+
+        if (ext == nullptr) {
+            return TF_ERR_WRONG_PARAM;
+        }
+    }
+
+    file->cur_ofs  = pos;
+    file->cur_clus = cur_clus;
+
+    return 0;
+}
+
+
+/**
+ * @brief get the hit and miss count of sector cache, for tuning TF_CACHE_SEC_NUM
+ *
+ * the counts stop at UINT32_MAX, tf_get_stats of TF_STATS has them in 64 bits
+ *
+ * @param dev device id
+ * @param hit result value
+ * @param miss result value
+ * @return int 0, TF_ERR_FS_UNMOUNT
+ */
+int tf_cache_stat(int dev, uint32_t* hit, uint32_t* miss) {
+    tf_fs_t* fs = tf_fs_of_dev(dev);
+    if (fs == nullptr) {
+        return TF_ERR_FS_UNMOUNT;
+    }
+
+    uint64_t hit_sum  = 0;
+    uint64_t miss_sum = 0;
+
+    for (int j = 0; j < TF_CACHE_SHARD_NUM; j++) {
+        tf_mutex_lock(&fs->cache_lock[j]);
+        hit_sum += fs->cache[j].hit;
+        miss_sum += fs->cache[j].miss;
+        tf_mutex_unlock(&fs->cache_lock[j]);
+    }
+
+    if (hit != nullptr) {
+        *hit = hit_sum > UINT32_MAX ? UINT32_MAX : (uint32_t)hit_sum;
+    }
+    if (miss != nullptr) {
+        *miss = miss_sum > UINT32_MAX ? UINT32_MAX : (uint32_t)miss_sum;
+    }
+    return 0;
+}
+
+
+#if TF_STATS
+/**
+ * @brief get or clear the counters of a fs, the cache ones with the cache locks held
+ *
+ * @param fs
+ * @param st result value, nullptr to clear them only
+ * @return int 0, TF_ERR_DISK_NOT_FOUND
+ */
+static int tf_fs_stats(tf_fs_t* fs, tf_stats_t* st) {
+    tf_stats_t      sum = {0};
+    tf_disk_stats_t dst;
+
+    for (int j = 0; j < TF_CACHE_SHARD_NUM; j++) {
+        tf_mutex_lock(&fs->cache_lock[j]);
+        sum.cache_hit += fs->cache[j].hit;
+        sum.cache_miss += fs->cache[j].miss;
+        if (st == nullptr) {
+            fs->cache[j].hit  = 0;
+            fs->cache[j].miss = 0;
+        }
+        tf_mutex_unlock(&fs->cache_lock[j]);
+    }
+
+    tf_mutex_lock(&fs->fat_lock);
+    sum.fatcache_hit  = fs->fatcache.hit;
+    sum.fatcache_miss = fs->fatcache.miss;
+    if (st == nullptr) {
+        fs->fatcache.hit  = 0;
+        fs->fatcache.miss = 0;
+    }
+    tf_mutex_unlock(&fs->fat_lock);
+
+    int ret = tf_disk_stats(fs->dev, &dst, st == nullptr);
+    if (st == nullptr) {
+        tf_atomic_store(&fs->stats.bytes_read, 0);
+        tf_atomic_store(&fs->stats.bytes_written, 0);
+        tf_atomic_store(&fs->stats.lookups, 0);
+        tf_atomic_store(&fs->stats.lookup_items, 0);
+        tf_atomic_store(&fs->stats.chain_links, 0);
+        return ret;
+    }
+
+    st->cache_hit       = sum.cache_hit;
+    st->cache_miss      = sum.cache_miss;
+    st->fatcache_hit    = sum.fatcache_hit;
+    st->fatcache_miss   = sum.fatcache_miss;
+    st->disk_reads      = dst.reads;
+    st->disk_read_secs  = dst.read_secs;
+    st->disk_writes     = dst.writes;
+    st->disk_write_secs = dst.write_secs;
+    st->bytes_read      = tf_atomic_load(&fs->stats.bytes_read);
+    st->bytes_written   = tf_atomic_load(&fs->stats.bytes_written);
+    st->lookups         = tf_atomic_load(&fs->stats.lookups);
+    st->lookup_items    = tf_atomic_load(&fs->stats.lookup_items);
+    st->chain_links     = tf_atomic_load(&fs->stats.chain_links);
+    return ret;
+}
+
+
+/**
+ * @brief get the counters of a mounted fs, counted since mount or the last reset
+ *
+ * @param dev device id
+ * @param st result value
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_FS_UNMOUNT
+ */
+int tf_get_stats(int dev, tf_stats_t* st) {
+    if (st == nullptr) {
+        return TF_ERR_WRONG_PARAM;
+    }
+
+    tf_fs_t* fs = tf_fs_of_dev(dev);
+    if (fs == nullptr) {
+        return TF_ERR_FS_UNMOUNT;
+    }
+
+    return tf_fs_stats(fs, st);
+}
+
+
+/**
+ * @brief clear the counters of a mounted fs
+ *
+ * @param dev device id
+ * @return int 0, TF_ERR_FS_UNMOUNT
+ */
+int tf_reset_stats(int dev) {
+    tf_fs_t* fs = tf_fs_of_dev(dev);
+    if (fs == nullptr) {
+        return TF_ERR_FS_UNMOUNT;
+    }
+
+    return tf_fs_stats(fs, nullptr);
+}
+#endif
+
+
+/**
+ * @brief get the space of a mounted fs, the free space is counted from FAT, not the FSInfo hint
+ *
+ * @param dev device id
+ * @param st result value
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_FS_UNMOUNT, TF_ERR_NO_MEM, TF_ERR_DISK_IO
+ */
+int tf_statfs(int dev, tf_statfs_t* st) {
+    if (st == nullptr) {
+        return TF_ERR_WRONG_PARAM;
+    }
+
+    tf_fs_t* fs = tf_fs_of_dev(dev);
+    if (fs == nullptr) {
+        return TF_ERR_FS_UNMOUNT;
+    }
+
+    int ret = 0;
+
+    tf_mutex_lock(&fs->write_lock);
+    if (tf_clusmap_get(fs) != nullptr) {
+        st->clus_free = fs->free_clus_num;
+    } else {
+        // no bitmap kept, count with a temporary one, and correct the FSInfo hint by the way
+        uint32_t* map;
+        ret = tf_clusmap_build(fs, &map, &st->clus_free);
+        if (ret == 0) {
+            free(map);
+            fs->free_clus_num = st->clus_free;
+        }
+    }
+    tf_mutex_unlock(&fs->write_lock);
+
+    st->sec_size   = fs->sec_size;
+    st->clus_size  = fs->sec_size * fs->clus_sec_num;
+    st->clus_total = fs->clus_num - 2;
+#if TF_INDEX
+    st->indexed = tf_atomic_load(&fs->index_on) != 0;
+#else
+    st->indexed = false;
+#endif
+
+    return ret;
+}
+
+
+#if TF_INDEX
+/**
+ * @brief write all of a buffer to a file
+ *
+ * @return int 0, TF_ERR_DISK_IO
+ */
+static int tf_index_write(int fd, const void* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n <= 0) {
+            return TF_ERR_DISK_IO;
+        }
+        data = (const uint8_t*)data + n;
+        size -= n;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief save the dir tree, the items and the extents of all chains of a mounted fs to a sidecar file,
+ *        changed data is written to disk first
+ *
+ * @param dev device id
+ * @param path the file is written to path.tmp and renamed to it
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_FS_UNMOUNT, TF_ERR_NO_MEM, TF_ERR_DISK_IO
+ */
+int tf_index_save(int dev, const char* path) {
+    if (path == nullptr) {
+        return TF_ERR_WRONG_PARAM;
+    }
+
+    tf_fs_t* fs = tf_fs_of_dev(dev);
+    if (fs == nullptr) {
+        return TF_ERR_FS_UNMOUNT;
+    }
+
+    tf_index_hdr_t   hdr      = {0};
+    tf_index_node_t* nodes    = nullptr;
+    tf_extent_t*     exts     = nullptr;
+    int32_t*         hash     = nullptr;
+    uint32_t*        seen     = nullptr;   // dirs listed, a looped tree is listed once
+    char*            tmp      = nullptr;
+    uint32_t         node_cap = 64;
+    uint32_t         ext_cap  = 64;
+    int              fd       = -1;
+
+    // no change until the file is in place, the current mount marks it stale at the next change
+    tf_mutex_lock(&fs->write_lock);
+
+    int ret = tf_fs_sync(fs);
+    if (ret == 0) {
+        ret = tf_fat_sum(fs, &hdr.fat_sum);
+    }
+    if (ret != 0) {
+        goto out;
+    }
+
+    nodes = malloc(sizeof(tf_index_node_t) * node_cap);
+    exts  = malloc(sizeof(tf_extent_t) * ext_cap);
+    seen  = calloc((fs->clus_num + 31) / 32, sizeof(uint32_t));
+    tmp   = malloc(strlen(path) + 5);
+    if (nodes == nullptr || exts == nullptr || seen == nullptr || tmp == nullptr) {
+        ret = TF_ERR_NO_MEM;
+        goto out;
+    }
+
+    // the root dir, then the items of each dir found, breadth first
+    memset(&nodes[0], 0, sizeof(tf_index_node_t));
+    nodes[0].ent.attr       = TF_FILEATTR_DIRECTORY;
+    nodes[0].ent.first_clus = 2;
+    hdr.node_num            = 1;
+
+    for (uint32_t d = 0; d < hdr.node_num; d++) {
+        tf_dirent_t ent = nodes[d].ent;
+        tf_extmap_t map;
+
+        if (ent.first_clus < 2 || ent.first_clus >= fs->clus_num || ent.sfn[0] == '.') {
+            continue;   // empty file, or "." and ".." of a dir
+        }
+
+        ret = tf_extmap_build(fs, ent.first_clus, &map);
+        if (ret != 0) {
+            goto out;
+        }
+        if (hdr.ext_num + map.ext_num > ext_cap) {
+            while (hdr.ext_num + map.ext_num > ext_cap) {
+                ext_cap *= 2;
+            }
+            tf_extent_t* more = realloc(exts, sizeof(tf_extent_t) * ext_cap);
+            if (more == nullptr) {
+                free(map.exts);
+                ret = TF_ERR_NO_MEM;
+                goto out;
+            }
+            exts = more;
+        }
+        memcpy(exts + hdr.ext_num, map.exts, sizeof(tf_extent_t) * map.ext_num);
+        nodes[d].ext_first  = hdr.ext_num;
+        nodes[d].ext_num    = map.ext_num;
+        nodes[d].clus_total = map.clus_total;
+        hdr.ext_num += map.ext_num;
+        free(map.exts);
+
+        if (!TF_MASK_MATCH(ent.attr, TF_FILEATTR_DIRECTORY) || util_bitmap_chk(seen, ent.first_clus)) {
+            continue;
+        }
+        util_bitmap_set(seen, ent.first_clus);
+
+        // the same items as a dir lookup finds
+        tf_item_t   dir;
+        tf_diridx_t idx = {0};
+
+        tf_dirent_to_item(&ent, fs, &dir);
+        ret = tf_diridx_build(&dir, &idx);
+        if (ret != 0) {
+            goto out;
+        }
+        free(idx.hash);
+
+        if (hdr.node_num + idx.ent_num > node_cap) {
+            while (hdr.node_num + idx.ent_num > node_cap) {
+                node_cap *= 2;
+            }
+            tf_index_node_t* more = realloc(nodes, sizeof(tf_index_node_t) * node_cap);
+            if (more == nullptr) {
+                free(idx.ents);
+                ret = TF_ERR_NO_MEM;
+                goto out;
+            }
+            nodes = more;
+        }
+        for (uint32_t i = 0; i < idx.ent_num; i++) {
+            memset(&nodes[hdr.node_num], 0, sizeof(tf_index_node_t));
+            nodes[hdr.node_num++].ent = idx.ents[i];
+        }
+        free(idx.ents);
+    }
+
+    // hash chains are linked from the last node, so they go in node order, which is dir order
+    hdr.hash_bits = 4;
+    while ((1u << hdr.hash_bits) < hdr.node_num * 2) {
+        hdr.hash_bits++;
+    }
+    hash = malloc(sizeof(int32_t) << (hdr.hash_bits + 1));
+    if (hash == nullptr) {
+        ret = TF_ERR_NO_MEM;
+        goto out;
+    }
+    memset(hash, 0xFF, sizeof(int32_t) << (hdr.hash_bits + 1));   // all -1
+
+    int32_t* name_hash = hash;
+    int32_t* clus_hash = hash + (1u << hdr.hash_bits);
+    for (uint32_t i = hdr.node_num; i-- > 0;) {
+        tf_dirent_t* ent = &nodes[i].ent;
+
+        nodes[i].name_next = -1;
+        nodes[i].clus_next = -1;
+        if (i > 0) {
+            uint32_t h         = tf_index_name_hash(ent->sfn, ent->dir_clus) & ((1u << hdr.hash_bits) - 1);
+            nodes[i].name_next = name_hash[h];
+            name_hash[h]       = i;
+        }
+        if (nodes[i].ext_num > 0) {
+            uint32_t h         = (ent->first_clus * 2654435761u) >> (32 - hdr.hash_bits);
+            nodes[i].clus_next = clus_hash[h];
+            clus_hash[h]       = i;
+        }
+    }
+
+    memcpy(hdr.magic, TF_INDEX_MAGIC, 4);
+    hdr.version       = TF_INDEX_VERSION;
+    hdr.node_size     = sizeof(tf_index_node_t);
+    hdr.vol_id        = fs->vol_id;
+    hdr.sec_num_total = fs->sec_num_total;
+    hdr.fat_sec_num   = fs->fat_sec_num;
+    hdr.clus_num      = fs->clus_num;
+    hdr.sec_size      = fs->sec_size;
+    hdr.clus_sec_num  = fs->clus_sec_num;
+
+    // a crash leaves the old file or the new one, not a torn one
+    sprintf(tmp, "%s.tmp", path);
+    fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || tf_index_write(fd, &hdr, sizeof(hdr)) != 0 ||
+        tf_index_write(fd, nodes, sizeof(tf_index_node_t) * hdr.node_num) != 0 ||
+        tf_index_write(fd, exts, sizeof(tf_extent_t) * hdr.ext_num) != 0 ||
+        tf_index_write(fd, hash, sizeof(int32_t) << (hdr.hash_bits + 1)) != 0 || fsync(fd) != 0 ||
+        rename(tmp, path) != 0) {
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp);
+        }
+        fd  = -1;
+        ret = TF_ERR_DISK_IO;
+        goto out;
+    }
+
+    // a loaded index is still used while it matches, the new file is the one marked stale
+    if (fs->index_fd >= 0) {
+        close(fs->index_fd);
+    }
+    fs->index_fd = fd;
+
+out:
+    tf_mutex_unlock(&fs->write_lock);
+    free(nodes);
+    free(exts);
+    free(hash);
+    free(seen);
+    free(tmp);
+    return ret;
+}
+#endif
+
+
+/**
+ * @brief drop the cached metadata of a mounted fs, like when the disk is changed by others
+ *
+ * @param dev device id
+ * @param path absolute path like "/a/b", drop the results of it and paths under it, nullptr to drop all
+ * @return int 0, TF_ERR_FS_UNMOUNT, TF_ERR_PATH_INVALID
+ */
+int tf_cache_invalidate(int dev, const char* path) {
+    const char* subpath = nullptr;
+
+    // path could be like "/a/b/c" or "x:/a/b/c"
+    if (path != nullptr) {
+        if (path[0] == '/') {
+            subpath = &path[1];
+        } else if (strlen(path) >= 3 && path[1] == ':' && path[2] == '/') {
+            subpath = &path[3];
+        }
+    }
+
+    tf_fs_t* fs = tf_fs_of_dev(dev);
+    if (fs == nullptr) {
+        return TF_ERR_FS_UNMOUNT;
+    }
+    if (path != nullptr && subpath == nullptr) {
+        return TF_ERR_PATH_INVALID;
+    }
+
+    int ret = 0;
+
+    // no change of this mount meanwhile
+    tf_mutex_lock(&fs->write_lock);
+
+    if (path == nullptr) {
+#if TF_INDEX
+        tf_index_stale(fs);   // the disk is changed by others, the index may not match it either
+#endif
+        // read FAT and sectors from disk again, but the ones changed here and not written yet
+        ret = tf_fat_reload(fs);
+        for (int i = 0; i < TF_CACHE_SHARD_NUM; i++) {
+            tf_mutex_lock(&fs->cache_lock[i]);
+            tf_cache_drop_clean(&fs->cache[i]);
+            tf_mutex_unlock(&fs->cache_lock[i]);
+        }
+    }
+
+    // built from FAT and dir sectors, so after they are dropped
+    tf_mutex_lock(&fs->meta_lock);
+    fs->meta_gen++;
+    tf_pathcache_invalidate(fs, subpath);
+    if (path == nullptr) {
+        tf_diridx_clear(fs);
+        tf_extmap_clear(fs);
+    }
+    tf_mutex_unlock(&fs->meta_lock);
+    tf_mutex_unlock(&fs->write_lock);
+
+    return ret;
 }
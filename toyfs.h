@@ -6,7 +6,11 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "toyfs_cache.h"
 #include "toyfs_cfg.h"
+#include "toyfs_disk.h"
+#include "toyfs_lock.h"
+#include "toyfs_trace.h"
 #include "toyfs_utils.h"
 
 
@@ -20,6 +24,14 @@
 #define TF_ERR_MOUNT_LABEL_USED  -7
 #define TF_ERR_ITEM_NOT_DIR      -8
 #define TF_ERR_LFN_NOT_SUPPORTED -9
+#define TF_ERR_DISK_NOT_FOUND    -11
+#define TF_ERR_DISK_BUSY         -12
+#define TF_ERR_DISK_IO           -13
+#define TF_ERR_NO_MEM            -14
+#define TF_ERR_NO_SPACE          -15
+#define TF_ERR_PATH_EXISTS       -16
+#define TF_ERR_ITEM_IS_DIR       -17
+#define TF_ERR_DISK_NOT_MAPPED   -18
 #define TF_STA_READDIR_END       -101
 #define TF_STA_READFILE_END      -102
 #define TF_ATTR_READ_ONLY        0x01
@@ -28,8 +40,132 @@
 #define TF_ATTR_VOLUME_ID        0x08
 #define TF_ATTR_DIRECTORY        0x10
 #define TF_ATTR_ARCHIVE          0x20
+#define TF_SEEK_SET              0
+#define TF_SEEK_CUR              1
+#define TF_SEEK_END              2
+#define TF_DIRENT_NAME           0x01   // fields of tf_dir_read_batch, sfn
+#define TF_DIRENT_SIZE           0x02   // size and first_clus
+#define TF_DIRENT_TIME           0x04   // write_time and create_time
+#define TF_DIRENT_ALL            0x07
+#define TF_WALK_PRE              0x01   // flags of tf_walk, visit dirs before the items in them
+#define TF_WALK_POST             0x02   // visit dirs after all items below them
+#define TF_WALK_F                0      // visit types, a file
+#define TF_WALK_D                1      // a dir, pre-order
+#define TF_WALK_DP               2      // a dir, post-order
+#define TF_WALK_SKIP             1      // visitor result, don't go into the dir at its pre-order visit
+#define TF_INDEX_MAGIC           "TFIX"
+#define TF_INDEX_VERSION         1
 
 
+typedef struct {
+    uint8_t* base;
+    uint32_t len;
+} tf_iovec_t;
+
+typedef struct {
+    uint32_t fclus;   // cluster index in file of the first cluster
+    uint32_t clus;    // first cluster id
+    uint32_t len;     // continuous cluster count
+} tf_extent_t;
+
+typedef struct {
+    uint32_t     first_clus;   // first cluster of the chain, the key
+    uint32_t     clus_total;   // cluster count of the chain
+    uint32_t     ext_num;
+    uint32_t     tick;         // last used, for lru
+    uint32_t     refs;         // readers using it, not evicted or freed while not 0
+    bool         stale;        // invalidated while used, freed by the last reader
+    bool         heap;         // not in the table, all slots were in use
+    tf_extent_t* exts;         // sorted by fclus
+} tf_extmap_t;
+
+typedef struct {
+    uint16_t year;
+    uint8_t  month;
+    uint8_t  day;
+    uint8_t  hour;
+    uint8_t  minite;
+    uint8_t  second;
+} tf_time_t;
+
+typedef struct {
+    char      sfn[TF_SFN_LEN];
+    uint8_t   attr;
+    uint32_t  size;
+    uint32_t  first_clus;
+    uint32_t  ofs;        // byte offset of the item in dir
+    uint32_t  dir_clus;   // first cluster of the dir
+    tf_time_t write_time;
+    tf_time_t create_time;
+} tf_dirent_t;
+
+typedef struct {
+    uint32_t     first_clus;   // first cluster of the dir, the key
+    uint32_t     ent_num;
+    uint32_t     tick;         // last used, for lru
+    uint8_t      hash_bits;
+    int32_t*     hash;         // sfn hash -> index of ents, -1 means empty
+    tf_dirent_t* ents;         // in dir order
+} tf_diridx_t;
+
+typedef struct {
+    char        path[TF_PATHCACHE_PATH_LEN];   // path without "/" or "x:/", "" means not used
+    uint32_t    hash;
+    int16_t     hnext;   // hash chain
+    uint32_t    tick;    // last used, for lru
+    int         ret;     // result of the search, not found result cached too
+    tf_dirent_t ent;     // the item found when ret is 0
+} tf_pathent_t;
+
+typedef struct {
+    uint32_t sec;
+    uint32_t sec_num;
+} tf_ra_req_t;
+
+typedef struct {
+    char     magic[4];        // TF_INDEX_MAGIC
+    uint32_t version;         // TF_INDEX_VERSION
+    uint32_t node_size;       // sizeof(tf_index_node_t) of the writer
+    uint32_t stale;           // set at the first change of the volume by a mount using the index
+    uint32_t vol_id;          // BS_VolID, the index is checked against the volume by these and fat_sum
+    uint32_t sec_num_total;
+    uint32_t fat_sec_num;
+    uint32_t clus_num;
+    uint16_t sec_size;
+    uint8_t  clus_sec_num;
+    uint8_t  hash_bits;       // of the 2 hash tables
+    uint32_t node_num;        // nodes[0] is the root dir
+    uint32_t ext_num;
+    uint64_t fat_sum;         // hash of the first FAT
+} tf_index_hdr_t;
+
+typedef struct {
+    tf_dirent_t ent;          // ent.dir_clus and ent.sfn are the key of lookups
+    uint32_t    ext_first;    // extents of the chain in the extent table
+    uint32_t    ext_num;
+    uint32_t    clus_total;   // cluster count of the chain
+    int32_t     name_next;    // next node of the same name hash, a later one, -1 for the end
+    int32_t     clus_next;    // next node of the same first cluster hash
+} tf_index_node_t;
+
+#if TF_STATS
+typedef struct {
+    uint64_t cache_hit;         // sector cache
+    uint64_t cache_miss;
+    uint64_t fatcache_hit;      // FAT cache, not used when FAT is resident
+    uint64_t fatcache_miss;
+    uint64_t disk_reads;        // read requests to the device, each one of a batch
+    uint64_t disk_read_secs;
+    uint64_t disk_writes;
+    uint64_t disk_write_secs;
+    uint64_t bytes_read;        // served by file reads
+    uint64_t bytes_written;     // taken by file writes
+    uint64_t lookups;           // names searched in dirs
+    uint64_t lookup_items;      // dir items scanned for them, by dir scans and index builds
+    uint64_t chain_links;       // FAT entries followed along cluster chains
+} tf_stats_t;
+#endif
+
 typedef struct {
     uint8_t dev;     // physical disk id
     char    label;   // label, like: 'C', 'D', '0', '1'; '\0' means not used
@@ -38,32 +174,73 @@ typedef struct {
     uint16_t sec_size;        // sector size
     uint8_t  clus_sec_num;    // sector count of a cluster
     uint32_t sec_num_total;   // sector count of volume
+    uint32_t fat_sec_num;     // sector count of a FAT
+    uint8_t  fat_num;         // copies of FAT
+    uint32_t clus_num;        // cluster count, include the 2 reserved
+    uint32_t vol_id;          // BS_VolID
 
     // FSInfo
-    uint32_t free_clus_num;    // FSI_Free_Count
+    uint32_t free_clus_num;    // FSI_Free_Count, exact when clusmap built
     uint32_t next_free_clus;   // FSI_Nxt_Free
+    uint32_t fsinfo_sec;       // sector of FSInfo in DISK
+    bool     fsinfo_dirty;     // written at sync
 
     // for convenience
     int fat_sec_ofs;   // sector offset of FAT area in all DISK
     int dat_sec_ofs;   // sector offset of DATA area in DISK
 
-    uint8_t  cache[512];
-    uint32_t cache_sec;   // cache sector id
-    bool     cache_inited;
+    uint32_t cache_sec_num;   // budget of the sector cache, in sectors
+    uint32_t fatcache_size;   // budget of the FAT cache, in bytes
 
-    uint32_t fatcache[512 / 4];
-    uint32_t fatcache_start;   // fatcache start cluster id
-    bool     fatcache_inited;
-} tf_fs_t;
+    tf_cache_t cache[TF_CACHE_SHARD_NUM];        // sector cache, shared by dir and file reads, sharded by sector id
+    tf_mutex_t cache_lock[TF_CACHE_SHARD_NUM];   // one for each shard
+    uint32_t   cache_wb_num;                     // write backs of the shards, a read before one may be stale
 
-typedef struct {
-    uint16_t year;
-    uint8_t  month;
-    uint8_t  day;
-    uint8_t  hour;
-    uint8_t  minite;
-    uint8_t  second;
-} tf_time_t;
+    uint32_t*  fat;        // whole FAT in ram, nullptr when not resident
+    uint32_t*  fatdirty;   // bitmap of FAT sectors changed, when resident
+    uint32_t   fat_seq;    // odd while the resident FAT is read again by tf_cache_invalidate
+    tf_cache_t fatcache;   // FAT sectors, used when FAT not resident
+    uint8_t*   fatwin;     // buffer of a FAT window read
+    tf_mutex_t fat_lock;   // for fatcache and fatwin
+    uint32_t*  clusmap;    // bitmap of used clusters, nullptr when not built
+
+    tf_extmap_t extmaps[TF_EXTMAP_NUM];   // extents of recently read files
+    uint32_t    extmap_tick;
+
+    tf_diridx_t diridxs[TF_DIRIDX_NUM];   // name indexes of recently searched dirs
+    uint32_t    diridx_tick;
+
+    tf_pathent_t pathents[TF_PATHCACHE_NUM];   // results of recently opened paths
+    int16_t      pathhash[TF_PATHCACHE_HASH];
+    uint32_t     path_tick;
+
+    tf_mutex_t write_lock;  // one writer at a time
+    tf_mutex_t meta_lock;   // for extmaps, diridxs and the path cache
+    uint32_t   meta_gen;    // changed by invalidation, results got before it are not cached
+
+#if TF_INDEX
+    const tf_index_hdr_t* index;      // mapped sidecar index, nullptr when not loaded
+    uint64_t              index_size;
+    int                   index_fd;
+    uint32_t              index_on;   // the index matches the volume, cleared at the first change
+#endif
+
+#if TF_STATS
+    tf_stats_t stats;   // counters of the fs itself, the cache and disk ones are kept by them
+#endif
+
+    uint8_t* rabuf;        // staging buffer of readahead
+    uint32_t   ra_sec_max;   // sectors of rabuf
+    tf_mutex_t ra_lock;      // for rabuf, and ra_queue when in thread
+#if TF_READAHEAD_THREAD
+    pthread_t      ra_thread;
+    pthread_cond_t ra_cond;
+    tf_ra_req_t    ra_queue[TF_READAHEAD_QUEUE];
+    uint32_t       ra_head;
+    uint32_t       ra_tail;
+    bool           ra_stop;
+#endif
+} tf_fs_t;
 
 typedef struct {
     uint8_t   attr;              // bitmap of TF_ATTR_*
@@ -72,34 +249,100 @@ typedef struct {
     uint32_t  first_clus;        // first cluster id (start at 2)
     uint32_t  cur_clus;          //
     uint32_t  cur_ofs;           // current byte offset
+    uint32_t  ra_next;           // offset of the next read if access is sequential
+    uint32_t  ra_done;           // data before this offset has been read ahead
+    uint32_t  ra_win;            // readahead window, in clusters
+    uint32_t  dir_clus;          // first cluster of the dir contains the item, 0 for the root dir itself
+    uint32_t  dir_ofs;           // byte offset of the item in the dir
+    bool      dirty;             // size or first cluster changed, dir item not updated
     tf_time_t write_time;
     tf_time_t create_time;
     tf_fs_t*  fs;
 } tf_item_t;
 
+typedef struct {
+    uint16_t sec_size;     // bytes of a sector
+    uint32_t clus_size;    // bytes of a cluster
+    uint32_t clus_total;   // clusters for data
+    uint32_t clus_free;    // free clusters, exact
+    bool     indexed;      // lookups and extents are served by the sidecar index
+} tf_statfs_t;
+
 
 #define tf_dir_t      tf_item_t
 #define tf_file_t     tf_item_t
 #define tf_dir_open   tf_item_open
-#define tf_dir_close  tf_item_open
+#define tf_dir_close  tf_item_close
 #define tf_file_open  tf_item_open
-#define tf_file_close tf_item_open
+#define tf_file_close tf_item_close
+
+
+typedef struct {
+    const uint8_t* base;   // in the mapped image
+    uint32_t       ofs;    // byte offset in file of base
+    uint32_t       len;
+} tf_view_t;
+
+typedef struct {
+    tf_file_t* file;
+    uint32_t   ofs;    // byte offset in file
+    uint8_t*   buf;
+    uint32_t   size;
+    int        ret;    // result value, the data size really read, or TF_ERR_*
+} tf_read_req_t;
+
+/**
+ * @brief visitor of tf_walk
+ *
+ * @param path absolute path of the item, like "X:/a/b"
+ * @param ent the item, all TF_DIRENT_* fields filled
+ * @param depth 0 for the item tf_walk starts at
+ * @param type TF_WALK_F, TF_WALK_D, TF_WALK_DP
+ * @param ctx of tf_walk
+ * @return int 0 to go on, TF_WALK_SKIP to prune the dir, others to stop the walk with it
+ */
+typedef int (*tf_walk_fn_t)(const char* path, const tf_dirent_t* ent, int depth, int type, void* ctx);
+
+typedef struct {
+    uint32_t    cache_sec_num;   // sectors in the sector cache, 0 for TF_CACHE_SEC_NUM
+    uint32_t    fatcache_size;   // FAT cache memory budget in bytes, 0 for TF_FATCACHE_SIZE
+    const char* index_path;      // sidecar index saved by tf_index_save, used when it matches the volume
+} tf_mount_opt_t;
 
 
+/**
+ * when TF_THREAD_SAFE, many threads can mount, open, list and read at the same time, as long as
+ * a tf_item_t is used by one thread at a time, and a fs is not unmounted while it's in use.
+ * writes are done one at a time, reading a file while it's written may get the old or new data.
+ * each mounted volume has its own device, caches and locks, volumes are not stalled by each other.
+ */
+
 /**
  * @brief mount a device to file system
  *
  * @param dev device id
  * @param label
- * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_MOUNT_LABEL_USED, TF_ERR_NO_FREE_FS, TF_ERR_NO_FAT32LBA
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_MOUNT_LABEL_USED, TF_ERR_NO_FREE_FS, TF_ERR_NO_FAT32LBA,
+ *             TF_ERR_DISK_NOT_FOUND, TF_ERR_DISK_BUSY, TF_ERR_DISK_IO, TF_ERR_NO_MEM
  */
 int tf_mount(int dev, char label);
 
 /**
- * @brief unmount device
+ * @brief mount a device to file system, with the cache budgets of it
+ *
+ * @param dev device id
+ * @param label
+ * @param opt budgets, nullptr or zero fields for the defaults
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_MOUNT_LABEL_USED, TF_ERR_NO_FREE_FS, TF_ERR_NO_FAT32LBA,
+ *             TF_ERR_DISK_NOT_FOUND, TF_ERR_DISK_BUSY, TF_ERR_DISK_IO, TF_ERR_NO_MEM
+ */
+int tf_mount_ex(int dev, char label, const tf_mount_opt_t* opt);
+
+/**
+ * @brief unmount device, changed data is written to disk first
  *
  * @param dev id
- * @return int 0, TF_ERR_FS_UNMOUNT
+ * @return int 0, TF_ERR_FS_UNMOUNT, TF_ERR_DISK_IO when write failed, the device is unmounted anyway
  */
 int tf_unmount(int dev);
 
@@ -113,10 +356,10 @@ int tf_unmount(int dev);
 int tf_item_open(const char* path, tf_item_t* item);
 
 /**
- * @brief close a file or dir
+ * @brief close a file or dir, the dir item of a written file is updated in cache
  *
  * @param dir
- * @return int 0, TF_ERR_WRONG_PARAM
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_DISK_IO
  */
 int tf_item_close(tf_item_t* item);
 
@@ -129,6 +372,35 @@ int tf_item_close(tf_item_t* item);
  */
 int tf_dir_read(tf_item_t* dir, tf_item_t* item);
 
+/**
+ * @brief read many items from dir at once, continues from where tf_dir_read or the last batch stops
+ *
+ * @param dir should be dir really
+ * @param ents the items read, result value
+ * @param num max items to read
+ * @param mask TF_DIRENT_* fields to fill, the others are left as they are; attr, ofs and dir_clus are
+ *             always filled
+ * @return int items read, TF_STA_READDIR_END when no more, TF_ERR_WRONG_PARAM, TF_ERR_ITEM_NOT_DIR
+ */
+int tf_dir_read_batch(tf_item_t* dir, tf_dirent_t* ents, int num, uint32_t mask);
+
+/**
+ * @brief visit every item below a dir, the subdirs are listed by a pool of threads stealing work from
+ *        each other
+ *
+ * the visitor is called from many threads at once, in no given order except that a dir is visited in
+ * pre-order before its items and in post-order after all items below it.
+ *
+ * @param path absolute path of the dir to start, or of a file to visit only
+ * @param fn the visitor
+ * @param ctx passed to fn
+ * @param flags TF_WALK_PRE, TF_WALK_POST, for the visits of dirs
+ * @param threads workers include the caller, up to TF_WALK_THREADS, 0 for all; 1 when not TF_THREAD_SAFE
+ * @return int 0, the first value of fn not 0 or TF_WALK_SKIP, TF_ERR_WRONG_PARAM, TF_ERR_PATH_INVALID,
+ *             TF_ERR_PATH_NOT_FOUND, TF_ERR_NO_MEM, TF_ERR_DISK_IO
+ */
+int tf_walk(const char* path, tf_walk_fn_t fn, void* ctx, uint32_t flags, int threads);
+
 /**
  * @brief find an item from dir of subpath
  *
@@ -139,6 +411,25 @@ int tf_dir_read(tf_item_t* dir, tf_item_t* item);
  */
 int tf_dir_find(tf_item_t* dir, const char* subpath, tf_item_t* item);   // dir&item may be same object
 
+/**
+ * @brief create an empty file
+ *
+ * @param path absolute path, the dir contains it should exist
+ * @param item the file created, result value, may be nullptr
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_PATH_INVALID, TF_ERR_PATH_NOT_FOUND, TF_ERR_PATH_EXISTS,
+ *             TF_ERR_LFN_NOT_SUPPORTED, TF_ERR_NO_SPACE, TF_ERR_DISK_IO
+ */
+int tf_file_create(const char* path, tf_file_t* item);
+
+/**
+ * @brief create an empty dir
+ *
+ * @param path absolute path, the dir contains it should exist
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_PATH_INVALID, TF_ERR_PATH_NOT_FOUND, TF_ERR_PATH_EXISTS,
+ *             TF_ERR_LFN_NOT_SUPPORTED, TF_ERR_NO_SPACE, TF_ERR_DISK_IO
+ */
+int tf_dir_create(const char* path);
+
 /**
  * @brief read file content, once read, the file ptr will move
  *
@@ -150,21 +441,186 @@ int tf_dir_find(tf_item_t* dir, const char* subpath, tf_item_t* item);   // dir&
 int tf_file_read(tf_file_t* file, uint8_t* buffer, uint32_t size);
 
 /**
- * @brief read a sector from disk
+ * @brief read file content at a position, the file ptr will not move
+ *
+ * @param file should be really file
+ * @param ofs byte offset in file
+ * @param buffer should be large enough to store the data you want
+ * @param size the data size wanted
+ * @return int the data size really read
+ */
+int tf_file_pread(tf_file_t* file, uint32_t ofs, uint8_t* buffer, uint32_t size);
+
+/**
+ * @brief read file content at a position to several buffers, the file ptr will not move
+ *
+ * @param file should be really file
+ * @param ofs byte offset in file
+ * @param iov buffers, filled in order
+ * @param iovcnt count of iov
+ * @return int the data size really read
+ */
+int tf_file_preadv(tf_file_t* file, uint32_t ofs, const tf_iovec_t* iov, int iovcnt);
+
+/**
+ * @brief get pointers to file content right in the image, one per continuous cluster run, no copy
+ *
+ * the device should be in memory (tf_disk_mmap_register or tf_disk_mem_register), changed data of
+ * the range not written back yet is written first. the pointers are valid until the fs is unmounted,
+ * the data is read only, later writes to the file show through once written back.
+ *
+ * @param file should be really file
+ * @param ofs byte offset in file
+ * @param size the data size wanted
+ * @param views result value, in file order
+ * @param num max views
+ * @return int views got, 0 at the end of file, TF_ERR_WRONG_PARAM, TF_ERR_ITEM_IS_DIR,
+ *             TF_ERR_DISK_NOT_MAPPED, TF_ERR_NO_MEM, TF_ERR_DISK_IO
+ */
+int tf_file_map(tf_file_t* file, uint32_t ofs, uint32_t size, tf_view_t* views, int num);
+
+/**
+ * @brief get a pointer to file content right in the image, like tf_file_map with one view
+ *
+ * @param file should be really file
+ * @param ofs byte offset in file
+ * @param size the data size wanted
+ * @param data result value, valid until the fs is unmounted
+ * @return int bytes at data, less than size when the run of clusters ends first, 0 at the end of file,
+ *             TF_ERR_WRONG_PARAM, TF_ERR_ITEM_IS_DIR, TF_ERR_DISK_NOT_MAPPED, TF_ERR_NO_MEM, TF_ERR_DISK_IO
+ */
+int tf_file_view(tf_file_t* file, uint32_t ofs, uint32_t size, const uint8_t** data);
+
+/**
+ * @brief get the runs of continuous clusters of a file or dir, like for measuring fragmentation
+ *
+ * @param item file or dir
+ * @param exts result value, in file order, may be nullptr when num is 0
+ * @param num max extents to fill
+ * @return int extent count of the whole chain, may be larger than num, TF_ERR_WRONG_PARAM, TF_ERR_NO_MEM
+ */
+int tf_item_extents(tf_item_t* item, tf_extent_t* exts, int num);
+
+/**
+ * @brief read several files or parts of files, the disk reads are in flight together
+ *
+ * @param reqs the reads, ret of each is set
+ * @param req_num count of reqs
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_NO_MEM, TF_ERR_DISK_IO when any read failed
+ */
+int tf_file_read_batch(tf_read_req_t* reqs, int req_num);
+
+/**
+ * @brief write file content at the file ptr, the file ptr will move, the file grows when needed
+ *
+ * data goes to the write-back cache, it's on disk after tf_file_flush or tf_sync
+ *
+ * @param file should be really file
+ * @param buffer data to write
+ * @param size the data size
+ * @return int the data size really written, TF_ERR_WRONG_PARAM, TF_ERR_ITEM_IS_DIR, TF_ERR_NO_SPACE,
+ *             TF_ERR_DISK_IO
+ */
+int tf_file_write(tf_file_t* file, const uint8_t* buffer, uint32_t size);
+
+/**
+ * @brief update the dir item of file, and write all changed data of its fs to disk
+ *
+ * @param file
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_DISK_IO
+ */
+int tf_file_flush(tf_file_t* file);
+
+/**
+ * @brief write all changed data of a fs to disk: sectors, FAT copies and FSInfo
+ *
+ * @param dev device id
+ * @return int 0, TF_ERR_FS_UNMOUNT, TF_ERR_DISK_IO
+ */
+int tf_sync(int dev);
+
+/**
+ * @brief move the file ptr
+ *
+ * @param file file or dir
+ * @param ofs offset from whence
+ * @param whence TF_SEEK_SET, TF_SEEK_CUR, TF_SEEK_END
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_NO_MEM
+ */
+int tf_file_seek(tf_file_t* file, int64_t ofs, int whence);
+
+/**
+ * @brief get the hit and miss count of sector cache, for tuning TF_CACHE_SEC_NUM
+ *
+ * the counts stop at UINT32_MAX, tf_get_stats of TF_STATS has them in 64 bits
  *
  * @param dev device id
- * @param sec sector id
- * @param sec_size sector size
- * @param data data buffer
- * @return int 0，-1
+ * @param hit result value
+ * @param miss result value
+ * @return int 0, TF_ERR_FS_UNMOUNT
  */
-int tf_disk_read_co(int dev, uint32_t sec, uint16_t sec_size, uint8_t* data);
+int tf_cache_stat(int dev, uint32_t* hit, uint32_t* miss);
 
+#if TF_STATS
+/**
+ * @brief get the counters of a mounted fs, counted since mount or the last reset
+ *
+ * @param dev device id
+ * @param st result value
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_FS_UNMOUNT
+ */
+int tf_get_stats(int dev, tf_stats_t* st);
+
+/**
+ * @brief clear the counters of a mounted fs
+ *
+ * @param dev device id
+ * @return int 0, TF_ERR_FS_UNMOUNT
+ */
+int tf_reset_stats(int dev);
+#endif
+
+/**
+ * @brief get the space of a mounted fs, the free space is counted from FAT, not the FSInfo hint
+ *
+ * @param dev device id
+ * @param st result value
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_FS_UNMOUNT, TF_ERR_NO_MEM, TF_ERR_DISK_IO
+ */
+int tf_statfs(int dev, tf_statfs_t* st);
+
+#if TF_INDEX
+/**
+ * @brief save the dir tree, the items and the extents of all chains of a mounted fs to a sidecar file,
+ *        changed data is written to disk first
+ *
+ * a later tf_mount_ex with opt->index_path maps the file, and uses it for lookups and extents when
+ * it matches the volume, so opening paths and mapping files read no dir or FAT sectors. the index is
+ * not used from the first change of the volume by that mount, and is marked stale in the file.
+ *
+ * @param dev device id
+ * @param path the file is written to path.tmp and renamed to it
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_FS_UNMOUNT, TF_ERR_NO_MEM, TF_ERR_DISK_IO
+ */
+int tf_index_save(int dev, const char* path);
+#endif
+
+/**
+ * @brief drop the cached metadata of a mounted fs, like when the disk is changed by others
+ *
+ * with path nullptr, the clean sectors of the sector cache and the FAT cache are dropped and a
+ * resident FAT is read again too, so all is read from disk again but the changes of this mount not
+ * written yet, and a sidecar index in use is marked stale. a path drops only the cached opens of it
+ * and paths under it, the index is kept.
+ *
+ * @param dev device id
+ * @param path absolute path like "/a/b", drop the results of it and paths under it, nullptr to drop all
+ * @return int 0, TF_ERR_FS_UNMOUNT, TF_ERR_PATH_INVALID, TF_ERR_NO_MEM, TF_ERR_DISK_IO when FAT
+ *         could not be read again, the rest are dropped still
+ */
+int tf_cache_invalidate(int dev, const char* path);
 
 // tbd
 /*
 int tf_format();
-int tf_dir_create();
-int tf_file_seek();
-int tf_file_write();
 */
@@ -0,0 +1,347 @@
+#include "toyfs_cache.h"
+
+#include "toyfs.h"
+
+
+#define TF_CACHE_FLUSH_RUN 32   // max sectors written back at once
+
+
+static uint32_t tf_cache_hash(tf_cache_t* cache, uint32_t sec) {
+    return (sec * 2654435761u) >> (32 - cache->hash_bits);
+}
+
+static int32_t tf_cache_find(tf_cache_t* cache, uint32_t sec) {
+    int32_t e = cache->hash[tf_cache_hash(cache, sec)];
+    while (e >= 0 && cache->ents[e].sec != sec) {
+        e = cache->ents[e].hnext;
+    }
+    return e;
+}
+
+static void tf_cache_hash_del(tf_cache_t* cache, int32_t e) {
+    int32_t* link = &cache->hash[tf_cache_hash(cache, cache->ents[e].sec)];
+    while (*link != e) {
+        link = &cache->ents[*link].hnext;
+    }
+    *link = cache->ents[e].hnext;
+}
+
+static void tf_cache_list_del(tf_cache_t* cache, int32_t e) {
+    tf_cache_ent_t* ent  = &cache->ents[e];
+    uint8_t         list = ent->list;
+
+    if (ent->prev >= 0) {
+        cache->ents[ent->prev].next = ent->next;
+    } else {
+        cache->head[list] = ent->next;
+    }
+    if (ent->next >= 0) {
+        cache->ents[ent->next].prev = ent->prev;
+    } else {
+        cache->tail[list] = ent->prev;
+    }
+    cache->len[list]--;
+    ent->list = TF_CACHE_LIST_FREE;
+}
+
+static void tf_cache_list_add(tf_cache_t* cache, int32_t e, uint8_t list) {
+    tf_cache_ent_t* ent = &cache->ents[e];
+
+    ent->list = list;
+    ent->prev = -1;
+    ent->next = cache->head[list];
+    if (ent->next >= 0) {
+        cache->ents[ent->next].prev = e;
+    } else {
+        cache->tail[list] = e;
+    }
+    cache->head[list] = e;
+    cache->len[list]++;
+}
+
+/**
+ * @brief write back an evicted dirty sector
+ *
+ * @param cache
+ * @param e
+ */
+static void tf_cache_ent_wb(tf_cache_t* cache, int32_t e) {
+    tf_cache_ent_t* ent = &cache->ents[e];
+
+    if (ent->dirty) {
+        if (cache->wb(cache->wb_ctx, ent->sec, 1, cache->data + (size_t)ent->slot * cache->sec_size) != 0) {
+            cache->wb_err = true;
+        }
+        ent->dirty = false;
+        cache->dirty_num--;
+    }
+}
+
+static void tf_cache_ent_free(tf_cache_t* cache, int32_t e) {
+    tf_cache_hash_del(cache, e);
+    cache->ents[e].next = cache->free_ent;
+    cache->free_ent     = e;
+}
+
+/**
+ * @brief get a free data slot, evict a sector when no free one
+ *
+ * @param cache
+ * @return int32_t slot id
+ */
+static int32_t tf_cache_reclaim(tf_cache_t* cache) {
+    if (cache->free_slot_num > 0) {
+        return cache->free_slots[--cache->free_slot_num];
+    }
+
+    int32_t e;
+    int32_t slot;
+
+    if (cache->len[TF_CACHE_LIST_A1IN] > cache->a1in_max || cache->len[TF_CACHE_LIST_AM] == 0) {
+        // page out A1in tail, remember it in A1out
+        e    = cache->tail[TF_CACHE_LIST_A1IN];
+        slot = cache->ents[e].slot;
+        tf_cache_ent_wb(cache, e);
+        tf_cache_list_del(cache, e);
+        cache->ents[e].slot = -1;
+        tf_cache_list_add(cache, e, TF_CACHE_LIST_A1OUT);
+
+        if (cache->len[TF_CACHE_LIST_A1OUT] > cache->a1out_max) {
+            e = cache->tail[TF_CACHE_LIST_A1OUT];
+            tf_cache_list_del(cache, e);
+            tf_cache_ent_free(cache, e);
+        }
+    } else {
+        // page out Am tail
+        e    = cache->tail[TF_CACHE_LIST_AM];
+        slot = cache->ents[e].slot;
+        tf_cache_ent_wb(cache, e);
+        tf_cache_list_del(cache, e);
+        tf_cache_ent_free(cache, e);
+    }
+
+    return slot;
+}
+
+
+int tf_cache_init(tf_cache_t* cache, uint32_t slot_num, uint16_t sec_size) {
+    memset(cache, 0, sizeof(tf_cache_t));
+
+    if (slot_num == 0) {
+        slot_num = 1;
+    }
+
+    cache->sec_size  = sec_size;
+    cache->slot_num  = slot_num;
+    cache->a1in_max  = slot_num / 4 > 0 ? slot_num / 4 : 1;
+    cache->a1out_max = slot_num / 2 > 0 ? slot_num / 2 : 1;
+    cache->ent_num   = slot_num + cache->a1out_max;
+
+    cache->hash_bits = 1;
+    while ((1u << cache->hash_bits) < cache->ent_num * 2) {
+        cache->hash_bits++;
+    }
+
+    cache->hash       = malloc(sizeof(int32_t) << cache->hash_bits);
+    cache->ents       = malloc(sizeof(tf_cache_ent_t) * cache->ent_num);
+    cache->free_slots = malloc(sizeof(int32_t) * slot_num);
+    cache->data       = malloc((size_t)slot_num * sec_size);
+    if (cache->hash == nullptr || cache->ents == nullptr || cache->free_slots == nullptr || cache->data == nullptr) {
+        tf_cache_deinit(cache);
+        return TF_ERR_NO_MEM;
+    }
+
+    memset(cache->hash, 0xFF, sizeof(int32_t) << cache->hash_bits);   // all -1
+
+    cache->free_ent = -1;
+    for (int32_t e = cache->ent_num - 1; e >= 0; e--) {
+        cache->ents[e].list = TF_CACHE_LIST_FREE;
+        cache->ents[e].next = cache->free_ent;
+        cache->free_ent     = e;
+    }
+
+    for (uint32_t i = 0; i < slot_num; i++) {
+        cache->free_slots[i] = slot_num - 1 - i;
+    }
+    cache->free_slot_num = slot_num;
+
+    for (int i = 0; i < TF_CACHE_LIST_NUM; i++) {
+        cache->head[i] = cache->tail[i] = -1;
+    }
+
+    return 0;
+}
+
+void tf_cache_deinit(tf_cache_t* cache) {
+    free(cache->hash);
+    free(cache->ents);
+    free(cache->free_slots);
+    free(cache->data);
+    memset(cache, 0, sizeof(tf_cache_t));
+}
+
+uint8_t* tf_cache_lookup(tf_cache_t* cache, uint32_t sec) {
+    int32_t e = tf_cache_find(cache, sec);
+
+    if (e < 0 || cache->ents[e].slot < 0) {
+        cache->miss++;
+        return nullptr;
+    }
+
+    // A1in hits are correlated references, keep the fifo order
+    if (cache->ents[e].list == TF_CACHE_LIST_AM) {
+        tf_cache_list_del(cache, e);
+        tf_cache_list_add(cache, e, TF_CACHE_LIST_AM);
+    }
+
+    cache->hit++;
+    return cache->data + (size_t)cache->ents[e].slot * cache->sec_size;
+}
+
+bool tf_cache_contains(tf_cache_t* cache, uint32_t sec) {
+    int32_t e = tf_cache_find(cache, sec);
+    return e >= 0 && cache->ents[e].slot >= 0;
+}
+
+uint8_t* tf_cache_insert(tf_cache_t* cache, uint32_t sec) {
+    int32_t slot = tf_cache_reclaim(cache);
+    int32_t e    = tf_cache_find(cache, sec);
+
+    if (e >= 0) {
+        // in A1out, it's hot
+        tf_cache_list_del(cache, e);
+        tf_cache_list_add(cache, e, TF_CACHE_LIST_AM);
+    } else {
+        e               = cache->free_ent;
+        cache->free_ent = cache->ents[e].next;
+
+        uint32_t h           = tf_cache_hash(cache, sec);
+        cache->ents[e].sec   = sec;
+        cache->ents[e].hnext = cache->hash[h];
+        cache->hash[h]       = e;
+        tf_cache_list_add(cache, e, TF_CACHE_LIST_A1IN);
+    }
+    cache->ents[e].slot  = slot;
+    cache->ents[e].dirty = false;
+
+    return cache->data + (size_t)slot * cache->sec_size;
+}
+
+void tf_cache_drop(tf_cache_t* cache, uint32_t sec) {
+    int32_t e = tf_cache_find(cache, sec);
+    if (e < 0) {
+        return;
+    }
+
+    if (cache->ents[e].slot >= 0) {
+        cache->free_slots[cache->free_slot_num++] = cache->ents[e].slot;
+    }
+    if (cache->ents[e].dirty) {
+        cache->ents[e].dirty = false;
+        cache->dirty_num--;
+    }
+    tf_cache_list_del(cache, e);
+    tf_cache_ent_free(cache, e);
+}
+
+void tf_cache_drop_clean(tf_cache_t* cache) {
+    for (uint32_t e = 0; e < cache->ent_num; e++) {
+        if (cache->ents[e].list != TF_CACHE_LIST_FREE && cache->ents[e].slot >= 0 && !cache->ents[e].dirty) {
+            cache->free_slots[cache->free_slot_num++] = cache->ents[e].slot;
+            tf_cache_list_del(cache, e);
+            tf_cache_ent_free(cache, e);
+        }
+    }
+}
+
+void tf_cache_mark_dirty(tf_cache_t* cache, uint32_t sec) {
+    int32_t e = tf_cache_find(cache, sec);
+
+    if (e >= 0 && cache->ents[e].slot >= 0 && !cache->ents[e].dirty) {
+        cache->ents[e].dirty = true;
+        cache->dirty_num++;
+    }
+}
+
+uint8_t* tf_cache_dirty_data(tf_cache_t* cache, uint32_t sec) {
+    int32_t e = tf_cache_find(cache, sec);
+
+    if (e < 0 || cache->ents[e].slot < 0 || !cache->ents[e].dirty) {
+        return nullptr;
+    }
+    return cache->data + (size_t)cache->ents[e].slot * cache->sec_size;
+}
+
+int tf_cache_clean(tf_cache_t* cache, uint32_t sec) {
+    int32_t e = tf_cache_find(cache, sec);
+
+    if (e < 0 || cache->ents[e].slot < 0 || !cache->ents[e].dirty) {
+        return 0;
+    }
+    if (cache->wb(cache->wb_ctx, sec, 1, cache->data + (size_t)cache->ents[e].slot * cache->sec_size) != 0) {
+        return -1;
+    }
+    cache->ents[e].dirty = false;
+    cache->dirty_num--;
+    return 0;
+}
+
+static int tf_cache_sec_cmp(const void* a, const void* b) {
+    uint32_t sa = ((const tf_cache_ent_t*)a)->sec;
+    uint32_t sb = ((const tf_cache_ent_t*)b)->sec;
+    return sa < sb ? -1 : sa > sb;
+}
+
+int tf_cache_flush(tf_cache_t* cache) {
+    int ret = cache->wb_err ? -1 : 0;
+
+    cache->wb_err = false;
+    if (cache->dirty_num == 0) {
+        return ret;
+    }
+
+    // dirty ones sorted by sector, slot is kept in the copy
+    tf_cache_ent_t* dirty = malloc(sizeof(tf_cache_ent_t) * cache->dirty_num);
+    uint8_t*        run   = malloc((size_t)TF_CACHE_FLUSH_RUN * cache->sec_size);
+    uint32_t        num   = 0;
+
+    for (uint32_t e = 0; e < cache->ent_num; e++) {
+        if (cache->ents[e].list != TF_CACHE_LIST_FREE && cache->ents[e].slot >= 0 && cache->ents[e].dirty) {
+            if (dirty != nullptr) {
+                dirty[num++] = cache->ents[e];
+            } else if (cache->wb(cache->wb_ctx, cache->ents[e].sec, 1,
+                                 cache->data + (size_t)cache->ents[e].slot * cache->sec_size) != 0) {
+                ret = -1;   // no memory to sort, one by one
+            }
+            cache->ents[e].dirty = false;
+        }
+    }
+    cache->dirty_num = 0;
+
+    if (dirty != nullptr) {
+        qsort(dirty, num, sizeof(tf_cache_ent_t), tf_cache_sec_cmp);
+    }
+
+    for (uint32_t i = 0; i < num;) {
+        uint32_t n = 1;
+
+        if (run != nullptr) {
+            memcpy(run, cache->data + (size_t)dirty[i].slot * cache->sec_size, cache->sec_size);
+            while (i + n < num && n < TF_CACHE_FLUSH_RUN && dirty[i + n].sec == dirty[i].sec + n) {
+                memcpy(run + (size_t)n * cache->sec_size, cache->data + (size_t)dirty[i + n].slot * cache->sec_size,
+                       cache->sec_size);
+                n++;
+            }
+        }
+
+        const uint8_t* data = run != nullptr ? run : cache->data + (size_t)dirty[i].slot * cache->sec_size;
+        if (cache->wb(cache->wb_ctx, dirty[i].sec, n, data) != 0) {
+            ret = -1;
+        }
+        i += n;
+    }
+
+    free(dirty);
+    free(run);
+    return ret;
+}
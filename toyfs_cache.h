@@ -0,0 +1,162 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/**
+ * sector cache with 2Q replacement
+ *
+ * new sectors enter the A1in fifo, re-referenced only after falling out of it (tracked by the
+ * A1out ghost list) they get into the Am lru, so one pass of a large file can't flush the hot
+ * sectors (FAT, dirs) out of the cache.
+ *
+ * a sector changed in cache is marked dirty and written back by the `wb` callback when it's
+ * evicted or at tf_cache_flush, which writes the continuous dirty sectors together.
+ */
+
+#define TF_CACHE_LIST_A1IN  0
+#define TF_CACHE_LIST_AM    1
+#define TF_CACHE_LIST_A1OUT 2   // ghost, no data
+#define TF_CACHE_LIST_NUM   3
+#define TF_CACHE_LIST_FREE  0xFF
+
+typedef struct {
+    uint32_t sec;     // sector id
+    int32_t  slot;    // data slot, -1 for ghost
+    int32_t  prev;    // list link
+    int32_t  next;    // list link, or free link
+    int32_t  hnext;   // hash chain
+    uint8_t  list;    // TF_CACHE_LIST_*
+    bool     dirty;   // changed, not written back yet
+} tf_cache_ent_t;
+
+/**
+ * @brief write back continuous sectors
+ *
+ * @return int 0, -1
+ */
+typedef int (*tf_cache_wb_t)(void* ctx, uint32_t sec, uint32_t sec_num, const uint8_t* data);
+
+typedef struct {
+    uint16_t sec_size;
+    uint32_t slot_num;   // sectors can be cached
+    uint32_t ent_num;    // slot_num + ghost num
+    uint32_t a1in_max;   // Kin
+    uint32_t a1out_max;  // Kout
+    uint8_t  hash_bits;
+
+    int32_t*        hash;
+    tf_cache_ent_t* ents;
+    int32_t*        free_slots;
+    uint32_t        free_slot_num;
+    int32_t         free_ent;
+    uint8_t*        data;   // slot_num * sec_size
+
+    int32_t  head[TF_CACHE_LIST_NUM];   // mru
+    int32_t  tail[TF_CACHE_LIST_NUM];   // lru
+    uint32_t len[TF_CACHE_LIST_NUM];
+
+    uint64_t hit;
+    uint64_t miss;
+
+    tf_cache_wb_t wb;          // nullptr for a read only cache
+    void*         wb_ctx;
+    uint32_t      dirty_num;
+    bool          wb_err;      // a write back of eviction failed, reported by tf_cache_flush
+} tf_cache_t;
+
+
+/**
+ * @brief init a cache, alloc all memory
+ *
+ * @param cache
+ * @param slot_num sectors can be cached
+ * @param sec_size sector size
+ * @return int 0, TF_ERR_NO_MEM
+ */
+int tf_cache_init(tf_cache_t* cache, uint32_t slot_num, uint16_t sec_size);
+
+/**
+ * @brief free all memory of cache
+ *
+ * @param cache
+ */
+void tf_cache_deinit(tf_cache_t* cache);
+
+/**
+ * @brief find a sector in cache
+ *
+ * @param cache
+ * @param sec sector id
+ * @return uint8_t* sector data, nullptr when miss
+ */
+uint8_t* tf_cache_lookup(tf_cache_t* cache, uint32_t sec);
+
+/**
+ * @brief check if a sector in cache, without touching the replacement state or counters
+ *
+ * @param cache
+ * @param sec sector id
+ * @return bool
+ */
+bool tf_cache_contains(tf_cache_t* cache, uint32_t sec);
+
+/**
+ * @brief alloc a slot for a missed sector, may evict another one
+ *
+ * @param cache
+ * @param sec sector id, should not in cache
+ * @return uint8_t* buffer to fill the sector data
+ */
+uint8_t* tf_cache_insert(tf_cache_t* cache, uint32_t sec);
+
+/**
+ * @brief mark a cached sector changed, it will be written back
+ *
+ * @param cache should have wb set
+ * @param sec sector id, should in cache
+ */
+void tf_cache_mark_dirty(tf_cache_t* cache, uint32_t sec);
+
+/**
+ * @brief get a sector changed in cache, without touching the replacement state or counters
+ *
+ * @param cache
+ * @param sec sector id
+ * @return uint8_t* sector data, nullptr when not in cache or not dirty
+ */
+uint8_t* tf_cache_dirty_data(tf_cache_t* cache, uint32_t sec);
+
+/**
+ * @brief write back a dirty sector, it stays in cache clean
+ *
+ * @param cache
+ * @param sec sector id
+ * @return int 0, -1 when the write back failed, the sector is still dirty then
+ */
+int tf_cache_clean(tf_cache_t* cache, uint32_t sec);
+
+/**
+ * @brief write back all dirty sectors, in sector order, continuous ones together
+ *
+ * @param cache
+ * @return int 0, -1 when any write back failed, including the ones of eviction since last flush
+ */
+int tf_cache_flush(tf_cache_t* cache);
+
+/**
+ * @brief remove a sector from cache, like when the data can't be filled, a dirty one is discarded
+ *
+ * @param cache
+ * @param sec sector id
+ */
+void tf_cache_drop(tf_cache_t* cache, uint32_t sec);
+
+/**
+ * @brief remove all clean sectors from cache, like when the disk is changed by others, the dirty
+ *        ones are kept
+ *
+ * @param cache
+ */
+void tf_cache_drop_clean(tf_cache_t* cache);
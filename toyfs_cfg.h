@@ -1,10 +1,41 @@
 #pragma once
 
 // config
-#define TF_MAX_FS_NUM          1
-#define TF_DEFALUT_SECTOR_SIZE 512
-#define TF_FN_LEN_MAX          13   // 8.3 + '\0'
-#define TF_SFN_LEN             12   // 8 + 3 + '\0'
-#define TF_LFN_SUPPORTTED      0    // lfn not supported
-#define TF_WITH_MBR            1    // set `1` for vhd file
+#define TF_MAX_FS_NUM          32             // volumes mounted at once
+#define TF_MAX_DEV_NUM         32
+#define TF_DEFALUT_SECTOR_SIZE 512            // sector size of MBR, the smallest one tried at mount
+#define TF_MAX_SECTOR_SIZE     4096           // sector size is BPB_BytsPerSec, up to this
+#define TF_FN_LEN_MAX          13             // 8.3 + '\0'
+#define TF_SFN_LEN             12             // 8 + 3 + '\0'
+#define TF_LFN_SUPPORTTED      0              // lfn not supported
+#define TF_WITH_MBR            1              // set `1` for vhd file
+#define TF_DISK_POSIX          1              // file, fd and mmap backends, need pread and mmap
+#define TF_DISK_AIO            0              // io_uring backend for batch reads, linux only, needs pthread
+#define TF_DISK_AIO_DEPTH      32             // reads in flight of the io_uring backend
+#define TF_DISK_AIO_THREADS    4              // pread threads when io_uring not supported
+#define TF_DISK_PATH_LEN       256            // path length of file backend
+#define TF_CACHE_SEC_NUM       256            // sectors in the sector cache of each fs, tf_mount_ex may set others
+#define TF_FATCACHE_SIZE       (256 * 1024)   // FAT cache memory budget of each fs, in bytes, so may tf_mount_ex
+#define TF_FATCACHE_WINDOW     8              // FAT sectors read at once when cache miss
+#define TF_FAT_RESIDENT        1              // load whole FAT at mount if it fits TF_FATCACHE_SIZE
+#define TF_CLUSMAP             1              // bitmap of used clusters, for allocation and tf_statfs
+#define TF_CLUSMAP_LAZY        0              // build the bitmap at the first allocation or tf_statfs, not at mount
+#define TF_FAT_SIMD            1              // SSE2/AVX2 kernels for scanning the whole FAT, x86 only, chosen at runtime
+#define TF_EXTMAP_NUM          16             // extent maps of files cached in each fs
+#define TF_DIR_INDEX           1              // index items of searched dirs by sfn hash
+#define TF_DIRIDX_NUM          8              // dir indexes cached in each fs
+#define TF_PATHCACHE_NUM       64             // opened paths cached in each fs, include not found ones
+#define TF_PATHCACHE_HASH      (TF_PATHCACHE_NUM * 2)
+#define TF_PATHCACHE_PATH_LEN  64             // longer paths are not cached
+#define TF_READAHEAD           1              // read ahead for sequential access
+#define TF_READAHEAD_MAX       16             // max readahead window, in clusters
+#define TF_READAHEAD_THREAD    0              // read ahead in a background thread of each fs
+#define TF_READAHEAD_QUEUE     16             // pending requests of the readahead thread
+#define TF_THREAD_SAFE         0              // many threads can open and read on the same fs
+#define TF_WALK_THREADS        8              // max threads of tf_walk, include the caller
+#define TF_STATS               1              // counters of each mount, see tf_get_stats
+#define TF_INDEX               1              // sidecar file of the tree and extents for warm mounts, posix only
+#define TF_TRACE               0              // latency tracepoints, see toyfs_trace.h, gcc/clang only
+#define TF_TRACE_RING_SIZE     65536          // latest events kept for tf_trace_export_chrome
+#define TF_CACHE_SHARD_NUM     (TF_THREAD_SAFE ? 8 : 1)   // sector cache split by sector id, each has a lock
 #define MY_DISK_ID             0
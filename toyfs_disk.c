@@ -1,14 +1,850 @@
 #include "toyfs.h"
 
+#if TF_DISK_POSIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if TF_DISK_POSIX && TF_DISK_AIO
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#endif
+
+
+// global
+static tf_disk_t disk_pool[TF_MAX_DEV_NUM] = {0};
+
+
+#if TF_DISK_POSIX
+/**
+ * @brief positional read, retry until all data read
+ *
+ * @return int 0, -1
+ */
+static int tf_disk_pread(int fd, uint8_t* data, uint32_t size, uint64_t ofs) {
+    while (size > 0) {
+        ssize_t n = pread(fd, data, size, ofs);
+        if (n <= 0) {
+            return -1;
+        }
+        data += n;
+        ofs += n;
+        size -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief positional write, retry until all data written
+ *
+ * @return int 0, -1
+ */
+static int tf_disk_pwrite(int fd, const uint8_t* data, uint32_t size, uint64_t ofs) {
+    while (size > 0) {
+        ssize_t n = pwrite(fd, data, size, ofs);
+        if (n <= 0) {
+            return -1;
+        }
+        data += n;
+        ofs += n;
+        size -= n;
+    }
+    return 0;
+}
+
+static int tf_disk_file_open(void* ctx) {
+    tf_disk_t* disk = ctx;
+
+    disk->fd = open(disk->path, O_RDWR);
+    if (disk->fd < 0) {
+        disk->fd = open(disk->path, O_RDONLY);   // writes will fail
+    }
+    return disk->fd < 0 ? -1 : 0;
+}
+
+static int tf_disk_file_close(void* ctx) {
+    tf_disk_t* disk = ctx;
+
+    close(disk->fd);
+    disk->fd = -1;
+    return 0;
+}
+
+static int tf_disk_fd_open(void* ctx) {
+    return 0;
+}
+
+static int tf_disk_fd_close(void* ctx) {
+    return 0;
+}
+
+static int tf_disk_fd_read(void* ctx, uint32_t sec, uint32_t sec_num, uint16_t sec_size, uint8_t* data) {
+    tf_disk_t* disk = ctx;
+
+    return tf_disk_pread(disk->fd, data, sec_num * sec_size, (uint64_t)sec * sec_size);
+}
+
+static int tf_disk_fd_write(void* ctx, uint32_t sec, uint32_t sec_num, uint16_t sec_size, const uint8_t* data) {
+    tf_disk_t* disk = ctx;
+
+    return tf_disk_pwrite(disk->fd, data, sec_num * sec_size, (uint64_t)sec * sec_size);
+}
+
+static const tf_disk_ops_t tf_disk_file_ops = {
+    .open  = tf_disk_file_open,
+    .read  = tf_disk_fd_read,
+    .write = tf_disk_fd_write,
+    .close = tf_disk_file_close,
+};
+
+static const tf_disk_ops_t tf_disk_fd_ops = {
+    .open  = tf_disk_fd_open,
+    .read  = tf_disk_fd_read,
+    .write = tf_disk_fd_write,
+    .close = tf_disk_fd_close,
+};
+
+
+#if TF_DISK_AIO
+typedef struct {
+    tf_disk_t* disk;
+    uint16_t   sec_size;
+
+    // io_uring, ring_fd is -1 when not supported, then the pool threads are used
+    int                  ring_fd;
+    uint32_t             depth;
+    uint8_t*             sq_ring;
+    size_t               sq_ring_size;
+    uint8_t*             cq_ring;
+    size_t               cq_ring_size;
+    struct io_uring_sqe* sqes;
+    size_t               sqes_size;
+    uint32_t*            sq_head;
+    uint32_t*            sq_tail;
+    uint32_t*            sq_mask;
+    uint32_t*            sq_array;
+    uint32_t*            cq_head;
+    uint32_t*            cq_tail;
+    uint32_t*            cq_mask;
+    struct io_uring_cqe* cqes;
+
+    // pread thread pool, the caller of a batch works too
+    pthread_t       threads[TF_DISK_AIO_THREADS];
+    uint32_t        thread_num;
+    pthread_mutex_t lock;        // one batch at a time
+    pthread_mutex_t job_lock;    // for the job_* fields
+    pthread_cond_t  job_cond;    // new jobs or stop
+    pthread_cond_t  done_cond;   // all jobs done
+    tf_disk_req_t*  jobs;
+    uint32_t        job_num;
+    uint32_t        job_next;
+    uint32_t        job_done;
+    bool            stop;
+} tf_disk_aio_t;
+
+static tf_disk_aio_t aio_pool[TF_MAX_DEV_NUM] = {0};
+
+
+/**
+ * @brief do a read of a batch with pread
+ *
+ * @param aio
+ * @param req
+ */
+static void tf_disk_aio_pread(tf_disk_aio_t* aio, tf_disk_req_t* req) {
+    req->ret = tf_disk_pread(aio->disk->fd, req->data, req->sec_num * aio->sec_size, (uint64_t)req->sec * aio->sec_size);
+}
+
+
+/**
+ * @brief free the io_uring of device
+ *
+ * @param aio
+ */
+static void tf_disk_uring_deinit(tf_disk_aio_t* aio) {
+    if (aio->sqes != nullptr && aio->sqes != MAP_FAILED) {
+        munmap(aio->sqes, aio->sqes_size);
+    }
+    if (aio->cq_ring != nullptr && aio->cq_ring != MAP_FAILED && aio->cq_ring != aio->sq_ring) {
+        munmap(aio->cq_ring, aio->cq_ring_size);
+    }
+    if (aio->sq_ring != nullptr && aio->sq_ring != MAP_FAILED) {
+        munmap(aio->sq_ring, aio->sq_ring_size);
+    }
+    if (aio->ring_fd >= 0) {
+        close(aio->ring_fd);
+    }
+    aio->ring_fd = -1;
+    aio->sq_ring = aio->cq_ring = nullptr;
+    aio->sqes    = nullptr;
+}
+
+
+/**
+ * @brief setup an io_uring and map its rings, by raw syscalls, no liburing needed
+ *
+ * @param aio
+ * @return int 0, -1 when io_uring not supported
+ */
+static int tf_disk_uring_init(tf_disk_aio_t* aio) {
+    struct io_uring_params p;
+
+    memset(&p, 0, sizeof(p));
+    aio->ring_fd = syscall(__NR_io_uring_setup, TF_DISK_AIO_DEPTH, &p);
+    if (aio->ring_fd < 0) {
+        aio->ring_fd = -1;
+        return -1;
+    }
+
+    aio->depth        = p.sq_entries;
+    aio->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    aio->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    aio->sqes_size    = p.sq_entries * sizeof(struct io_uring_sqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (aio->cq_ring_size > aio->sq_ring_size) {
+            aio->sq_ring_size = aio->cq_ring_size;
+        }
+        aio->cq_ring_size = aio->sq_ring_size;
+    }
+
+    aio->sq_ring = mmap(nullptr, aio->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, aio->ring_fd,
+                        IORING_OFF_SQ_RING);
+    if (aio->sq_ring == MAP_FAILED) {
+        goto err;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        aio->cq_ring = aio->sq_ring;
+    } else {
+        aio->cq_ring = mmap(nullptr, aio->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            aio->ring_fd, IORING_OFF_CQ_RING);
+        if (aio->cq_ring == MAP_FAILED) {
+            goto err;
+        }
+    }
+    aio->sqes = mmap(nullptr, aio->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, aio->ring_fd,
+                     IORING_OFF_SQES);
+    if (aio->sqes == MAP_FAILED) {
+        goto err;
+    }
+
+    aio->sq_head  = (uint32_t*)(aio->sq_ring + p.sq_off.head);
+    aio->sq_tail  = (uint32_t*)(aio->sq_ring + p.sq_off.tail);
+    aio->sq_mask  = (uint32_t*)(aio->sq_ring + p.sq_off.ring_mask);
+    aio->sq_array = (uint32_t*)(aio->sq_ring + p.sq_off.array);
+    aio->cq_head  = (uint32_t*)(aio->cq_ring + p.cq_off.head);
+    aio->cq_tail  = (uint32_t*)(aio->cq_ring + p.cq_off.tail);
+    aio->cq_mask  = (uint32_t*)(aio->cq_ring + p.cq_off.ring_mask);
+    aio->cqes     = (struct io_uring_cqe*)(aio->cq_ring + p.cq_off.cqes);
+
+    return 0;
+
+err:
+    tf_disk_uring_deinit(aio);
+    return -1;
+}
+
+
+/**
+ * @brief read a batch by io_uring, keep up to depth reads in flight
+ *
+ * a read failed or short in the ring is done again by pread, like on kernels without
+ * IORING_OP_READ; when the ring breaks, the rest are all done by pread
+ *
+ * @param aio
+ * @param reqs
+ * @param req_num
+ */
+static void tf_disk_uring_batch(tf_disk_aio_t* aio, tf_disk_req_t* reqs, uint32_t req_num) {
+    uint32_t next     = 0;
+    uint32_t inflight = 0;
+    uint32_t done     = 0;
+    bool     broken   = false;
+
+    for (uint32_t i = 0; i < req_num; i++) {
+        reqs[i].ret = 1;   // pending
+    }
+
+    while (done < req_num) {
+        uint32_t tail = *aio->sq_tail;   // only written by us
+
+        while (!broken && next < req_num && inflight < aio->depth) {
+            uint32_t             idx = tail & *aio->sq_mask;
+            struct io_uring_sqe* sqe = &aio->sqes[idx];
+
+            memset(sqe, 0, sizeof(struct io_uring_sqe));
+            sqe->opcode    = IORING_OP_READ;
+            sqe->fd        = aio->disk->fd;
+            sqe->addr      = (uintptr_t)reqs[next].data;
+            sqe->len       = reqs[next].sec_num * aio->sec_size;
+            sqe->off       = (uint64_t)reqs[next].sec * aio->sec_size;
+            sqe->user_data = next;
+            aio->sq_array[idx] = idx;
+
+            tail++;
+            next++;
+            inflight++;
+        }
+        __atomic_store_n(aio->sq_tail, tail, __ATOMIC_RELEASE);
+
+        if (inflight == 0) {
+            break;
+        }
+
+        // submit the new ones, and wait one done at least
+        uint32_t to_submit = tail - __atomic_load_n(aio->sq_head, __ATOMIC_ACQUIRE);
+        if (syscall(__NR_io_uring_enter, aio->ring_fd, to_submit, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 &&
+            errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            // the ones not taken by the kernel are done by pread later
+            uint32_t head = __atomic_load_n(aio->sq_head, __ATOMIC_ACQUIRE);
+            __atomic_store_n(aio->sq_tail, head, __ATOMIC_RELEASE);
+            next -= tail - head;
+            inflight -= tail - head;
+            broken = true;
+        }
+
+        uint32_t head = *aio->cq_head;   // only written by us
+        while (head != __atomic_load_n(aio->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe* cqe = &aio->cqes[head & *aio->cq_mask];
+            tf_disk_req_t*       req = &reqs[cqe->user_data];
+
+            if (cqe->res == (int32_t)(req->sec_num * aio->sec_size)) {
+                req->ret = 0;
+            } else {
+                tf_disk_aio_pread(aio, req);
+            }
+
+            head++;
+            inflight--;
+            done++;
+        }
+        __atomic_store_n(aio->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    for (uint32_t i = 0; i < req_num; i++) {
+        if (reqs[i].ret > 0) {
+            tf_disk_aio_pread(aio, &reqs[i]);
+        }
+    }
+}
+
+
+/**
+ * @brief take a job of the current batch and do it, called with job_lock held
+ *
+ * @param aio
+ */
+static void tf_disk_aio_job(tf_disk_aio_t* aio) {
+    tf_disk_req_t* req = &aio->jobs[aio->job_next++];
+
+    pthread_mutex_unlock(&aio->job_lock);
+    tf_disk_aio_pread(aio, req);
+    pthread_mutex_lock(&aio->job_lock);
+
+    if (++aio->job_done == aio->job_num) {
+        pthread_cond_signal(&aio->done_cond);
+    }
+}
+
+
+/**
+ * @brief pread thread of the pool
+ *
+ * @param arg aio
+ * @return void*
+ */
+static void* tf_disk_aio_worker(void* arg) {
+    tf_disk_aio_t* aio = arg;
+
+    pthread_mutex_lock(&aio->job_lock);
+    while (true) {
+        while (aio->job_next == aio->job_num && !aio->stop) {
+            pthread_cond_wait(&aio->job_cond, &aio->job_lock);
+        }
+        if (aio->stop) {
+            break;
+        }
+        tf_disk_aio_job(aio);
+    }
+    pthread_mutex_unlock(&aio->job_lock);
+
+    return nullptr;
+}
+
+
+/**
+ * @brief read a batch by the pread thread pool
+ *
+ * @param aio
+ * @param reqs
+ * @param req_num
+ */
+static void tf_disk_pool_batch(tf_disk_aio_t* aio, tf_disk_req_t* reqs, uint32_t req_num) {
+    pthread_mutex_lock(&aio->job_lock);
+
+    aio->jobs     = reqs;
+    aio->job_num  = req_num;
+    aio->job_next = 0;
+    aio->job_done = 0;
+    pthread_cond_broadcast(&aio->job_cond);
+
+    while (aio->job_next < aio->job_num) {
+        tf_disk_aio_job(aio);
+    }
+    while (aio->job_done < aio->job_num) {
+        pthread_cond_wait(&aio->done_cond, &aio->job_lock);
+    }
+
+    aio->jobs    = nullptr;
+    aio->job_num = aio->job_next = aio->job_done = 0;
+
+    pthread_mutex_unlock(&aio->job_lock);
+}
+
+
+static int tf_disk_aio_open(void* ctx) {
+    tf_disk_aio_t* aio = ctx;
+
+    if (tf_disk_file_open(aio->disk) != 0) {
+        return -1;
+    }
+
+    pthread_mutex_init(&aio->lock, nullptr);
+    pthread_mutex_init(&aio->job_lock, nullptr);
+    pthread_cond_init(&aio->job_cond, nullptr);
+    pthread_cond_init(&aio->done_cond, nullptr);
+    aio->stop       = false;
+    aio->thread_num = 0;
+
+    if (tf_disk_uring_init(aio) != 0) {
+        // no io_uring, like old kernels or forbidden by seccomp
+        while (aio->thread_num < TF_DISK_AIO_THREADS &&
+               pthread_create(&aio->threads[aio->thread_num], nullptr, tf_disk_aio_worker, aio) == 0) {
+            aio->thread_num++;
+        }
+    }
+
+    return 0;
+}
+
+static int tf_disk_aio_close(void* ctx) {
+    tf_disk_aio_t* aio = ctx;
+
+    pthread_mutex_lock(&aio->job_lock);
+    aio->stop = true;
+    pthread_cond_broadcast(&aio->job_cond);
+    pthread_mutex_unlock(&aio->job_lock);
+    for (uint32_t i = 0; i < aio->thread_num; i++) {
+        pthread_join(aio->threads[i], nullptr);
+    }
+    aio->thread_num = 0;
+
+    tf_disk_uring_deinit(aio);
+
+    pthread_cond_destroy(&aio->done_cond);
+    pthread_cond_destroy(&aio->job_cond);
+    pthread_mutex_destroy(&aio->job_lock);
+    pthread_mutex_destroy(&aio->lock);
+
+    return tf_disk_file_close(aio->disk);
+}
+
+static int tf_disk_aio_read(void* ctx, uint32_t sec, uint32_t sec_num, uint16_t sec_size, uint8_t* data) {
+    tf_disk_aio_t* aio = ctx;
+
+    return tf_disk_fd_read(aio->disk, sec, sec_num, sec_size, data);
+}
+
+static int tf_disk_aio_write(void* ctx, uint32_t sec, uint32_t sec_num, uint16_t sec_size, const uint8_t* data) {
+    tf_disk_aio_t* aio = ctx;
+
+    return tf_disk_fd_write(aio->disk, sec, sec_num, sec_size, data);
+}
+
+static int tf_disk_aio_read_batch(void* ctx, tf_disk_req_t* reqs, uint32_t req_num, uint16_t sec_size) {
+    tf_disk_aio_t* aio = ctx;
+
+    pthread_mutex_lock(&aio->lock);
+    aio->sec_size = sec_size;
+    if (aio->ring_fd >= 0) {
+        tf_disk_uring_batch(aio, reqs, req_num);
+    } else {
+        tf_disk_pool_batch(aio, reqs, req_num);
+    }
+    pthread_mutex_unlock(&aio->lock);
+
+    for (uint32_t i = 0; i < req_num; i++) {
+        if (reqs[i].ret != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static const tf_disk_ops_t tf_disk_aio_ops = {
+    .open       = tf_disk_aio_open,
+    .read       = tf_disk_aio_read,
+    .read_batch = tf_disk_aio_read_batch,
+    .write      = tf_disk_aio_write,
+    .close      = tf_disk_aio_close,
+};
+#endif
+#endif
+
+
+static int tf_disk_mem_open(void* ctx) {
+    return 0;
+}
+
+static int tf_disk_mem_close(void* ctx) {
+    return 0;
+}
+
+static int tf_disk_mem_read(void* ctx, uint32_t sec, uint32_t sec_num, uint16_t sec_size, uint8_t* data) {
+    tf_disk_t* disk = ctx;
+    uint64_t   ofs  = (uint64_t)sec * sec_size;
+    uint64_t   size = (uint64_t)sec_num * sec_size;
+
+    if (ofs + size > disk->mem_size) {
+        return -1;
+    }
+    memcpy(data, disk->mem + ofs, size);
+    return 0;
+}
+
+static int tf_disk_mem_write(void* ctx, uint32_t sec, uint32_t sec_num, uint16_t sec_size, const uint8_t* data) {
+    tf_disk_t* disk = ctx;
+    uint64_t   ofs  = (uint64_t)sec * sec_size;
+    uint64_t   size = (uint64_t)sec_num * sec_size;
+
+    if (ofs + size > disk->mem_size) {
+        return -1;
+    }
+    memcpy(disk->mem + ofs, data, size);
+    return 0;
+}
+
+static const tf_disk_ops_t tf_disk_mem_ops = {
+    .open  = tf_disk_mem_open,
+    .read  = tf_disk_mem_read,
+    .write = tf_disk_mem_write,
+    .close = tf_disk_mem_close,
+};
+
+
+#if TF_DISK_POSIX
+/**
+ * @brief map the whole image, shared, so the writes go to the file and the file is read by memcpy
+ */
+static int tf_disk_mmap_open(void* ctx) {
+    tf_disk_t* disk = ctx;
+
+    disk->mem_ro = false;
+    disk->fd     = open(disk->path, O_RDWR);
+    if (disk->fd < 0) {
+        disk->mem_ro = true;
+        disk->fd     = open(disk->path, O_RDONLY);
+    }
+    if (disk->fd < 0) {
+        return -1;
+    }
+
+    off_t size = lseek(disk->fd, 0, SEEK_END);   // st_size is 0 for a block device
+    if (size > 0) {
+        void* mem = mmap(nullptr, size, disk->mem_ro ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, disk->fd, 0);
+        if (mem != MAP_FAILED) {
+            disk->mem      = mem;
+            disk->mem_size = size;
+            return 0;
+        }
+    }
+
+    close(disk->fd);
+    disk->fd = -1;
+    return -1;
+}
+
+static int tf_disk_mmap_close(void* ctx) {
+    tf_disk_t* disk = ctx;
+
+    if (!disk->mem_ro) {
+        msync(disk->mem, disk->mem_size, MS_SYNC);
+    }
+    munmap(disk->mem, disk->mem_size);
+    close(disk->fd);
+    disk->mem      = nullptr;
+    disk->mem_size = 0;
+    disk->fd       = -1;
+    return 0;
+}
+
+static int tf_disk_mmap_write(void* ctx, uint32_t sec, uint32_t sec_num, uint16_t sec_size, const uint8_t* data) {
+    tf_disk_t* disk = ctx;
+
+    if (disk->mem_ro) {
+        return -1;
+    }
+    return tf_disk_mem_write(ctx, sec, sec_num, sec_size, data);
+}
+
+static const tf_disk_ops_t tf_disk_mmap_ops = {
+    .open  = tf_disk_mmap_open,
+    .read  = tf_disk_mem_read,
+    .write = tf_disk_mmap_write,
+    .close = tf_disk_mmap_close,
+};
+#endif
+
+
+/**
+ * @brief get a registered device
+ *
+ * @param dev device id
+ * @return tf_disk_t* nullptr if not registered
+ */
+static tf_disk_t* tf_disk_get(int dev) {
+    if (dev < 0 || dev >= TF_MAX_DEV_NUM || disk_pool[dev].ops == nullptr) {
+        return nullptr;
+    }
+    return &disk_pool[dev];
+}
+
+
+int tf_disk_register(int dev, const tf_disk_ops_t* ops, void* ctx) {
+    if (dev < 0 || dev >= TF_MAX_DEV_NUM || ops == nullptr) {
+        return TF_ERR_WRONG_PARAM;
+    }
+
+    tf_disk_t* disk = &disk_pool[dev];
+    if (disk->opened) {
+        return TF_ERR_DISK_BUSY;
+    }
+
+    memset(disk, 0, sizeof(tf_disk_t));
+    disk->ops = ops;
+    disk->ctx = ctx;
+    disk->fd  = -1;
+
+    return 0;
+}
+
+int tf_disk_file_register(int dev, const char* path) {
+#if TF_DISK_POSIX
+    if (dev < 0 || dev >= TF_MAX_DEV_NUM || path == nullptr || strlen(path) >= TF_DISK_PATH_LEN) {
+        return TF_ERR_WRONG_PARAM;
+    }
+
+    int ret = tf_disk_register(dev, &tf_disk_file_ops, &disk_pool[dev]);
+    if (ret == 0) {
+        strcpy(disk_pool[dev].path, path);
+    }
+    return ret;
+#else
+    return TF_ERR_WRONG_PARAM;
+#endif
+}
+
+int tf_disk_fd_register(int dev, int fd) {
+#if TF_DISK_POSIX
+    if (dev < 0 || dev >= TF_MAX_DEV_NUM || fd < 0) {
+        return TF_ERR_WRONG_PARAM;
+    }
+
+    int ret = tf_disk_register(dev, &tf_disk_fd_ops, &disk_pool[dev]);
+    if (ret == 0) {
+        disk_pool[dev].fd = fd;
+    }
+    return ret;
+#else
+    return TF_ERR_WRONG_PARAM;
+#endif
+}
+
+int tf_disk_aio_register(int dev, const char* path) {
+#if TF_DISK_POSIX && TF_DISK_AIO
+    if (dev < 0 || dev >= TF_MAX_DEV_NUM || path == nullptr || strlen(path) >= TF_DISK_PATH_LEN) {
+        return TF_ERR_WRONG_PARAM;
+    }
+
+    int ret = tf_disk_register(dev, &tf_disk_aio_ops, &aio_pool[dev]);
+    if (ret == 0) {
+        strcpy(disk_pool[dev].path, path);
+        memset(&aio_pool[dev], 0, sizeof(tf_disk_aio_t));
+        aio_pool[dev].disk    = &disk_pool[dev];
+        aio_pool[dev].ring_fd = -1;
+    }
+    return ret;
+#else
+    return TF_ERR_WRONG_PARAM;
+#endif
+}
+
+int tf_disk_mem_register(int dev, uint8_t* mem, uint64_t size) {
+    if (dev < 0 || dev >= TF_MAX_DEV_NUM || mem == nullptr) {
+        return TF_ERR_WRONG_PARAM;
+    }
+
+    int ret = tf_disk_register(dev, &tf_disk_mem_ops, &disk_pool[dev]);
+    if (ret == 0) {
+        disk_pool[dev].mem      = mem;
+        disk_pool[dev].mem_size = size;
+    }
+    return ret;
+}
+
+int tf_disk_mmap_register(int dev, const char* path) {
+#if TF_DISK_POSIX
+    if (dev < 0 || dev >= TF_MAX_DEV_NUM || path == nullptr || strlen(path) >= TF_DISK_PATH_LEN) {
+        return TF_ERR_WRONG_PARAM;
+    }
+
+    int ret = tf_disk_register(dev, &tf_disk_mmap_ops, &disk_pool[dev]);
+    if (ret == 0) {
+        strcpy(disk_pool[dev].path, path);
+    }
+    return ret;
+#else
+    return TF_ERR_WRONG_PARAM;
+#endif
+}
+
+int tf_disk_unregister(int dev) {
+    if (dev < 0 || dev >= TF_MAX_DEV_NUM) {
+        return TF_ERR_WRONG_PARAM;
+    }
+    if (disk_pool[dev].opened) {
+        return TF_ERR_DISK_BUSY;
+    }
+
+    memset(&disk_pool[dev], 0, sizeof(tf_disk_t));
+    return 0;
+}
+
+int tf_disk_open(int dev) {
+    tf_disk_t* disk = tf_disk_get(dev);
+    if (disk == nullptr) {
+        return TF_ERR_DISK_NOT_FOUND;
+    }
+    if (disk->opened) {
+        return TF_ERR_DISK_BUSY;
+    }
+
+    if (disk->ops->open(disk->ctx) != 0) {
+        return TF_ERR_DISK_IO;
+    }
+    disk->opened = true;
+#if TF_STATS
+    memset(&disk->stats, 0, sizeof(tf_disk_stats_t));
+#endif
+
+    return 0;
+}
+
+int tf_disk_close(int dev) {
+    tf_disk_t* disk = tf_disk_get(dev);
+    if (disk == nullptr || !disk->opened) {
+        return TF_ERR_DISK_NOT_FOUND;
+    }
+
+    disk->ops->close(disk->ctx);
+    disk->opened = false;
+
+    return 0;
+}
+
 int tf_disk_read_co(int dev, uint32_t sec, uint16_t sec_size, uint8_t* data) {
-    if (dev != MY_DISK_ID) {
+    return tf_disk_readn_co(dev, sec, 1, sec_size, data);
+}
+
+int tf_disk_readn_co(int dev, uint32_t sec, uint32_t sec_num, uint16_t sec_size, uint8_t* data) {
+    TF_TRACE_SCOPE(TF_TRACE_DISK_READ, sec);
+
+    tf_disk_t* disk = tf_disk_get(dev);
+    if (disk == nullptr || !disk->opened) {
+        return -1;
+    }
+
+#if TF_STATS
+    tf_atomic_add(&disk->stats.reads, 1);
+    tf_atomic_add(&disk->stats.read_secs, sec_num);
+#endif
+    return disk->ops->read(disk->ctx, sec, sec_num, sec_size, data);
+}
+
+int tf_disk_writen_co(int dev, uint32_t sec, uint32_t sec_num, uint16_t sec_size, const uint8_t* data) {
+    TF_TRACE_SCOPE(TF_TRACE_DISK_WRITE, sec);
+
+    tf_disk_t* disk = tf_disk_get(dev);
+    if (disk == nullptr || !disk->opened || disk->ops->write == nullptr) {
+        return -1;
+    }
+
+#if TF_STATS
+    tf_atomic_add(&disk->stats.writes, 1);
+    tf_atomic_add(&disk->stats.write_secs, sec_num);
+#endif
+    return disk->ops->write(disk->ctx, sec, sec_num, sec_size, data);
+}
+
+uint8_t* tf_disk_map(int dev, uint32_t sec, uint32_t sec_num, uint16_t sec_size) {
+    tf_disk_t* disk = tf_disk_get(dev);
+    if (disk == nullptr || !disk->opened || disk->mem == nullptr) {
+        return nullptr;
+    }
+    if ((uint64_t)sec * sec_size + (uint64_t)sec_num * sec_size > disk->mem_size) {
+        return nullptr;
+    }
+    return disk->mem + (uint64_t)sec * sec_size;
+}
+
+int tf_disk_read_batch(int dev, tf_disk_req_t* reqs, uint32_t req_num, uint16_t sec_size) {
+    TF_TRACE_SCOPE(TF_TRACE_DISK_READ, req_num);
+
+    tf_disk_t* disk = tf_disk_get(dev);
+    if (disk == nullptr || !disk->opened) {
         return -1;
     }
 
-    FILE* vhd = fopen("../fat32.vhd", "rb");   // vhd: MBR+FAT32
-    fseek(vhd, sec * sec_size, SEEK_SET);
-    fread(data, 1, sec_size, vhd);
-    fclose(vhd);
+#if TF_STATS
+    for (uint32_t i = 0; i < req_num; i++) {
+        tf_atomic_add(&disk->stats.reads, 1);
+        tf_atomic_add(&disk->stats.read_secs, reqs[i].sec_num);
+    }
+#endif
+    if (disk->ops->read_batch != nullptr) {
+        return disk->ops->read_batch(disk->ctx, reqs, req_num, sec_size);
+    }
+
+    int ret = 0;
+    for (uint32_t i = 0; i < req_num; i++) {
+        reqs[i].ret = disk->ops->read(disk->ctx, reqs[i].sec, reqs[i].sec_num, sec_size, reqs[i].data) == 0 ? 0 : -1;
+        if (reqs[i].ret != 0) {
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+#if TF_STATS
+int tf_disk_stats(int dev, tf_disk_stats_t* st, bool reset) {
+    tf_disk_t* disk = tf_disk_get(dev);
+    if (disk == nullptr) {
+        return TF_ERR_DISK_NOT_FOUND;
+    }
+
+    st->reads      = tf_atomic_load(&disk->stats.reads);
+    st->read_secs  = tf_atomic_load(&disk->stats.read_secs);
+    st->writes     = tf_atomic_load(&disk->stats.writes);
+    st->write_secs = tf_atomic_load(&disk->stats.write_secs);
+    if (reset) {
+        tf_atomic_store(&disk->stats.reads, 0);
+        tf_atomic_store(&disk->stats.read_secs, 0);
+        tf_atomic_store(&disk->stats.writes, 0);
+        tf_atomic_store(&disk->stats.write_secs, 0);
+    }
 
     return 0;
 }
+#endif
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "toyfs_cfg.h"
+
+
+typedef struct {
+    uint32_t sec;       // first sector id
+    uint32_t sec_num;   // sector count
+    uint8_t* data;      // data buffer, at least sec_num * sec_size
+    int      ret;       // result value, 0 or -1
+} tf_disk_req_t;
+
+/**
+ * @brief block device operations, one set per backend
+ *
+ * `open` is called once at tf_mount, `close` at tf_unmount, `read` is positional
+ * and may be called any times between them. all return 0 or a negative value.
+ * `read_batch` is optional, it keeps the reads in flight together and returns when all done,
+ * the device without it reads them one by one. `write` is optional, nullptr for read only device.
+ */
+typedef struct {
+    int (*open)(void* ctx);
+    int (*read)(void* ctx, uint32_t sec, uint32_t sec_num, uint16_t sec_size, uint8_t* data);
+    int (*read_batch)(void* ctx, tf_disk_req_t* reqs, uint32_t req_num, uint16_t sec_size);
+    int (*write)(void* ctx, uint32_t sec, uint32_t sec_num, uint16_t sec_size, const uint8_t* data);
+    int (*close)(void* ctx);
+} tf_disk_ops_t;
+
+#if TF_STATS
+typedef struct {
+    uint64_t reads;        // read requests, each one of a batch
+    uint64_t read_secs;
+    uint64_t writes;       // write requests
+    uint64_t write_secs;
+} tf_disk_stats_t;
+#endif
+
+typedef struct {
+    const tf_disk_ops_t* ops;   // nullptr means not registered
+    void*                ctx;   // backend private data
+    bool                 opened;
+
+    // builtin backends
+    int      fd;
+    char     path[TF_DISK_PATH_LEN];
+    uint8_t* mem;      // the image, of the memory backend or mapped by the mmap one
+    uint64_t mem_size;
+    bool     mem_ro;   // mapped read only
+
+#if TF_STATS
+    tf_disk_stats_t stats;   // since opened
+#endif
+} tf_disk_t;
+
+
+/**
+ * @brief register a device with custom operations
+ *
+ * @param dev device id, < TF_MAX_DEV_NUM
+ * @param ops backend operations, should be valid until unregistered
+ * @param ctx passed to every operation
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_DISK_BUSY
+ */
+int tf_disk_register(int dev, const tf_disk_ops_t* ops, void* ctx);
+
+/**
+ * @brief register a device backed by an image file, opened once at mount, read only when the
+ *        file is not writable
+ *
+ * @param dev device id
+ * @param path image file path, like "../fat32.vhd"
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_DISK_BUSY
+ */
+int tf_disk_file_register(int dev, const char* path);
+
+/**
+ * @brief register a device backed by an opened file descriptor, the fd is not closed at unmount
+ *
+ * @param dev device id
+ * @param fd raw fd, like a block device or an image file
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_DISK_BUSY
+ */
+int tf_disk_fd_register(int dev, int fd);
+
+/**
+ * @brief register a device backed by an image file, batch reads go through io_uring, or a pread
+ *        thread pool when the kernel has no io_uring
+ *
+ * @param dev device id
+ * @param path image file path
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_DISK_BUSY
+ */
+int tf_disk_aio_register(int dev, const char* path);
+
+/**
+ * @brief register a device backed by a memory buffer
+ *
+ * @param dev device id
+ * @param mem the whole disk image
+ * @param size byte size of mem
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_DISK_BUSY
+ */
+int tf_disk_mem_register(int dev, uint8_t* mem, uint64_t size);
+
+/**
+ * @brief register a device backed by an image file mapped in memory, mapped once at mount and read by
+ *        memcpy, read only when the file is not writable; tf_file_map gets pointers into it
+ *
+ * @param dev device id
+ * @param path image file or block device path
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_DISK_BUSY
+ */
+int tf_disk_mmap_register(int dev, const char* path);
+
+/**
+ * @brief unregister a device, should not be mounted
+ *
+ * @param dev device id
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_DISK_BUSY
+ */
+int tf_disk_unregister(int dev);
+
+/**
+ * @brief open a registered device, called by tf_mount
+ *
+ * @param dev device id
+ * @return int 0, TF_ERR_DISK_NOT_FOUND, TF_ERR_DISK_IO
+ */
+int tf_disk_open(int dev);
+
+/**
+ * @brief close a device, called by tf_unmount
+ *
+ * @param dev device id
+ * @return int 0, TF_ERR_DISK_NOT_FOUND
+ */
+int tf_disk_close(int dev);
+
+/**
+ * @brief read a sector from disk
+ *
+ * @param dev device id
+ * @param sec sector id
+ * @param sec_size sector size
+ * @param data data buffer
+ * @return int 0，-1
+ */
+int tf_disk_read_co(int dev, uint32_t sec, uint16_t sec_size, uint8_t* data);
+
+/**
+ * @brief read continuous sectors from disk in one request
+ *
+ * @param dev device id
+ * @param sec first sector id
+ * @param sec_num sector count
+ * @param sec_size sector size
+ * @param data data buffer, at least sec_num * sec_size
+ * @return int 0，-1
+ */
+int tf_disk_readn_co(int dev, uint32_t sec, uint32_t sec_num, uint16_t sec_size, uint8_t* data);
+
+/**
+ * @brief get the address of continuous sectors of a device in memory, the mmap and memory backends
+ *
+ * @param dev device id
+ * @param sec first sector id
+ * @param sec_num sector count
+ * @param sec_size sector size
+ * @return uint8_t* valid until the device is closed, nullptr when not opened, not in memory, or beyond
+ *                  the device
+ */
+uint8_t* tf_disk_map(int dev, uint32_t sec, uint32_t sec_num, uint16_t sec_size);
+
+/**
+ * @brief read several sector ranges from disk, in flight together when the device supports
+ *
+ * @param dev device id
+ * @param reqs the reads, ret of each is set
+ * @param req_num count of reqs
+ * @param sec_size sector size
+ * @return int 0 when all done, -1
+ */
+int tf_disk_read_batch(int dev, tf_disk_req_t* reqs, uint32_t req_num, uint16_t sec_size);
+
+/**
+ * @brief write continuous sectors to disk in one request
+ *
+ * @param dev device id
+ * @param sec first sector id
+ * @param sec_num sector count
+ * @param sec_size sector size
+ * @param data at least sec_num * sec_size
+ * @return int 0，-1 also when the device is read only
+ */
+int tf_disk_writen_co(int dev, uint32_t sec, uint32_t sec_num, uint16_t sec_size, const uint8_t* data);
+
+#if TF_STATS
+/**
+ * @brief get the request counters of a device since opened
+ *
+ * @param dev device id
+ * @param st result value
+ * @param reset clear the counters after got
+ * @return int 0, TF_ERR_DISK_NOT_FOUND
+ */
+int tf_disk_stats(int dev, tf_disk_stats_t* st, bool reset);
+#endif
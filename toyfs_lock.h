@@ -0,0 +1,53 @@
+#pragma once
+
+#include "toyfs_cfg.h"
+
+
+/**
+ * locks of the library, compiled out when not TF_THREAD_SAFE
+ *
+ * lock hierarchy, always take the outer one first:
+ *   fs_pool_lock > fs->write_lock > fs->meta_lock > fs->ra_lock > fs->fat_lock > fs->cache_lock[]
+ * fs_pool_lock only guards claiming and freeing the fs slots, a mounted fs is found by label or device
+ * without it, and each fs has its own locks, so volumes never wait for each other.
+ * disk io is never done with fs->meta_lock held, nor with fs->cache_lock[] held except writing back
+ * the dirty sectors evicted or flushed.
+ */
+
+#if TF_THREAD_SAFE || TF_READAHEAD_THREAD
+#include <pthread.h>
+
+typedef pthread_mutex_t tf_mutex_t;
+
+#define TF_MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+#define tf_mutex_init(m)     pthread_mutex_init(m, NULL)
+#define tf_mutex_deinit(m)   pthread_mutex_destroy(m)
+#define tf_mutex_lock(m)     pthread_mutex_lock(m)
+#define tf_mutex_trylock(m)  pthread_mutex_trylock(m)   // 0 when locked
+#define tf_mutex_unlock(m)   pthread_mutex_unlock(m)
+
+// counters updated without a lock
+#define tf_atomic_add(p, n)   __atomic_fetch_add(p, n, __ATOMIC_RELAXED)
+#define tf_atomic_load(p)     __atomic_load_n(p, __ATOMIC_RELAXED)
+#define tf_atomic_store(p, v) __atomic_store_n(p, v, __ATOMIC_RELAXED)
+
+// pointers published to readers without a lock
+#define tf_atomic_load_acq(p)     __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define tf_atomic_store_rel(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#else
+typedef char tf_mutex_t;
+
+#define TF_MUTEX_INITIALIZER 0
+#define tf_mutex_init(m)     ((void)(m))
+#define tf_mutex_deinit(m)   ((void)(m))
+#define tf_mutex_lock(m)     ((void)(m))
+#define tf_mutex_trylock(m)  ((void)(m), 0)
+#define tf_mutex_unlock(m)   ((void)(m))
+
+#define tf_atomic_add(p, n)   (*(p) += (n))
+#define tf_atomic_load(p)     (*(p))
+#define tf_atomic_store(p, v) (*(p) = (v))
+
+#define tf_atomic_load_acq(p)     (*(p))
+#define tf_atomic_store_rel(p, v) (*(p) = (v))
+#endif
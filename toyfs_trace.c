@@ -0,0 +1,251 @@
+#include "toyfs_trace.h"
+
+#if TF_TRACE
+#include <time.h>
+
+#include "toyfs.h"
+
+
+#define TF_TRACE_SUB_BITS 4
+#define TF_TRACE_SUB      (1u << TF_TRACE_SUB_BITS)   // buckets in each power of 2
+#define TF_TRACE_BKT_NUM  (TF_TRACE_SUB + (64 - TF_TRACE_SUB_BITS) * TF_TRACE_SUB)
+
+typedef struct {
+    uint64_t         seq;   // index of the event + 1, 0 while being written
+    tf_trace_event_t ev;
+} tf_trace_slot_t;
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;   // + 1, 0 when no event
+    uint64_t max;
+    uint64_t bkts[TF_TRACE_BKT_NUM];
+} tf_trace_hist_t;
+
+static const char* const trace_names[TF_TRACE_POINT_NUM] = {
+    [TF_TRACE_MOUNT]          = "mount",
+    [TF_TRACE_UNMOUNT]        = "unmount",
+    [TF_TRACE_OPEN]           = "open",
+    [TF_TRACE_DIR_READ]       = "dir_read",
+    [TF_TRACE_DIR_READ_BATCH] = "dir_read_batch",
+    [TF_TRACE_FILE_READ]      = "file_read",
+    [TF_TRACE_FILE_PREAD]     = "file_pread",
+    [TF_TRACE_FILE_MAP]       = "file_map",
+    [TF_TRACE_READ_BATCH]     = "read_batch",
+    [TF_TRACE_FILE_WRITE]     = "file_write",
+    [TF_TRACE_SYNC]           = "sync",
+    [TF_TRACE_LOOKUP]         = "lookup",
+    [TF_TRACE_PREFETCH]       = "prefetch",
+    [TF_TRACE_NEXT_CLUS]      = "next_clus",
+    [TF_TRACE_DISK_READ]      = "disk_read",
+    [TF_TRACE_DISK_WRITE]     = "disk_write",
+};
+
+static bool              trace_on = true;
+static uint64_t          trace_head;   // events ever recorded, the next index
+static uint16_t          trace_tid_last;
+static __thread uint16_t trace_tid;
+static tf_trace_slot_t   trace_ring[TF_TRACE_RING_SIZE];
+static tf_trace_hist_t   trace_hist[TF_TRACE_POINT_NUM];
+
+
+static uint64_t tf_trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static uint32_t tf_trace_bkt(uint64_t v) {
+    if (v < TF_TRACE_SUB) {
+        return v;
+    }
+
+    uint32_t e = 63 - __builtin_clzll(v);   // >= TF_TRACE_SUB_BITS
+    return TF_TRACE_SUB + (e - TF_TRACE_SUB_BITS) * TF_TRACE_SUB + ((v >> (e - TF_TRACE_SUB_BITS)) & (TF_TRACE_SUB - 1));
+}
+
+/**
+ * @brief the max value counted in a bucket
+ */
+static uint64_t tf_trace_bkt_max(uint32_t b) {
+    if (b < TF_TRACE_SUB) {
+        return b;
+    }
+
+    uint32_t shift = (b - TF_TRACE_SUB) / TF_TRACE_SUB;
+    uint64_t sub   = (b - TF_TRACE_SUB) % TF_TRACE_SUB;
+    return ((TF_TRACE_SUB + sub) << shift) + ((1ull << shift) - 1);
+}
+
+static void tf_trace_hist_add(tf_trace_hist_t* hist, uint64_t dur) {
+    __atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->sum, dur, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->bkts[tf_trace_bkt(dur)], 1, __ATOMIC_RELAXED);
+
+    uint64_t v = __atomic_load_n(&hist->min, __ATOMIC_RELAXED);
+    while ((v == 0 || dur + 1 < v) &&
+           !__atomic_compare_exchange_n(&hist->min, &v, dur + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    v = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+    while (dur > v && !__atomic_compare_exchange_n(&hist->max, &v, dur, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+/**
+ * @brief put an event in the ring, the oldest one is overwritten when full
+ *
+ * the slot is written like a seqlock, its seq is cleared first and set to the index + 1 at last, so
+ * tf_trace_snapshot can tell a torn event from a complete one.
+ */
+static void tf_trace_record(uint16_t point, uint64_t start, uint64_t dur, uint32_t arg) {
+    if (trace_tid == 0) {
+        trace_tid = __atomic_add_fetch(&trace_tid_last, 1, __ATOMIC_RELAXED);
+    }
+
+    uint64_t         idx  = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+    tf_trace_slot_t* slot = &trace_ring[idx % TF_TRACE_RING_SIZE];
+
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&slot->ev.start, start, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->ev.dur, dur > UINT32_MAX ? UINT32_MAX : (uint32_t)dur, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->ev.arg, arg, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->ev.point, point, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->ev.tid, trace_tid, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->seq, idx + 1, __ATOMIC_RELEASE);
+
+    tf_trace_hist_add(&trace_hist[point], dur);
+}
+
+
+uint64_t tf_trace_begin(void) {
+    return __atomic_load_n(&trace_on, __ATOMIC_RELAXED) ? tf_trace_now() : 0;
+}
+
+void tf_trace_scope_end(tf_trace_scope_t* scope) {
+    if (scope->t0 != 0) {
+        tf_trace_record(scope->point, scope->t0, tf_trace_now() - scope->t0, scope->arg);
+    }
+}
+
+void tf_trace_enable(bool on) {
+    __atomic_store_n(&trace_on, on, __ATOMIC_RELAXED);
+}
+
+void tf_trace_reset(void) {
+    for (uint32_t i = 0; i < TF_TRACE_RING_SIZE; i++) {
+        __atomic_store_n(&trace_ring[i].seq, 0, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&trace_head, 0, __ATOMIC_RELAXED);
+    memset(trace_hist, 0, sizeof(trace_hist));
+}
+
+int tf_trace_snapshot(tf_trace_event_t* evs, uint32_t num) {
+    uint64_t head  = __atomic_load_n(&trace_head, __ATOMIC_RELAXED);
+    uint64_t first = head > TF_TRACE_RING_SIZE ? head - TF_TRACE_RING_SIZE : 0;
+    int      n     = 0;
+
+    if (head - first > num) {
+        first = head - num;
+    }
+
+    for (uint64_t i = first; i < head; i++) {
+        tf_trace_slot_t* slot = &trace_ring[i % TF_TRACE_RING_SIZE];
+        tf_trace_event_t ev;
+
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != i + 1) {
+            continue;   // not done yet, or overwritten by a newer one
+        }
+        ev.start = __atomic_load_n(&slot->ev.start, __ATOMIC_RELAXED);
+        ev.dur   = __atomic_load_n(&slot->ev.dur, __ATOMIC_RELAXED);
+        ev.arg   = __atomic_load_n(&slot->ev.arg, __ATOMIC_RELAXED);
+        ev.point = __atomic_load_n(&slot->ev.point, __ATOMIC_RELAXED);
+        ev.tid   = __atomic_load_n(&slot->ev.tid, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != i + 1) {
+            continue;
+        }
+        evs[n++] = ev;
+    }
+
+    return n;
+}
+
+int tf_trace_export_chrome(FILE* fp) {
+    if (fp == nullptr) {
+        return TF_ERR_WRONG_PARAM;
+    }
+
+    tf_trace_event_t* evs = malloc(sizeof(tf_trace_event_t) * TF_TRACE_RING_SIZE);
+    if (evs == nullptr) {
+        return TF_ERR_NO_MEM;
+    }
+
+    int      num  = tf_trace_snapshot(evs, TF_TRACE_RING_SIZE);
+    uint64_t base = UINT64_MAX;
+    for (int i = 0; i < num; i++) {
+        if (evs[i].start < base) {
+            base = evs[i].start;
+        }
+    }
+
+    // complete events, times in us
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (int i = 0; i < num; i++) {
+        uint64_t ts = evs[i].start - base;
+        fprintf(fp,
+                "%s\n{\"name\":\"%s\",\"cat\":\"toyfs\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%llu.%03u,"
+                "\"dur\":%u.%03u,\"args\":{\"arg\":%u}}",
+                i > 0 ? "," : "", trace_names[evs[i].point], evs[i].tid, (unsigned long long)(ts / 1000),
+                (unsigned)(ts % 1000), evs[i].dur / 1000, evs[i].dur % 1000, evs[i].arg);
+    }
+    fprintf(fp, "\n]}\n");
+
+    free(evs);
+    return ferror(fp) ? TF_ERR_DISK_IO : 0;
+}
+
+int tf_trace_export_hist(FILE* fp) {
+    if (fp == nullptr) {
+        return TF_ERR_WRONG_PARAM;
+    }
+
+    for (int p = 0; p < TF_TRACE_POINT_NUM; p++) {
+        tf_trace_hist_t* hist  = &trace_hist[p];
+        uint64_t         count = __atomic_load_n(&hist->count, __ATOMIC_RELAXED);
+        uint64_t         total = 0;
+
+        if (count == 0) {
+            continue;
+        }
+
+        fprintf(fp, "# %s: count %llu, min %llu ns, mean %.1f ns, max %llu ns\n", trace_names[p],
+                (unsigned long long)count, (unsigned long long)__atomic_load_n(&hist->min, __ATOMIC_RELAXED) - 1,
+                (double)__atomic_load_n(&hist->sum, __ATOMIC_RELAXED) / count,
+                (unsigned long long)__atomic_load_n(&hist->max, __ATOMIC_RELAXED));
+        fprintf(fp, "%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+
+        // bucket counts may run ahead of count while recording, the last line is at 100%
+        for (uint32_t b = 0; b < TF_TRACE_BKT_NUM && total < count; b++) {
+            uint64_t n = __atomic_load_n(&hist->bkts[b], __ATOMIC_RELAXED);
+            if (n == 0) {
+                continue;
+            }
+
+            total      = total + n < count ? total + n : count;
+            double pct = (double)total / count;
+            if (total < count) {
+                fprintf(fp, "%12llu %14.12f %10llu %14.2f\n", (unsigned long long)tf_trace_bkt_max(b), pct,
+                        (unsigned long long)total, 1 / (1 - pct));
+            } else {
+                fprintf(fp, "%12llu %14.12f %10llu %14s\n", (unsigned long long)tf_trace_bkt_max(b), pct,
+                        (unsigned long long)total, "inf");
+            }
+        }
+        fprintf(fp, "\n");
+    }
+
+    return ferror(fp) ? TF_ERR_DISK_IO : 0;
+}
+#endif
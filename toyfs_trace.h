@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "toyfs_cfg.h"
+
+
+/**
+ * latency tracing, compiled out when not TF_TRACE
+ *
+ * a traced scope takes the time at its start and records an event at its end, whatever the return
+ * path is (gcc/clang cleanup attribute). events go to a lock-free ring, the latest TF_TRACE_RING_SIZE
+ * ones are kept for tf_trace_export_chrome, and every event is counted in the log-linear histogram of
+ * its tracepoint for tf_trace_export_hist.
+ */
+
+typedef enum {
+    TF_TRACE_MOUNT,            // arg is the device, so are unmount and sync
+    TF_TRACE_UNMOUNT,
+    TF_TRACE_OPEN,
+    TF_TRACE_DIR_READ,
+    TF_TRACE_DIR_READ_BATCH,   // arg is the max items
+    TF_TRACE_FILE_READ,        // arg is the size wanted, so are pread, map and write
+    TF_TRACE_FILE_PREAD,
+    TF_TRACE_FILE_MAP,
+    TF_TRACE_READ_BATCH,       // arg is the request count
+    TF_TRACE_FILE_WRITE,
+    TF_TRACE_SYNC,
+    TF_TRACE_LOOKUP,           // a path component in a dir, arg is the dir cluster
+    TF_TRACE_PREFETCH,         // tf_item_data_prefetch, arg is the item offset
+    TF_TRACE_NEXT_CLUS,        // tf_next_cluster, arg is the cluster
+    TF_TRACE_DISK_READ,        // arg is the sector, or the request count of a batch
+    TF_TRACE_DISK_WRITE,       // arg is the sector
+    TF_TRACE_POINT_NUM,
+} tf_trace_point_t;
+
+typedef struct {
+    uint64_t start;   // ns, monotonic clock
+    uint32_t dur;     // ns
+    uint32_t arg;
+    uint16_t point;
+    uint16_t tid;     // small id of the thread, from 1
+} tf_trace_event_t;
+
+#if TF_TRACE
+typedef struct {
+    uint64_t t0;
+    uint32_t arg;
+    uint16_t point;
+} tf_trace_scope_t;
+
+uint64_t tf_trace_begin(void);
+void     tf_trace_scope_end(tf_trace_scope_t* scope);
+
+#define TF_TRACE_SCOPE(point, arg)                                                                                     \
+    tf_trace_scope_t tf_trace_scope __attribute__((cleanup(tf_trace_scope_end))) = {tf_trace_begin(), (arg), (point)}
+
+/**
+ * @brief pause or resume tracing, scopes started while paused are not recorded
+ *
+ * @param on true to record, it's on from the start
+ */
+void tf_trace_enable(bool on);
+
+/**
+ * @brief drop the recorded events and clear the histograms, should not run with traced calls
+ */
+void tf_trace_reset(void);
+
+/**
+ * @brief copy the latest events out of the ring, oldest first
+ *
+ * @param evs result value
+ * @param num max events to copy
+ * @return int events copied, the ones being written or overwritten while copying are skipped
+ */
+int tf_trace_snapshot(tf_trace_event_t* evs, uint32_t num);
+
+/**
+ * @brief write the events in the ring as Chrome trace event JSON, for chrome://tracing or Perfetto
+ *
+ * @param fp opened for writing
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_NO_MEM, TF_ERR_DISK_IO when writing failed
+ */
+int tf_trace_export_chrome(FILE* fp);
+
+/**
+ * @brief write the latency histogram of each tracepoint with events, in the percentile format of
+ *        HdrHistogram (.hgrm), values are in ns and within 1/16 of the real ones
+ *
+ * @param fp opened for writing
+ * @return int 0, TF_ERR_WRONG_PARAM, TF_ERR_DISK_IO when writing failed
+ */
+int tf_trace_export_hist(FILE* fp);
+#else
+#define TF_TRACE_SCOPE(point, arg)
+#endif
@@ -125,3 +125,31 @@ uint32_t util_get_value_from_block(uint8_t* block, int ofs, int size) {
     }
     return value;
 }
+
+/**
+ * @brief set the value to block data, little endian
+ *
+ * @param block
+ * @param ofs
+ * @param size <= 4
+ * @param value
+ */
+void util_set_value_to_block(uint8_t* block, int ofs, int size, uint32_t value) {
+    for (int i = 0; i < size; i++) {
+        block[ofs + i] = value >> (8 * i);
+    }
+}
+
+/**
+ * @brief hash of a string, FNV-1a
+ *
+ * @param str
+ * @return uint32_t
+ */
+uint32_t util_str_hash(const char* str) {
+    uint32_t h = 2166136261u;
+    while (*str != '\0') {
+        h = (h ^ (uint8_t)*str++) * 16777619u;
+    }
+    return h;
+}
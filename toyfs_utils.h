@@ -19,9 +19,9 @@
 #endif
 
 
-#define util_bitmap_set(u32bitmap, pos) u32bitmap[pos >> 5] |= ((uint32_t)0x1 << (pos & 0x1F))
-#define util_bitmap_clr(u32bitmap, pos) u32bitmap[pos >> 5] &= ~((uint32_t)0x1 << (pos & 0x1F))
-#define util_bitmap_chk(u32bitmap, pos) (u32bitmap[pos >> 5] & ((uint32_t)0x1 << (pos & 0x1F)))
+#define util_bitmap_set(u32bitmap, pos) (u32bitmap)[(pos) >> 5] |= ((uint32_t)0x1 << ((pos) & 0x1F))
+#define util_bitmap_clr(u32bitmap, pos) (u32bitmap)[(pos) >> 5] &= ~((uint32_t)0x1 << ((pos) & 0x1F))
+#define util_bitmap_chk(u32bitmap, pos) ((u32bitmap)[(pos) >> 5] & ((uint32_t)0x1 << ((pos) & 0x1F)))
 
 
 void     util_dump(uint8_t* block, int size);
@@ -29,3 +29,5 @@ void     util_name2sfn(const char* name, char* sfn);
 void     util_sfn2name(const char* sfn, char* name);
 int      util_get_1st_subpath(const char* subpath, char* name);
 uint32_t util_get_value_from_block(uint8_t* block, int ofs, int size);
+void     util_set_value_to_block(uint8_t* block, int ofs, int size, uint32_t value);
+uint32_t util_str_hash(const char* str);